@@ -24,6 +24,9 @@
 #include "DemoPostEffectBlur.h"
 #include "DemoUI.h"
 #include "DemoShadowMap.h"
+#include "DemoCmdRecord.h"
+#include "DemoTransformUpdate.h"
+#include "DemoInstancing.h"
 #include "graphics/Display.h"
 #include "graphics/Camera.h"
 #include "ui/CanvasRenderer.h"
@@ -57,7 +60,7 @@ namespace Viry3D
             auto canvas = RefMake<CanvasRenderer>();
             m_camera->AddRenderer(canvas);
 
-            Vector<String> titles({ "Mesh", "SkinnedMesh", "Skybox", "RenderToTexture", "FXAA", "PostEffectBlur", "UI", "ShadowMap" });
+            Vector<String> titles({ "Mesh", "SkinnedMesh", "Skybox", "RenderToTexture", "FXAA", "PostEffectBlur", "UI", "ShadowMap", "CmdRecord", "TransformUpdate", "Instancing" });
 
 #if VR_WINDOWS || VR_MAC
             float scale = 0.4f;
@@ -117,6 +120,15 @@ namespace Viry3D
                 case 7:
                     m_demo = new DemoShadowMap();
                     break;
+                case 8:
+                    m_demo = new DemoCmdRecord();
+                    break;
+                case 9:
+                    m_demo = new DemoTransformUpdate();
+                    break;
+                case 10:
+                    m_demo = new DemoInstancing();
+                    break;
                 default:
                     break;
             }
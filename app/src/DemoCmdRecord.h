@@ -0,0 +1,139 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "DemoMesh.h"
+#include "Debug.h"
+
+namespace Viry3D
+{
+    // measures secondary cmd record time against renderer count,
+    // every frame forces a full re-record of all renderer cmds
+    class DemoCmdRecord : public DemoMesh
+    {
+    public:
+        Vector<int> m_steps = Vector<int>({ 100, 500, 1000, 2000, 5000, 10000 });
+        int m_step = -1;
+        int m_frame = 0;
+        float m_record_ms_sum = 0;
+        Ref<Shader> m_shader;
+        Ref<Mesh> m_cube;
+
+        void InitRecord()
+        {
+            // every renderer must own its cmd
+            m_camera->SetCullingEnable(false);
+            m_camera->SetLocalPosition(Vector3(0, 40, -60));
+            m_camera->SetLocalRotation(Quaternion::Euler(35, 0, 0));
+
+            RenderState render_state;
+
+            m_shader = RefMake<Shader>(
+                "",
+                Vector<String>({ "Diffuse.vs.in" }),
+                "",
+                "",
+                Vector<String>({ "Diffuse.fs.in" }),
+                "",
+                render_state);
+
+            m_cube = Mesh::LoadFromFile(Application::Instance()->GetDataPath() + "/Library/unity default resources.Cube.mesh");
+
+            this->NextStep();
+        }
+
+        void NextStep()
+        {
+            m_step++;
+            m_frame = 0;
+            m_record_ms_sum = 0;
+
+            if (m_step >= m_steps.Size())
+            {
+                return;
+            }
+
+            const int row = 100;
+            for (int i = m_renderers.Size(); i < m_steps[m_step]; ++i)
+            {
+                auto material = RefMake<Material>(m_shader);
+                material->SetTexture("u_texture", Texture::GetSharedWhiteTexture());
+                material->SetVector("u_uv_scale_offset", Vector4(1, 1, 0, 0));
+                material->SetLightProperties(m_light);
+
+                auto renderer = RefMake<MeshRenderer>();
+                renderer->SetMaterial(material);
+                renderer->SetMesh(m_cube);
+                renderer->SetLocalPosition(Vector3((float) (i % row - row / 2), 0, (float) (i / row)));
+                renderer->SetLocalScale(Vector3(0.5f, 0.5f, 0.5f));
+                m_camera->AddRenderer(renderer);
+                m_renderers.Add(renderer);
+            }
+        }
+
+        virtual void Init()
+        {
+            this->InitCamera();
+            this->InitLight();
+            this->InitUI();
+            this->InitRecord();
+
+            m_label->SetSize(Vector2i(600, 30));
+        }
+
+        virtual void Done()
+        {
+            m_shader.reset();
+            m_cube.reset();
+
+            DemoMesh::Done();
+        }
+
+        virtual void Update()
+        {
+            const int frames_per_step = 60;
+
+            if (m_step < m_steps.Size())
+            {
+                // skip the frame that adds renderers
+                if (m_frame > 0)
+                {
+                    m_record_ms_sum += m_camera->GetInstanceCmdRecordMs();
+                }
+                m_frame++;
+
+                if (m_frame > frames_per_step)
+                {
+                    Log("renderers:%d record:%.3fms threads:%d",
+                        m_renderers.Size(),
+                        m_record_ms_sum / frames_per_step,
+                        Application::Instance()->GetRecordThreadPool()->GetThreadCount());
+                    this->NextStep();
+                }
+            }
+
+            // rerecord every renderer cmd in next camera update
+            m_camera->SetViewportRect(m_camera->GetViewportRect());
+
+            m_label->SetText(String::Format("FPS:%d Renderers:%d Record:%.3fms",
+                Time::GetFPS(),
+                m_renderers.Size(),
+                m_camera->GetInstanceCmdRecordMs()));
+        }
+    };
+}
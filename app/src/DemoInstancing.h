@@ -0,0 +1,170 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "DemoMesh.h"
+#include "Debug.h"
+
+namespace Viry3D
+{
+    // measures instanced renderers batched by mesh and material,
+    // every renderer count runs with multi draw indirect and again with one draw per batch
+    class DemoInstancing : public DemoMesh
+    {
+    public:
+        Vector<int> m_steps = Vector<int>({ 1000, 5000, 10000 });
+        int m_step = -1;
+        bool m_multi_draw = false;
+        int m_frame = 0;
+        float m_record_ms_sum = 0;
+        float m_cpu_frame_ms_sum = 0;
+        Ref<Shader> m_shader;
+        Vector<Ref<Mesh>> m_meshes;
+        Vector<Ref<Material>> m_materials;
+
+        void InitInstancing()
+        {
+            m_camera->SetCullingEnable(false);
+            m_camera->SetLocalPosition(Vector3(0, 40, -60));
+            m_camera->SetLocalRotation(Quaternion::Euler(35, 0, 0));
+
+            RenderState render_state;
+
+            m_shader = RefMake<Shader>(
+                "#define INSTANCING 1",
+                Vector<String>({ "Diffuse.vs.in" }),
+                "",
+                "",
+                Vector<String>({ "Diffuse.fs.in" }),
+                "",
+                render_state);
+
+            m_meshes.Add(Mesh::LoadFromFile(Application::Instance()->GetDataPath() + "/Library/unity default resources.Cube.mesh"));
+            m_meshes.Add(Mesh::LoadFromFile(Application::Instance()->GetDataPath() + "/Library/unity default resources.Sphere.mesh"));
+
+            // each mesh and material pair is one batch
+            for (int i = 0; i < 2; ++i)
+            {
+                auto material = RefMake<Material>(m_shader);
+                material->SetTexture("u_texture", Texture::GetSharedWhiteTexture());
+                material->SetVector("u_uv_scale_offset", Vector4(1, 1, 0, 0));
+                material->SetLightProperties(m_light);
+                m_materials.Add(material);
+            }
+
+            this->NextStep();
+        }
+
+        void NextStep()
+        {
+            if (m_multi_draw && Display::Instance()->IsMultiDrawIndirectSupported())
+            {
+                m_multi_draw = false;
+            }
+            else
+            {
+                m_multi_draw = Display::Instance()->IsMultiDrawIndirectSupported();
+                m_step++;
+            }
+            m_frame = 0;
+            m_record_ms_sum = 0;
+            m_cpu_frame_ms_sum = 0;
+
+            if (m_step >= m_steps.Size())
+            {
+                return;
+            }
+
+            // batches are only rebuilt when renderers change, add them again for the new draw path
+            for (int i = 0; i < m_renderers.Size(); ++i)
+            {
+                m_camera->RemoveRenderer(m_renderers[i]);
+            }
+            m_renderers.Clear();
+
+            Display::Instance()->SetMultiDrawIndirectEnable(m_multi_draw);
+
+            const int row = 100;
+            for (int i = 0; i < m_steps[m_step]; ++i)
+            {
+                auto renderer = RefMake<MeshRenderer>();
+                renderer->SetMaterial(m_materials[(i / 2) % m_materials.Size()]);
+                renderer->SetMesh(m_meshes[i % m_meshes.Size()]);
+                renderer->SetLocalPosition(Vector3((float) (i % row - row / 2), 0, (float) (i / row)));
+                renderer->SetLocalScale(Vector3(0.5f, 0.5f, 0.5f));
+                m_camera->AddRenderer(renderer);
+                m_renderers.Add(renderer);
+            }
+        }
+
+        virtual void Init()
+        {
+            this->InitCamera();
+            this->InitLight();
+            this->InitUI();
+            this->InitInstancing();
+
+            m_label->SetSize(Vector2i(800, 30));
+        }
+
+        virtual void Done()
+        {
+            Display::Instance()->SetMultiDrawIndirectEnable(true);
+
+            m_materials.Clear();
+            m_meshes.Clear();
+            m_shader.reset();
+
+            DemoMesh::Done();
+        }
+
+        virtual void Update()
+        {
+            const int frames_per_step = 60;
+
+            if (m_step < m_steps.Size())
+            {
+                // skip the frame that rebuilds batches
+                if (m_frame > 0)
+                {
+                    m_record_ms_sum += m_camera->GetInstanceCmdRecordMs();
+                    m_cpu_frame_ms_sum += Display::Instance()->GetFramePacingStats().cpu_frame_ms;
+                }
+                m_frame++;
+
+                if (m_frame > frames_per_step)
+                {
+                    Log("renderers:%d batches:%d groups:%d multi draw:%d record:%.3fms cpu frame:%.3fms",
+                        m_renderers.Size(),
+                        m_camera->GetInstanceBatchCount(),
+                        m_camera->GetDrawGroupCount(),
+                        m_multi_draw ? 1 : 0,
+                        m_record_ms_sum / frames_per_step,
+                        m_cpu_frame_ms_sum / frames_per_step);
+                    this->NextStep();
+                }
+            }
+
+            m_label->SetText(String::Format("FPS:%d Renderers:%d Batches:%d MultiDraw:%d",
+                Time::GetFPS(),
+                m_renderers.Size(),
+                m_camera->GetInstanceBatchCount(),
+                m_multi_draw ? 1 : 0));
+        }
+    };
+}
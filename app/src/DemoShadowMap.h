@@ -18,6 +18,7 @@
 #pragma once
 
 #include "DemoSkinnedMesh.h"
+#include "graphics/ShaderVariants.h"
 
 #define SHADOW_MAP_SIZE 1024
 
@@ -42,6 +43,28 @@ namespace Viry3D
         Vector<Ref<MeshRenderer>> m_shadow_renderers;
         Ref<Texture> m_shadow_texture;
         Matrix4x4 m_light_view_projection_matrix;
+        Ref<ShaderVariants> m_diffuse_variants;
+
+        void InitShaderVariants()
+        {
+            ShaderKeyword cast_shadow;
+            cast_shadow.name = "CAST_SHADOW";
+
+            ShaderKeyword recieve_shadow;
+            recieve_shadow.name = "RECIEVE_SHADOW";
+            recieve_shadow.fs_includes.Add("Shadow.in");
+
+            ShaderKeyword skinned_mesh;
+            skinned_mesh.name = "SKINNED_MESH";
+            skinned_mesh.vs_includes.Add("Skin.in");
+
+            m_diffuse_variants = RefMake<ShaderVariants>(
+                Vector<ShaderKeyword>({ cast_shadow, recieve_shadow, skinned_mesh }),
+                Vector<String>({ "Diffuse.vs.in" }),
+                "",
+                Vector<String>({ "Diffuse.fs.in" }),
+                "");
+        }
 
         void InitShadowCaster()
         {
@@ -71,26 +94,15 @@ namespace Viry3D
             RenderState render_state;
             render_state.cull = RenderState::Cull::Front;
 
-            auto shader = RefMake<Shader>(
-                "#define CAST_SHADOW 1",
-                Vector<String>({ "Diffuse.vs.in" }),
-                "",
-                "#define CAST_SHADOW 1",
-                Vector<String>({ "Diffuse.fs.in" }),
-                "",
-                render_state);
+            uint32_t cast_shadow = m_diffuse_variants->GetKeywordBit("CAST_SHADOW");
+            uint32_t skinned_mesh = m_diffuse_variants->GetKeywordBit("SKINNED_MESH");
+
+            auto shader = m_diffuse_variants->GetVariant(cast_shadow, render_state);
             auto material = RefMake<Material>(shader);
 
             m_light_view_projection_matrix = m_shadow_camera->GetProjectionMatrix() * m_shadow_camera->GetViewMatrix();
 
-            auto skin_shader = RefMake<Shader>(
-                "#define CAST_SHADOW 1\n#define SKINNED_MESH 1",
-                Vector<String>({ "Skin.in", "Diffuse.vs.in" }),
-                "",
-                "#define CAST_SHADOW 1",
-                Vector<String>({ "Diffuse.fs.in" }),
-                "",
-                render_state);
+            auto skin_shader = m_diffuse_variants->GetVariant(cast_shadow | skinned_mesh, render_state);
             auto skin_material = RefMake<Material>(skin_shader);
 
             m_shadow_renderers.Resize(m_renderers.Size());
@@ -126,25 +138,11 @@ namespace Viry3D
 
         void InitShadowReciever()
         {
-            RenderState render_state;
+            uint32_t recieve_shadow = m_diffuse_variants->GetKeywordBit("RECIEVE_SHADOW");
+            uint32_t skinned_mesh = m_diffuse_variants->GetKeywordBit("SKINNED_MESH");
 
-            auto shader = RefMake<Shader>(
-                "#define RECIEVE_SHADOW 1",
-                Vector<String>({ "Diffuse.vs.in" }),
-                "",
-                "#define RECIEVE_SHADOW 1",
-                Vector<String>({ "Shadow.in", "Diffuse.fs.in" }),
-                "",
-                render_state);
-
-            auto skin_shader = RefMake<Shader>(
-                "#define RECIEVE_SHADOW 1\n#define SKINNED_MESH 1",
-                Vector<String>({ "Skin.in", "Diffuse.vs.in" }),
-                "",
-                "#define RECIEVE_SHADOW 1",
-                Vector<String>({ "Shadow.in", "Diffuse.fs.in" }),
-                "",
-                render_state);
+            auto shader = m_diffuse_variants->GetVariant(recieve_shadow);
+            auto skin_shader = m_diffuse_variants->GetVariant(recieve_shadow | skinned_mesh);
 
             for (int i = 0; i < m_renderers.Size(); ++i)
             {
@@ -173,6 +171,7 @@ namespace Viry3D
         {
             DemoSkinnedMesh::Init();
 
+            this->InitShaderVariants();
             this->InitShadowCaster();
             this->InitShadowReciever();
         }
@@ -181,6 +180,7 @@ namespace Viry3D
         {
             m_shadow_texture.reset();
             m_shadow_renderers.Clear();
+            m_diffuse_variants.reset();
 
             Display::Instance()->DestroyCamera(m_shadow_camera);
             m_shadow_camera = nullptr;
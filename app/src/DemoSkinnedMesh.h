@@ -67,6 +67,7 @@ namespace Viry3D
             
             m_anim->SetLocalPosition(Vector3(0, 0, -0.5f));
             m_anim->SetLocalRotation(Quaternion::Euler(0, 90, 0));
+            m_anim->EnableTransformHierarchy(true);
 
             // play animation clip
             m_clips.Resize((int) ClipIndex::Count, -1);
@@ -0,0 +1,137 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "DemoSkinnedMesh.h"
+#include "TransformHierarchy.h"
+#include "Debug.h"
+
+namespace Viry3D
+{
+    // measures transform hierarchy update time of many animated soldiers against update thread count
+    class DemoTransformUpdate : public DemoSkinnedMesh
+    {
+    public:
+        const int m_soldier_count = 64;
+        Vector<Ref<Animation>> m_anims;
+        int m_thread_count = 0;
+        int m_frame = 0;
+        float m_update_ms_sum = 0;
+
+        void InitSoldiers()
+        {
+            m_camera->SetLocalPosition(Vector3(0, 8, -12));
+            m_camera->SetLocalRotation(Quaternion::Euler(30, 0, 0));
+
+            const int row = 8;
+            for (int i = 0; i < m_soldier_count; ++i)
+            {
+                Ref<Animation> anim;
+                if (i == 0)
+                {
+                    anim = m_anim;
+                    m_anims.Add(anim);
+                }
+                else
+                {
+                    anim = RefCast<Animation>(Resources::Load("res/model/ToonSoldier 1/ToonSoldier 1.go"));
+
+                    auto skin = RefCast<SkinnedMeshRenderer>(anim->Find("MESH_Infantry"));
+                    skin->GetMaterial()->SetLightProperties(m_light);
+                    m_camera->AddRenderer(skin);
+                    m_renderers.Add(skin);
+
+                    anim->SetLocalRotation(Quaternion::Euler(0, 90, 0));
+                    anim->EnableTransformHierarchy(true);
+                    m_anims.Add(anim);
+                }
+
+                anim->SetLocalPosition(Vector3((float) (i % row - row / 2), 0, (float) (i / row)));
+
+                // spread clips so hierarchies do not all move alike
+                anim->Play(m_clips[i % (int) ClipIndex::Count], 0.3f);
+            }
+
+            this->NextStep();
+        }
+
+        void NextStep()
+        {
+            m_thread_count++;
+            m_frame = 0;
+            m_update_ms_sum = 0;
+
+            if (m_thread_count <= 8)
+            {
+                TransformHierarchy::SetUpdateThreadCount(m_thread_count);
+            }
+        }
+
+        virtual void Init()
+        {
+            DemoSkinnedMesh::Init();
+
+            this->InitSoldiers();
+
+            m_label->SetSize(Vector2i(600, 30));
+        }
+
+        virtual void Done()
+        {
+            TransformHierarchy::SetUpdateThreadCount(0);
+            m_anims.Clear();
+
+            DemoSkinnedMesh::Done();
+        }
+
+        virtual void Update()
+        {
+            const int frames_per_step = 120;
+
+            if (m_thread_count <= 8)
+            {
+                // skip the first frame, it reads the update of the previous step
+                if (m_frame > 0)
+                {
+                    m_update_ms_sum += TransformHierarchy::GetUpdateMs();
+                }
+                m_frame++;
+
+                if (m_frame > frames_per_step)
+                {
+                    Log("soldiers:%d threads:%d transform update:%.3fms",
+                        m_anims.Size(),
+                        TransformHierarchy::GetUpdateThreadCount(),
+                        m_update_ms_sum / frames_per_step);
+                    this->NextStep();
+                }
+            }
+
+            for (auto& i : m_anims)
+            {
+                i->Update();
+            }
+
+            m_label->SetText(String::Format("FPS:%d Soldiers:%d Threads:%d Transform:%.3fms",
+                Time::GetFPS(),
+                m_anims.Size(),
+                TransformHierarchy::GetUpdateThreadCount(),
+                TransformHierarchy::GetUpdateMs()));
+        }
+    };
+}
@@ -46,6 +46,7 @@ namespace Viry3D
         List<Event> m_events;
         Mutex m_mutex;
         Ref<ThreadPool> m_thread_pool;
+        Ref<ThreadPool> m_record_thread_pool;
         bool m_quit;
 
         ApplicationPrivate(Application* app):
@@ -53,6 +54,7 @@ namespace Viry3D
         {
             m_app = app;
             m_thread_pool = RefMake<ThreadPool>(8);
+            m_record_thread_pool = RefMake<ThreadPool>(4);
             Font::Init();
         }
 
@@ -61,6 +63,7 @@ namespace Viry3D
             Font::Done();
 			Texture::Done();
 			Shader::Done();
+            m_record_thread_pool.reset();
             m_thread_pool.reset();
             m_app = nullptr;
         }
@@ -194,6 +197,11 @@ namespace Viry3D
         return m_private->m_thread_pool.get();
     }
 
+    ThreadPool* Application::GetRecordThreadPool() const
+    {
+        return m_private->m_record_thread_pool.get();
+    }
+
     void Application::PostEvent(Event event)
     {
         m_private->m_mutex.lock();
@@ -46,6 +46,8 @@ namespace Viry3D
         void SetSavePath(const String& path);
 #endif
         ThreadPool* GetThreadPool() const;
+        // records camera cmds and updates transforms, so long tasks on the shared pool never delay a frame
+        ThreadPool* GetRecordThreadPool() const;
         void PostEvent(Event event);
         void ProcessEvents();
         void OnFrameBegin();
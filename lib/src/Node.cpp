@@ -16,22 +16,112 @@
 */
 
 #include "Node.h"
+#include "TransformHierarchy.h"
+#include "memory/Memory.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
 
 namespace Viry3D
 {
+    static unsigned long long HashPath(unsigned long long hash, const char* str, int size)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            hash ^= (unsigned char) str[i];
+            hash *= FNV_PRIME;
+        }
+        return hash;
+    }
+
     Node::Node():
         m_local_position(0, 0, 0),
         m_local_rotation(Quaternion::Identity()),
         m_local_scale(1, 1, 1),
         m_matrix_dirty(true),
-        m_notify_children_on_matrix_dirty(true)
+        m_notify_children_on_matrix_dirty(true),
+        m_hierarchy(nullptr),
+        m_hierarchy_index(-1),
+        m_own_hierarchy(nullptr),
+        m_find_index_dirty(true),
+        m_subtree_version(0)
     {
         
     }
     
     Node::~Node()
     {
-    
+        if (m_own_hierarchy)
+        {
+            delete m_own_hierarchy;
+            m_own_hierarchy = nullptr;
+        }
+        else if (m_hierarchy)
+        {
+            m_hierarchy->RemoveNode(m_hierarchy_index);
+        }
+    }
+
+    void Node::SetName(const String& name)
+    {
+        Object::SetName(name);
+        this->MarkAncestorFindIndicesDirty();
+    }
+
+    void Node::EnableTransformHierarchy(bool enable)
+    {
+        if (enable == (m_own_hierarchy != nullptr))
+        {
+            return;
+        }
+
+        // the parent hierarchy leaves this subtree to the new one or takes it back
+        Ref<Node> parent = this->GetParent();
+        if (parent && parent->m_hierarchy)
+        {
+            parent->m_hierarchy->MarkStructureDirty();
+        }
+
+        if (enable)
+        {
+            this->DetachFromHierarchy();
+            m_own_hierarchy = new TransformHierarchy(this);
+        }
+        else
+        {
+            delete m_own_hierarchy;
+            m_own_hierarchy = nullptr;
+            this->MarkMatrixDirty();
+        }
+    }
+
+    void Node::DetachFromHierarchy()
+    {
+        if (m_hierarchy && m_hierarchy != m_own_hierarchy)
+        {
+            m_hierarchy->MarkStructureDirty();
+
+            // the hierarchy drops the whole subtree at its rebuild, clear it now so no stale index is used
+            Vector<Node*> nodes;
+            nodes.Add(this);
+            while (nodes.Size() > 0)
+            {
+                Node* node = nodes[nodes.Size() - 1];
+                nodes.Resize(nodes.Size() - 1);
+
+                if (node->m_hierarchy && node->m_hierarchy != node->m_own_hierarchy)
+                {
+                    node->m_hierarchy = nullptr;
+                    node->m_hierarchy_index = -1;
+                    node->m_matrix_dirty = true;
+
+                    for (auto& i : node->m_children)
+                    {
+                        nodes.Add(i.get());
+                    }
+                }
+            }
+        }
     }
 
     void Node::SetLocalPosition(const Vector3& pos)
@@ -54,6 +144,13 @@ namespace Viry3D
 
     void Node::MarkMatrixDirty()
     {
+        // the batched update notifies this node and its children
+        if (m_hierarchy)
+        {
+            m_hierarchy->SetLocalTransform(m_hierarchy_index, m_local_position, m_local_rotation, m_local_scale);
+            return;
+        }
+
         m_matrix_dirty = true;
         this->OnMatrixDirty();
 
@@ -68,6 +165,17 @@ namespace Viry3D
 
     const Matrix4x4& Node::GetLocalToWorldMatrix()
     {
+        if (m_hierarchy)
+        {
+            m_hierarchy->Update();
+
+            // the update may have dropped this node
+            if (m_hierarchy)
+            {
+                return m_hierarchy->GetLocalToWorldMatrix(m_hierarchy_index);
+            }
+        }
+
         if (m_matrix_dirty)
         {
             m_matrix_dirty = false;
@@ -92,6 +200,16 @@ namespace Viry3D
 
     Quaternion Node::GetRotation()
     {
+        if (m_hierarchy)
+        {
+            m_hierarchy->Update();
+
+            if (m_hierarchy)
+            {
+                return m_hierarchy->GetRotation(m_hierarchy_index);
+            }
+        }
+
         Quaternion rotation = m_local_rotation;
         if (!m_parent.expired())
         {
@@ -118,6 +236,16 @@ namespace Viry3D
 
     Vector3 Node::GetScale()
     {
+        if (m_hierarchy)
+        {
+            m_hierarchy->Update();
+
+            if (m_hierarchy)
+            {
+                return m_hierarchy->GetScale(m_hierarchy_index);
+            }
+        }
+
         Vector3 scale = m_local_scale;
         if (!m_parent.expired())
         {
@@ -133,17 +261,34 @@ namespace Viry3D
     {
         bool matrix_dirty = false;
 
+        // paths of the subtree change for the ancestors it leaves and joins
+        node->MarkAncestorFindIndicesDirty();
+
         if (!node->m_parent.expired())
         {
-            node->m_parent.lock()->m_children.Remove(node);
+            Ref<Node> old_parent = node->m_parent.lock();
+            if (old_parent->m_hierarchy)
+            {
+                old_parent->m_hierarchy->MarkStructureDirty();
+            }
+            node->DetachFromHierarchy();
+
+            old_parent->m_children.Remove(node);
             node->m_parent.reset();
             matrix_dirty = true;
         }
 
         if (parent)
         {
+            // joins the parent hierarchy at its next rebuild
+            if (parent->m_hierarchy)
+            {
+                parent->m_hierarchy->MarkStructureDirty();
+            }
+
             parent->m_children.Add(node);
             node->m_parent = parent;
+            node->MarkAncestorFindIndicesDirty();
             matrix_dirty = true;
         }
 
@@ -167,36 +312,130 @@ namespace Viry3D
 
     Ref<Node> Node::Find(const String& path)
     {
-        if (path.Empty())
+        return this->Find(path.CString(), path.Size());
+    }
+
+    Ref<Node> Node::Find(const char* path, int size)
+    {
+        if (size == 0)
         {
             return Ref<Node>();
         }
 
-        Ref<Node> find;
-        Node* p = this;
+        if (m_find_index_dirty)
+        {
+            this->BuildFindIndex();
+        }
 
-        auto layers = path.Split("/");
-        for (int i = 0; i < layers.Size(); ++i)
+        WeakRef<Node>* weak;
+        if (!m_find_index.TryGet(HashPath(FNV_OFFSET_BASIS, path, size), &weak))
         {
-            bool find_child = false;
+            return Ref<Node>();
+        }
+
+        Ref<Node> find = weak->lock();
+        if (!find)
+        {
+            return Ref<Node>();
+        }
+
+        // compare names up to this node, so a hash collision can not return a wrong node
+        int end = size;
+        Ref<Node> p = find;
+        while (p && p.get() != this)
+        {
+            const String& name = p->GetName();
+            int begin = end - name.Size();
+            if (begin < 0 || Memory::Compare(&path[begin], name.CString(), name.Size()) != 0)
+            {
+                return Ref<Node>();
+            }
 
-            for (int j = 0; j < p->GetChildCount(); ++j)
+            p = p->GetParent();
+            if (begin == 0)
             {
-                if (p->GetChild(j)->GetName() == layers[i])
+                if (p.get() == this)
                 {
-                    find_child = true;
-                    find = p->GetChild(j);
-                    p = find.get();
-                    break;
+                    return find;
                 }
+                break;
             }
+            if (path[begin - 1] != '/')
+            {
+                break;
+            }
+            end = begin - 1;
+        }
+
+        return Ref<Node>();
+    }
+
+    Vector<Ref<Node>> Node::FindAll(const Vector<String>& paths, const String& prefix)
+    {
+        Vector<Ref<Node>> nodes(paths.Size());
 
-            if (!find_child)
+        for (int i = 0; i < paths.Size(); ++i)
+        {
+            const String& path = paths[i];
+            if (prefix.Size() > 0)
             {
-                return Ref<Node>();
+                if (path.StartsWith(prefix))
+                {
+                    nodes[i] = this->Find(path.CString() + prefix.Size(), path.Size() - prefix.Size());
+                }
+            }
+            else
+            {
+                nodes[i] = this->Find(path);
             }
         }
 
-        return find;
+        return nodes;
+    }
+
+    void Node::MarkAncestorFindIndicesDirty()
+    {
+        Ref<Node> p = m_parent.lock();
+        while (p)
+        {
+            p->m_find_index_dirty = true;
+            p->m_subtree_version++;
+            p = p->m_parent.lock();
+        }
+    }
+
+    void Node::BuildFindIndex()
+    {
+        m_find_index.Clear();
+        m_find_index_dirty = false;
+
+        // preorder, so the first of same named siblings keeps the path like a linear scan would
+        Vector<Ref<Node>> stack;
+        Vector<unsigned long long> stack_hashes;
+        for (int i = m_children.Size() - 1; i >= 0; --i)
+        {
+            stack.Add(m_children[i]);
+            stack_hashes.Add(FNV_OFFSET_BASIS);
+        }
+
+        while (stack.Size() > 0)
+        {
+            Ref<Node> node = stack[stack.Size() - 1];
+            unsigned long long hash = stack_hashes[stack_hashes.Size() - 1];
+            stack.Resize(stack.Size() - 1);
+            stack_hashes.Resize(stack_hashes.Size() - 1);
+
+            const String& name = node->GetName();
+            hash = HashPath(hash, name.CString(), name.Size());
+
+            m_find_index.Add(hash, node);
+
+            unsigned long long child_hash = HashPath(hash, "/", 1);
+            for (int i = node->m_children.Size() - 1; i >= 0; --i)
+            {
+                stack.Add(node->m_children[i]);
+                stack_hashes.Add(child_hash);
+            }
+        }
     }
 }
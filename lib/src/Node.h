@@ -22,9 +22,12 @@
 #include "math/Quaternion.h"
 #include "math/Matrix4x4.h"
 #include "container/Vector.h"
+#include "container/Map.h"
 
 namespace Viry3D
 {
+    class TransformHierarchy;
+
     class Node : public Object
     {
     public:
@@ -32,6 +35,7 @@ namespace Viry3D
         static const Ref<Node>& GetRoot(const Ref<Node>& node);
         Node();
         virtual ~Node();
+        virtual void SetName(const String& name);
         const Vector3& GetLocalPosition() const { return m_local_position; }
         void SetLocalPosition(const Vector3& pos);
         const Quaternion& GetLocalRotation() const { return m_local_rotation; }
@@ -49,13 +53,25 @@ namespace Viry3D
         int GetChildCount() const { return m_children.Size(); }
         const Ref<Node>& GetChild(int index) const { return m_children[index]; }
         Ref<Node> Find(const String& path);
+        Ref<Node> Find(const char* path, int size);
+        // resolves all paths with one index walk, paths are relative to this node after the prefix
+        Vector<Ref<Node>> FindAll(const Vector<String>& paths, const String& prefix = String());
         void EnableNotifyChildrenOnMatrixDirty(bool enable) { m_notify_children_on_matrix_dirty = enable; }
+        // world transforms of this subtree are kept in one TransformHierarchy and updated in a batch
+        void EnableTransformHierarchy(bool enable);
+        bool IsTransformHierarchyEnabled() const { return m_own_hierarchy != nullptr; }
+        // increases every time a node below this one is renamed, added or removed
+        uint32_t GetSubtreeVersion() const { return m_subtree_version; }
 
     protected:
         virtual void OnMatrixDirty() { }
 
     private:
+        friend class TransformHierarchy;
         void MarkMatrixDirty();
+        void DetachFromHierarchy();
+        void BuildFindIndex();
+        void MarkAncestorFindIndicesDirty();
 
     private:
         Vector3 m_local_position;
@@ -66,5 +82,13 @@ namespace Viry3D
         Matrix4x4 m_local_to_world_matrix;
         Vector<Ref<Node>> m_children;
         WeakRef<Node> m_parent;
+        TransformHierarchy* m_hierarchy;
+        int m_hierarchy_index;
+        TransformHierarchy* m_own_hierarchy;
+        // path hash relative to this node to the first node with that path in preorder
+        Map<unsigned long long, WeakRef<Node>> m_find_index;
+        // set when a name or parent changes below this node, the index is rebuilt on the next find
+        bool m_find_index_dirty;
+        uint32_t m_subtree_version;
     };
 }
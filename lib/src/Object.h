@@ -27,7 +27,7 @@ namespace Viry3D
         Object() { }
         virtual ~Object() { }
         const String& GetName() const { return m_name; }
-        void SetName(const String& name) { m_name = name; }
+        virtual void SetName(const String& name) { m_name = name; }
 
     private:
         String m_name;
@@ -0,0 +1,396 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#include "TransformHierarchy.h"
+#include "Node.h"
+#include "Application.h"
+#include "memory/Memory.h"
+#include "time/Time.h"
+
+// fewer nodes are not worth a thread switch
+#define UPDATE_PARALLEL_MIN_NODES 256
+
+namespace Viry3D
+{
+    List<TransformHierarchy*> TransformHierarchy::m_hierarchies;
+    int TransformHierarchy::m_update_thread_count = 0;
+    float TransformHierarchy::m_update_ms = 0;
+    int TransformHierarchy::m_update_jobs = 0;
+    Mutex TransformHierarchy::m_update_mutex;
+    std::condition_variable TransformHierarchy::m_update_condition;
+
+    static Vector3 Scale(const Vector3& a, const Vector3& b)
+    {
+        return Vector3(a.x * b.x, a.y * b.y, a.z * b.z);
+    }
+
+    int TransformHierarchy::GetUpdateThreadCount()
+    {
+        // waves finish before cmds are recorded, so they share the record pool
+        // instead of queueing behind long tasks on the shared pool
+        int pool_count = Application::Instance()->GetRecordThreadPool()->GetThreadCount();
+        if (m_update_thread_count <= 0 || m_update_thread_count > pool_count)
+        {
+            return pool_count;
+        }
+        return m_update_thread_count;
+    }
+
+    void TransformHierarchy::UpdateAll()
+    {
+        float begin = Time::GetRealTimeSinceStartup();
+
+        // nested hierarchies read the world transform of their outer one,
+        // so they are updated in waves by nesting depth.
+        // a hierarchy may only become dirty by the wave before it, check that in each wave
+        Vector<Vector<TransformHierarchy*>> waves;
+        for (auto i : m_hierarchies)
+        {
+            int depth = i->GetDepth();
+            if (waves.Size() <= depth)
+            {
+                waves.Resize(depth + 1);
+            }
+            waves[depth].Add(i);
+        }
+
+        for (const auto& i : waves)
+        {
+            UpdateWave(i);
+        }
+
+        m_update_ms = (Time::GetRealTimeSinceStartup() - begin) * 1000;
+    }
+
+    void TransformHierarchy::UpdateWave(const Vector<TransformHierarchy*>& hierarchies)
+    {
+        Vector<TransformHierarchy*> dirty;
+        int node_count = 0;
+
+        for (auto i : hierarchies)
+        {
+            if (i->m_dirty)
+            {
+                i->Prepare();
+                dirty.Add(i);
+                node_count += i->m_nodes.Size();
+            }
+        }
+
+        int thread_count = GetUpdateThreadCount();
+
+        if (thread_count <= 1 || dirty.Size() < 2 || node_count < UPDATE_PARALLEL_MIN_NODES)
+        {
+            for (auto i : dirty)
+            {
+                i->Compute();
+            }
+        }
+        else
+        {
+            // contiguous ranges of about the same node count, computes touch only their own arrays
+            int range_nodes = (node_count + thread_count - 1) / thread_count;
+            int range_begin = 0;
+            int range_count = 0;
+            int worker = 0;
+
+            for (int i = 0; i < dirty.Size(); ++i)
+            {
+                range_count += dirty[i]->m_nodes.Size();
+
+                if (range_count < range_nodes && i < dirty.Size() - 1)
+                {
+                    continue;
+                }
+
+                m_update_mutex.lock();
+                m_update_jobs++;
+                m_update_mutex.unlock();
+
+                Vector<TransformHierarchy*> range;
+                for (int j = range_begin; j <= i; ++j)
+                {
+                    range.Add(dirty[j]);
+                }
+                range_begin = i + 1;
+                range_count = 0;
+
+                Thread::Task task;
+                task.job = [=]() {
+                    for (auto j : range)
+                    {
+                        j->Compute();
+                    }
+
+                    std::lock_guard<Mutex> lock(m_update_mutex);
+                    m_update_jobs--;
+                    if (m_update_jobs == 0)
+                    {
+                        m_update_condition.notify_all();
+                    }
+
+                    return Ref<Object>();
+                };
+                Application::Instance()->GetRecordThreadPool()->AddTask(task, worker++ % thread_count);
+            }
+
+            std::unique_lock<Mutex> lock(m_update_mutex);
+            m_update_condition.wait(lock, []() {
+                return m_update_jobs == 0;
+            });
+        }
+
+        // node callbacks may touch shared state, run them here in list order
+        for (auto i : dirty)
+        {
+            i->Notify();
+        }
+    }
+
+    int TransformHierarchy::GetDepth() const
+    {
+        int depth = 0;
+        Ref<Node> parent = m_root->GetParent();
+        while (parent)
+        {
+            if (parent->m_own_hierarchy)
+            {
+                depth++;
+            }
+            parent = parent->GetParent();
+        }
+        return depth;
+    }
+
+    TransformHierarchy::TransformHierarchy(Node* root):
+        m_root(root),
+        m_dirty(true),
+        m_structure_dirty(true)
+    {
+        m_hierarchies.AddLast(this);
+    }
+
+    TransformHierarchy::~TransformHierarchy()
+    {
+        this->ClearNodes();
+        m_hierarchies.Remove(this);
+    }
+
+    void TransformHierarchy::ClearNodes()
+    {
+        for (int i = 0; i < m_nodes.Size(); ++i)
+        {
+            if (m_nodes[i])
+            {
+                m_nodes[i]->m_hierarchy = nullptr;
+                m_nodes[i]->m_hierarchy_index = -1;
+            }
+        }
+        m_nodes.Clear();
+    }
+
+    void TransformHierarchy::Rebuild()
+    {
+        this->ClearNodes();
+        m_parents.Clear();
+        m_local_positions.Clear();
+        m_local_rotations.Clear();
+        m_local_scales.Clear();
+        m_child_roots.Clear();
+        m_child_root_parents.Clear();
+
+        // preorder walk, a parent always gets its index before its children
+        Vector<Node*> stack;
+        Vector<int> stack_parents;
+        stack.Add(m_root);
+        stack_parents.Add(-1);
+
+        while (stack.Size() > 0)
+        {
+            Node* node = stack[stack.Size() - 1];
+            int parent = stack_parents[stack_parents.Size() - 1];
+            stack.Resize(stack.Size() - 1);
+            stack_parents.Resize(stack_parents.Size() - 1);
+
+            int index = m_nodes.Size();
+            node->m_hierarchy = this;
+            node->m_hierarchy_index = index;
+            m_nodes.Add(node);
+            m_parents.Add(parent);
+            m_local_positions.Add(node->m_local_position);
+            m_local_rotations.Add(node->m_local_rotation);
+            m_local_scales.Add(node->m_local_scale);
+
+            for (int i = node->m_children.Size() - 1; i >= 0; --i)
+            {
+                Node* child = node->m_children[i].get();
+                if (child->m_own_hierarchy)
+                {
+                    m_child_roots.Add(child);
+                    m_child_root_parents.Add(index);
+                }
+                else
+                {
+                    stack.Add(child);
+                    stack_parents.Add(index);
+                }
+            }
+        }
+
+        int count = m_nodes.Size();
+        m_world_matrices.Resize(count);
+        m_world_rotations.Resize(count);
+        m_world_scales.Resize(count);
+        m_dirty_flags.Resize(count);
+        m_changed_flags.Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            m_dirty_flags[i] = 1;
+        }
+    }
+
+    void TransformHierarchy::SetLocalTransform(int index, const Vector3& pos, const Quaternion& rot, const Vector3& scale)
+    {
+        if (m_structure_dirty)
+        {
+            // rebuild reads the locals from the nodes
+            m_dirty = true;
+            return;
+        }
+
+        m_local_positions[index] = pos;
+        m_local_rotations[index] = rot;
+        m_local_scales[index] = scale;
+        this->MarkDirty(index);
+    }
+
+    void TransformHierarchy::MarkDirty(int index)
+    {
+        if (index < m_dirty_flags.Size())
+        {
+            m_dirty_flags[index] = 1;
+        }
+        m_dirty = true;
+    }
+
+    void TransformHierarchy::MarkStructureDirty()
+    {
+        m_structure_dirty = true;
+        m_dirty = true;
+    }
+
+    void TransformHierarchy::RemoveNode(int index)
+    {
+        m_nodes[index] = nullptr;
+        this->MarkStructureDirty();
+    }
+
+    void TransformHierarchy::Update()
+    {
+        if (!m_dirty)
+        {
+            return;
+        }
+
+        this->Prepare();
+        this->Compute();
+        this->Notify();
+    }
+
+    void TransformHierarchy::Prepare()
+    {
+        // this may update outer hierarchies, which can flag the root again
+        Ref<Node> root_parent = m_root->GetParent();
+        if (root_parent)
+        {
+            m_root_parent_matrix = root_parent->GetLocalToWorldMatrix();
+            m_root_parent_rotation = root_parent->GetRotation();
+            m_root_parent_scale = root_parent->GetScale();
+        }
+        else
+        {
+            m_root_parent_matrix = Matrix4x4::Identity();
+            m_root_parent_rotation = Quaternion::Identity();
+            m_root_parent_scale = Vector3(1, 1, 1);
+        }
+
+        m_dirty = false;
+
+        if (m_structure_dirty)
+        {
+            m_structure_dirty = false;
+            this->Rebuild();
+        }
+    }
+
+    void TransformHierarchy::Compute()
+    {
+        int count = m_nodes.Size();
+        if (count == 0)
+        {
+            return;
+        }
+
+        Memory::Zero(&m_changed_flags[0], count);
+
+        for (int i = 0; i < count; ++i)
+        {
+            int parent = m_parents[i];
+            if (!m_dirty_flags[i] && (parent < 0 || !m_changed_flags[parent]))
+            {
+                continue;
+            }
+            m_dirty_flags[i] = 0;
+            m_changed_flags[i] = 1;
+
+            Matrix4x4 local = Matrix4x4::TRS(m_local_positions[i], m_local_rotations[i], m_local_scales[i]);
+
+            if (parent >= 0)
+            {
+                m_world_matrices[i] = m_world_matrices[parent] * local;
+                m_world_rotations[i] = m_world_rotations[parent] * m_local_rotations[i];
+                m_world_scales[i] = Scale(m_world_scales[parent], m_local_scales[i]);
+            }
+            else
+            {
+                m_world_matrices[i] = m_root_parent_matrix * local;
+                m_world_rotations[i] = m_root_parent_rotation * m_local_rotations[i];
+                m_world_scales[i] = Scale(m_root_parent_scale, m_local_scales[i]);
+            }
+        }
+    }
+
+    void TransformHierarchy::Notify()
+    {
+        for (int i = 0; i < m_nodes.Size(); ++i)
+        {
+            if (m_changed_flags[i])
+            {
+                m_nodes[i]->OnMatrixDirty();
+            }
+        }
+
+        for (int i = 0; i < m_child_roots.Size(); ++i)
+        {
+            if (m_changed_flags[m_child_root_parents[i]])
+            {
+                m_child_roots[i]->m_own_hierarchy->MarkDirty(0);
+            }
+        }
+    }
+}
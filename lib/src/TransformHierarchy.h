@@ -0,0 +1,95 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "math/Vector3.h"
+#include "math/Quaternion.h"
+#include "math/Matrix4x4.h"
+#include "container/Vector.h"
+#include "container/List.h"
+#include "thread/ThreadPool.h"
+
+namespace Viry3D
+{
+    class Node;
+
+    // transforms of a node subtree in parent before child arrays.
+    // setting a local transform only flags its slot, one linear pass then updates
+    // every flagged transform and its descendants and notifies the changed nodes.
+    // a descendant owning its own hierarchy is left out and only marked dirty when its parent changes.
+    // UpdateAll computes independent hierarchies on the record thread pool, each one on a single worker,
+    // so results do not depend on the thread count.
+    class TransformHierarchy
+    {
+    public:
+        static void UpdateAll();
+        // 0 uses all threads of the record pool, 1 updates on the calling thread
+        static void SetUpdateThreadCount(int count) { m_update_thread_count = count; }
+        static int GetUpdateThreadCount();
+        static float GetUpdateMs() { return m_update_ms; }
+        TransformHierarchy(Node* root);
+        ~TransformHierarchy();
+        Node* GetRoot() const { return m_root; }
+        int GetNodeCount() const { return m_nodes.Size(); }
+        void Update();
+        void SetLocalTransform(int index, const Vector3& pos, const Quaternion& rot, const Vector3& scale);
+        void MarkDirty(int index);
+        void MarkStructureDirty();
+        void RemoveNode(int index);
+        const Matrix4x4& GetLocalToWorldMatrix(int index) const { return m_world_matrices[index]; }
+        const Quaternion& GetRotation(int index) const { return m_world_rotations[index]; }
+        const Vector3& GetScale(int index) const { return m_world_scales[index]; }
+
+    private:
+        static void UpdateWave(const Vector<TransformHierarchy*>& hierarchies);
+        int GetDepth() const;
+        void Prepare();
+        void Compute();
+        void Notify();
+        void Rebuild();
+        void ClearNodes();
+
+    private:
+        static List<TransformHierarchy*> m_hierarchies;
+        static int m_update_thread_count;
+        static float m_update_ms;
+        static int m_update_jobs;
+        static Mutex m_update_mutex;
+        static std::condition_variable m_update_condition;
+        Node* m_root;
+        // world transform of the root parent, read on the main thread before compute
+        Matrix4x4 m_root_parent_matrix;
+        Quaternion m_root_parent_rotation;
+        Vector3 m_root_parent_scale;
+        bool m_dirty;
+        bool m_structure_dirty;
+        Vector<Node*> m_nodes;
+        Vector<int> m_parents;
+        Vector<Vector3> m_local_positions;
+        Vector<Quaternion> m_local_rotations;
+        Vector<Vector3> m_local_scales;
+        Vector<Matrix4x4> m_world_matrices;
+        Vector<Quaternion> m_world_rotations;
+        Vector<Vector3> m_world_scales;
+        Vector<unsigned char> m_dirty_flags;
+        Vector<unsigned char> m_changed_flags;
+        // roots of nested hierarchies and the index of their parent here
+        Vector<Node*> m_child_roots;
+        Vector<int> m_child_root_parents;
+    };
+}
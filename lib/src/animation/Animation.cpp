@@ -181,7 +181,23 @@ namespace Viry3D
         const auto& clip = m_clips[state.clip_index];
         if (state.targets.Size() == 0)
         {
+            // resolve all curve targets with one index walk
+            Vector<String> paths(clip.curves.Size());
+            for (int i = 0; i < clip.curves.Size(); ++i)
+            {
+                paths[i] = clip.curves[i].path;
+            }
+
+            auto targets = this->FindAll(paths);
             state.targets.Resize(clip.curves.Size(), nullptr);
+            for (int i = 0; i < targets.Size(); ++i)
+            {
+                if (targets[i])
+                {
+                    targets[i]->EnableNotifyChildrenOnMatrixDirty(false);
+                    state.targets[i] = targets[i].get();
+                }
+            }
         }
 
         for (int i = 0; i < clip.curves.Size(); ++i)
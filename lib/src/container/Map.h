@@ -44,6 +44,7 @@ namespace Viry3D
 
 		void AddRange(ConstIterator begin, ConstIterator end);
 		Iterator Remove(ConstIterator pos);
+		Iterator LowerBound(const K& k);
 
 		Iterator begin() { return m_map.begin(); }
 		Iterator end() { return m_map.end(); }
@@ -144,4 +145,10 @@ namespace Viry3D
 	{
 		return m_map.erase(pos);
 	}
+
+	template<class K, class V>
+	typename Map<K, V>::Iterator Map<K, V>::LowerBound(const K& k)
+	{
+		return m_map.lower_bound(k);
+	}
 }
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "Display.h"
+#include "MemoryAllocator.h"
 #include "memory/Memory.h"
 
 namespace Viry3D
@@ -30,26 +31,29 @@ namespace Viry3D
     public:
         BufferObject(int size):
             m_buffer(VK_NULL_HANDLE),
-            m_memory(VK_NULL_HANDLE),
-            m_size(size)
+            m_size(size),
+            m_usage(0)
         {
-            Memory::Zero(&m_memory_info, sizeof(m_memory_info));
         }
 
         void Destroy(VkDevice device)
         {
             vkDestroyBuffer(device, m_buffer, nullptr);
-            vkFreeMemory(device, m_memory, nullptr);
+            m_buffer = VK_NULL_HANDLE;
+            Display::Instance()->FreeMemory(m_memory);
         }
 
         const VkBuffer& GetBuffer() const { return m_buffer; }
-        const VkDeviceMemory& GetMemory() const { return m_memory; }
+        const VkDeviceMemory& GetMemory() const { return m_memory.memory; }
+        VkDeviceSize GetMemoryOffset() const { return m_memory.offset; }
+        void* GetMappedData() const { return m_memory.mapped; }
         int GetSize() const { return m_size; }
+        VkBufferUsageFlags GetUsage() const { return m_usage; }
 
     private:
         VkBuffer m_buffer;
-        VkDeviceMemory m_memory;
-        VkMemoryAllocateInfo m_memory_info;
+        MemoryAllocation m_memory;
         int m_size;
+        VkBufferUsageFlags m_usage;
     };
 }
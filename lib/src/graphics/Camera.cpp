@@ -19,10 +19,38 @@
 #include "Texture.h"
 #include "Renderer.h"
 #include "Material.h"
+#include "MaterialPropertyBlock.h"
 #include "Shader.h"
+#include "SkinnedMeshRenderer.h"
+#include "Mesh.h"
+#include "BufferObject.h"
+#include "Application.h"
+#include "math/Frustum.h"
+#include "math/Mathf.h"
+#include "container/Map.h"
+#include "time/Time.h"
+
+// fewer dirty cmds than this are recorded on the main thread
+#define RECORD_PARALLEL_MIN 32
 
 namespace Viry3D
 {
+    // a batch draws with the material alone, so renderers with per renderer values in a property block are drawn on their own
+    static Ref<MeshRenderer> GetInstancingRenderer(const Ref<Renderer>& renderer)
+    {
+        Ref<MeshRenderer> mesh_renderer = RefCast<MeshRenderer>(renderer);
+        if (mesh_renderer && mesh_renderer->GetMesh() && !RefCast<SkinnedMeshRenderer>(renderer) && !renderer->GetPropertyBlock())
+        {
+            const Ref<Material>& material = mesh_renderer->GetMaterial();
+            if (material && material->GetShader()->IsInstancing())
+            {
+                return mesh_renderer;
+            }
+        }
+
+        return Ref<MeshRenderer>();
+    }
+
 	Camera::Camera():
 		m_render_pass_dirty(true),
 		m_renderer_order_dirty(true),
@@ -32,14 +60,26 @@ namespace Viry3D
 		m_viewport_rect(0, 0, 1, 1),
 		m_depth(0),
 		m_render_pass(VK_NULL_HANDLE),
-		m_cmd_pool(VK_NULL_HANDLE),
+		m_renderer_add_count(0),
+		m_transparent_count(0),
+		m_next_cmd_worker(0),
+		m_record_jobs(0),
+		m_record_begin_time(0),
+		m_record_ms(0),
+		m_record_cmd_count(0),
         m_view_matrix_dirty(true),
         m_projection_matrix_dirty(true),
         m_field_of_view(45),
         m_near_clip(0.3f),
         m_far_clip(1000),
         m_orthographic(false),
-        m_orthographic_size(1)
+        m_orthographic_size(1),
+        m_culling_enable(true),
+        m_visible_renderer_count(0),
+        m_culled_renderer_count(0),
+        m_instance_batches_dirty(true),
+        m_instance_capacity(0),
+        m_draw_capacity(0)
 	{
 
 	}
@@ -48,6 +88,7 @@ namespace Viry3D
 	{
 		this->ClearRenderPass();
 		this->ClearInstanceCmds();
+		this->ClearInstanceBatches();
 	}
 
     void Camera::OnMatrixDirty()
@@ -63,12 +104,13 @@ namespace Viry3D
 
             m_view_matrix = Matrix4x4::LookTo(this->GetPosition(), this->GetForward(), this->GetUp());
 
+            static const int view_matrix_id = Shader::PropertyToID(VIEW_MATRIX);
             for (auto& i : m_renderers)
             {
                 const Ref<Material>& material = i.renderer->GetMaterial();
                 if (material)
                 {
-                    material->SetMatrix(VIEW_MATRIX, m_view_matrix);
+                    material->SetMatrix(view_matrix_id, m_view_matrix);
                 }
             }
         }
@@ -128,12 +170,13 @@ namespace Viry3D
                 m_projection_matrix = Matrix4x4::Perspective(m_field_of_view, this->GetTargetWidth() / (float) this->GetTargetHeight(), m_near_clip, m_far_clip);
             }
 
+            static const int projection_matrix_id = Shader::PropertyToID(PROJECTION_MATRIX);
             for (auto& i : m_renderers)
             {
                 const Ref<Material>& material = i.renderer->GetMaterial();
                 if (material)
                 {
-                    material->SetMatrix(PROJECTION_MATRIX, m_projection_matrix);
+                    material->SetMatrix(projection_matrix_id, m_projection_matrix);
                 }
             }
         }
@@ -141,6 +184,11 @@ namespace Viry3D
         return m_projection_matrix;
     }
 
+    void Camera::SetCullingEnable(bool enable)
+    {
+        m_culling_enable = enable;
+    }
+
 	void Camera::SetClearFlags(CameraClearFlags flags)
 	{
 		m_clear_flags = flags;
@@ -150,7 +198,7 @@ namespace Viry3D
 	void Camera::SetClearColor(const Color& color)
 	{
 		m_clear_color = color;
-		Display::Instance()->MarkPrimaryCmdDirty();
+		Display::Instance()->MarkPrimaryCmdDirty(this);
 	}
 
 	void Camera::SetViewportRect(const Rect& rect)
@@ -162,7 +210,7 @@ namespace Viry3D
 	void Camera::SetDepth(int depth)
 	{
 		m_depth = depth;
-		Display::Instance()->MarkPrimaryCmdDirty();
+		Display::Instance()->MarkCameraOrderDirty();
 	}
 
 	void Camera::SetRenderTarget(const Ref<Texture>& color_texture, const Ref<Texture>& depth_texture)
@@ -174,9 +222,17 @@ namespace Viry3D
 
 	void Camera::Update()
 	{
+		this->FreeRetiredCmds(false);
+
         if (m_view_matrix_dirty)
         {
             this->GetViewMatrix();
+
+            // transparent draws are ordered by view depth
+            if (m_transparent_count > 0)
+            {
+                m_renderer_order_dirty = true;
+            }
         }
 
         if (m_projection_matrix_dirty)
@@ -190,18 +246,33 @@ namespace Viry3D
 			this->UpdateRenderPass();
 
 			m_instance_cmds_dirty = true;
-			Display::Instance()->MarkPrimaryCmdDirty();
+			Display::Instance()->MarkPrimaryCmdDirty(this);
 		}
 
 		if (m_renderer_order_dirty)
 		{
 			m_renderer_order_dirty = false;
-			this->SortRenderers();
 
-			Display::Instance()->MarkPrimaryCmdDirty();
+			if (this->SortRenderers())
+			{
+				m_instance_batches_dirty = true;
+
+				Display::Instance()->MarkPrimaryCmdDirty(this);
+			}
 		}
 
 		this->UpdateRenderers();
+		this->CullRenderers();
+
+		if (m_instance_batches_dirty)
+		{
+			m_instance_batches_dirty = false;
+			this->BuildInstanceBatches();
+
+			Display::Instance()->MarkPrimaryCmdDirty(this);
+		}
+
+		this->UpdateInstanceBatches();
 		this->UpdateInstanceCmds();
 	}
 
@@ -246,7 +317,8 @@ namespace Viry3D
 			m_render_target_depth,
 			m_clear_flags,
 			&m_render_pass,
-			m_framebuffers);
+			m_framebuffers,
+			&m_render_pass_key);
 	}
 
 	void Camera::ClearRenderPass()
@@ -261,86 +333,440 @@ namespace Viry3D
 
 		if (m_render_pass)
 		{
-			Shader::OnRenderPassDestroy(m_render_pass);
 			vkDestroyRenderPass(device, m_render_pass, nullptr);
 			m_render_pass = VK_NULL_HANDLE;
 		}
 	}
 
-	void Camera::SortRenderers()
+	// sort key bits from high to low:
+	// opaque:      queue 16 | pipeline 12 | material 12 | mesh 8 | depth 16, front to back
+	// transparent: queue 16 | depth 16 inverted, back to front | pipeline 12 | material 12 | mesh 8
+	#define SORT_QUEUE_SHIFT 48
+	#define SORT_ID_BITS 12
+	#define SORT_MESH_BITS 8
+	#define SORT_DEPTH_BITS 16
+
+	struct RendererSortItem
+	{
+		uint64_t key;
+		int index;
+	};
+
+	// lsd radix sort of 8 bit digits, stable, passes where all keys share a digit are skipped
+	static void RadixSort(Vector<RendererSortItem>& items, Vector<RendererSortItem>& temp)
+	{
+		temp.Resize(items.Size());
+
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			int counts[256] = { 0 };
+			for (int i = 0; i < items.Size(); ++i)
+			{
+				counts[(items[i].key >> shift) & 0xff]++;
+			}
+
+			if (items.Size() == 0 || counts[(items[0].key >> shift) & 0xff] == items.Size())
+			{
+				continue;
+			}
+
+			int offset = 0;
+			for (int i = 0; i < 256; ++i)
+			{
+				int count = counts[i];
+				counts[i] = offset;
+				offset += count;
+			}
+
+			for (int i = 0; i < items.Size(); ++i)
+			{
+				temp[counts[(items[i].key >> shift) & 0xff]++] = items[i];
+			}
+
+			std::swap(items, temp);
+		}
+	}
+
+	static uint32_t GetSortId(Map<void*, uint32_t>& ids, void* p, int bits)
+	{
+		uint32_t* id;
+		if (ids.TryGet(p, &id))
+		{
+			return *id;
+		}
+
+		// ids past the bit range share the last one, only costs sort quality
+		uint32_t new_id = Mathf::Min((uint32_t) ids.Size(), (uint32_t) (1 << bits) - 1);
+		ids.Add(p, new_id);
+		return new_id;
+	}
+
+	static void CountBinds(const Vector<RendererSortItem>& items, const Vector<RendererInstance>& renderers, int* pipeline_binds, int* material_binds, int* mesh_binds)
+	{
+		Shader* shader = nullptr;
+		Material* material = nullptr;
+		BufferObject* mesh = nullptr;
+
+		*pipeline_binds = 0;
+		*material_binds = 0;
+		*mesh_binds = 0;
+
+		for (int i = 0; i < items.Size(); ++i)
+		{
+			const Ref<Renderer>& renderer = renderers[items[i].index].renderer;
+			const Ref<Material>& m = renderer->GetMaterial();
+			if (!m)
+			{
+				continue;
+			}
+
+			if (m->GetShader().get() != shader)
+			{
+				shader = m->GetShader().get();
+				(*pipeline_binds)++;
+			}
+			if (m.get() != material)
+			{
+				material = m.get();
+				(*material_binds)++;
+			}
+			BufferObject* vb = renderer->GetVertexBuffer().get();
+			if (vb != mesh)
+			{
+				mesh = vb;
+				(*mesh_binds)++;
+			}
+		}
+	}
+
+	bool Camera::SortRenderers()
 	{
-		m_renderers.Sort([](const RendererInstance& a, const RendererInstance& b) {
-			const Ref<Material>& ma = a.renderer->GetMaterial();
-			const Ref<Material>& mb = b.renderer->GetMaterial();
-			if (ma && mb)
+		float sort_begin = Time::GetRealTimeSinceStartup();
+
+		Vector3 camera_pos = this->GetPosition();
+		Vector3 camera_forward = this->GetForward();
+		float depth_min = m_orthographic ? 0 : m_near_clip;
+		float depth_range = Mathf::Max(m_far_clip - depth_min, 0.0001f);
+		const uint64_t depth_max = (1 << SORT_DEPTH_BITS) - 1;
+
+		Map<void*, uint32_t> pipeline_ids;
+		Map<void*, uint32_t> material_ids;
+		Map<void*, uint32_t> mesh_ids;
+
+		Vector<RendererSortItem> items;
+		Vector<RendererSortItem> unsorted_items;
+		Vector<RendererSortItem> temp;
+		m_transparent_count = 0;
+
+		for (int i = 0; i < m_renderers.Size(); ++i)
+		{
+			RendererInstance& instance = m_renderers[i];
+			const Ref<Renderer>& renderer = instance.renderer;
+			const Ref<Material>& material = renderer->GetMaterial();
+
+			// renderers without material draw nothing, keep them first like before
+			uint64_t queue = 0;
+			uint64_t pipeline = 0;
+			uint64_t material_id = 0;
+			if (material)
 			{
-				return ma->GetQueue() < mb->GetQueue();
+				queue = (uint64_t) Mathf::Clamp(material->GetQueue() + 1, 0, 0xffff);
+				pipeline = GetSortId(pipeline_ids, material->GetShader().get(), SORT_ID_BITS);
+				material_id = GetSortId(material_ids, material.get(), SORT_ID_BITS);
 			}
-			else if (!ma && mb)
+			uint64_t mesh = GetSortId(mesh_ids, renderer->GetVertexBuffer().get(), SORT_MESH_BITS);
+
+			Bounds bounds;
+			Vector3 pos;
+			if (renderer->GetBounds(&bounds))
 			{
-				return true;
+				pos = (bounds.Min() + bounds.Max()) * 0.5f;
 			}
 			else
 			{
-				return false;
+				pos = renderer->GetPosition();
 			}
-		});
+			float depth = Mathf::Clamp01((camera_forward.Dot(pos - camera_pos) - depth_min) / depth_range);
+			uint64_t depth_key = (uint64_t) (depth * depth_max);
+
+			uint64_t key = queue << SORT_QUEUE_SHIFT;
+			if (material && material->GetQueue() >= (int) RenderState::Queue::Transparent)
+			{
+				key |= (depth_max - depth_key) << (SORT_ID_BITS * 2 + SORT_MESH_BITS);
+				key |= pipeline << (SORT_ID_BITS + SORT_MESH_BITS);
+				key |= material_id << SORT_MESH_BITS;
+				key |= mesh;
+				m_transparent_count++;
+			}
+			else
+			{
+				key |= pipeline << (SORT_ID_BITS + SORT_MESH_BITS + SORT_DEPTH_BITS);
+				key |= material_id << (SORT_MESH_BITS + SORT_DEPTH_BITS);
+				key |= mesh << SORT_DEPTH_BITS;
+				key |= depth_key;
+			}
+			instance.sort_key = key;
+
+			RendererSortItem item;
+			item.key = key;
+			item.index = i;
+			items.Add(item);
+
+			item.key = (queue << SORT_QUEUE_SHIFT) | instance.add_index;
+			unsorted_items.Add(item);
+		}
+
+		RadixSort(items, temp);
+		RadixSort(unsorted_items, temp);
+
+		m_sort_stats.draw_count = items.Size();
+		CountBinds(items, m_renderers, &m_sort_stats.pipeline_binds, &m_sort_stats.material_binds, &m_sort_stats.mesh_binds);
+		CountBinds(unsorted_items, m_renderers, &m_sort_stats.pipeline_binds_unsorted, &m_sort_stats.material_binds_unsorted, &m_sort_stats.mesh_binds_unsorted);
+
+		bool changed = false;
+		for (int i = 0; i < items.Size(); ++i)
+		{
+			if (items[i].index != i)
+			{
+				changed = true;
+				break;
+			}
+		}
+
+		// permute into key order and repoint the slots, batch indices are rebuilt by the caller
+		if (changed)
+		{
+			Vector<RendererInstance> renderers;
+			for (int i = 0; i < items.Size(); ++i)
+			{
+				renderers.Add(m_renderers[items[i].index]);
+				m_renderer_slots[renderers[i].slot].index = i;
+			}
+			m_renderers = renderers;
+		}
+
+		m_sort_stats.sort_ms = (Time::GetRealTimeSinceStartup() - sort_begin) * 1000;
+
+		return changed;
 	}
 
 	void Camera::UpdateInstanceCmds()
 	{
+		int worker_count = Application::Instance()->GetRecordThreadPool()->GetThreadCount();
+		Vector<Vector<RendererInstance*>> renderer_jobs(worker_count);
+		Vector<Vector<DrawGroup*>> group_jobs(worker_count);
+		int cmd_count = 0;
+
 		for (auto& i : m_renderers)
 		{
+			// culled cmds are recorded once they become visible, batched ones by their batch
+			if (!i.visible || i.instance_batch >= 0)
+			{
+				if (m_instance_cmds_dirty)
+				{
+					i.cmd_dirty = true;
+				}
+				continue;
+			}
+
 			if (i.cmd_dirty || m_instance_cmds_dirty)
 			{
 				i.cmd_dirty = false;
 
+				// cmd may be pending in a frame in flight, record a new one and retire it
+				this->RetireInstanceCmd(&i.cmd, i.cmd_worker);
+
 				if (i.cmd == VK_NULL_HANDLE)
 				{
-					if (m_cmd_pool == VK_NULL_HANDLE)
-					{
-						Display::Instance()->CreateCommandPool(&m_cmd_pool);
-					}
-
-					Display::Instance()->CreateCommandBuffer(m_cmd_pool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, &i.cmd);
+					this->AllocInstanceCmd(&i.cmd, &i.cmd_worker);
 				}
 
-				this->BuildInstanceCmd(i.cmd, i.renderer);
+				renderer_jobs[i.cmd_worker].Add(&i);
+				cmd_count++;
+			}
+		}
+
+		for (auto& i : m_draw_groups)
+		{
+			if (i.cmd_dirty || m_instance_cmds_dirty)
+			{
+				i.cmd_dirty = false;
+
+				this->RetireInstanceCmd(&i.cmd, i.cmd_worker);
 
-                Display::Instance()->MarkPrimaryCmdDirty();
+				if (i.cmd == VK_NULL_HANDLE)
+				{
+					this->AllocInstanceCmd(&i.cmd, &i.cmd_worker);
+				}
+
+				group_jobs[i.cmd_worker].Add(&i);
+				cmd_count++;
 			}
 		}
 
 		m_instance_cmds_dirty = false;
+
+		if (cmd_count == 0)
+		{
+			return;
+		}
+
+		Display::Instance()->MarkPrimaryCmdDirty(this);
+
+		m_record_begin_time = Time::GetRealTimeSinceStartup();
+		m_record_cmd_count = cmd_count;
+
+		// no job of this camera is running, so the worker pools can be used here
+		if (cmd_count < RECORD_PARALLEL_MIN)
+		{
+			for (int i = 0; i < worker_count; ++i)
+			{
+				for (auto j : renderer_jobs[i])
+				{
+					this->BuildInstanceCmd(j->cmd, j->renderer);
+				}
+				for (auto j : group_jobs[i])
+				{
+					this->BuildDrawGroupCmd(*j);
+				}
+			}
+
+			m_record_ms = (Time::GetRealTimeSinceStartup() - m_record_begin_time) * 1000;
+			return;
+		}
+
+		// each worker records only cmds of its own pool, pools are externally synchronized
+		for (int i = 0; i < worker_count; ++i)
+		{
+			if (renderer_jobs[i].Empty() && group_jobs[i].Empty())
+			{
+				continue;
+			}
+
+			m_record_mutex.lock();
+			m_record_jobs++;
+			m_record_mutex.unlock();
+
+			Vector<RendererInstance*> renderers = renderer_jobs[i];
+			Vector<DrawGroup*> groups = group_jobs[i];
+
+			Thread::Task task;
+			task.job = [=]() {
+				for (auto j : renderers)
+				{
+					this->BuildInstanceCmd(j->cmd, j->renderer);
+				}
+				for (auto j : groups)
+				{
+					this->BuildDrawGroupCmd(*j);
+				}
+
+				std::lock_guard<Mutex> lock(m_record_mutex);
+				m_record_jobs--;
+				if (m_record_jobs == 0)
+				{
+					m_record_ms = (Time::GetRealTimeSinceStartup() - m_record_begin_time) * 1000;
+					m_record_condition.notify_all();
+				}
+
+				return Ref<Object>();
+			};
+			Application::Instance()->GetRecordThreadPool()->AddTask(task, i);
+		}
+	}
+
+	void Camera::WaitInstanceCmds()
+	{
+		std::unique_lock<Mutex> lock(m_record_mutex);
+		m_record_condition.wait(lock, [this]() {
+			return m_record_jobs == 0;
+		});
+	}
+
+	void Camera::AllocInstanceCmd(VkCommandBuffer* cmd, int* worker)
+	{
+		if (m_cmd_pools.Empty())
+		{
+			m_cmd_pools.Resize(Application::Instance()->GetRecordThreadPool()->GetThreadCount());
+			for (int i = 0; i < m_cmd_pools.Size(); ++i)
+			{
+				Display::Instance()->CreateCommandPool(&m_cmd_pools[i]);
+			}
+		}
+
+		*worker = m_next_cmd_worker;
+		m_next_cmd_worker = (m_next_cmd_worker + 1) % m_cmd_pools.Size();
+
+		Display::Instance()->CreateCommandBuffer(m_cmd_pools[*worker], VK_COMMAND_BUFFER_LEVEL_SECONDARY, cmd);
+	}
+
+	void Camera::FreeInstanceCmd(VkCommandBuffer* cmd, int worker)
+	{
+		if (*cmd)
+		{
+			vkFreeCommandBuffers(Display::Instance()->GetDevice(), m_cmd_pools[worker], 1, cmd);
+			*cmd = VK_NULL_HANDLE;
+		}
+	}
+
+	void Camera::RetireInstanceCmd(VkCommandBuffer* cmd, int worker)
+	{
+		if (*cmd)
+		{
+			RetiredRendererCmd retired;
+			retired.cmd = *cmd;
+			retired.cmd_worker = worker;
+			retired.frame = Display::Instance()->GetFrameCount();
+			m_retired_cmds.Add(retired);
+			*cmd = VK_NULL_HANDLE;
+		}
 	}
 
 	void Camera::ClearInstanceCmds()
 	{
 		VkDevice device = Display::Instance()->GetDevice();
 
+		this->WaitInstanceCmds();
+		this->FreeRetiredCmds(true);
+
 		for (auto& i : m_renderers)
 		{
-			if (i.cmd)
-			{
-				vkFreeCommandBuffers(device, m_cmd_pool, 1, &i.cmd);
-				i.cmd = VK_NULL_HANDLE;
-			}
+			this->FreeInstanceCmd(&i.cmd, i.cmd_worker);
+		}
+
+		for (auto& i : m_draw_groups)
+		{
+			this->FreeInstanceCmd(&i.cmd, i.cmd_worker);
 		}
 
-		if (m_cmd_pool)
+		for (int i = 0; i < m_cmd_pools.Size(); ++i)
 		{
-			vkDestroyCommandPool(device, m_cmd_pool, nullptr);
-			m_cmd_pool = VK_NULL_HANDLE;
+			vkDestroyCommandPool(device, m_cmd_pools[i], nullptr);
 		}
+		m_cmd_pools.Clear();
 	}
 
 	Vector<VkCommandBuffer> Camera::GetInstanceCmds() const
 	{
 		Vector<VkCommandBuffer> cmds;
 
-		for (const auto& i : m_renderers)
+		for (int i = 0; i < m_renderers.Size(); ++i)
 		{
-			cmds.Add(i.cmd);
+			const RendererInstance& instance = m_renderers[i];
+
+			if (instance.instance_batch >= 0)
+			{
+				// group is drawn at the position of its first renderer
+				const DrawGroup& group = m_draw_groups[m_instance_batches[instance.instance_batch].group];
+				if (group.first_renderer == i)
+				{
+					cmds.Add(group.cmd);
+				}
+			}
+			else if (instance.visible)
+			{
+				cmds.Add(instance.cmd);
+			}
 		}
 
 		return cmds;
@@ -392,47 +818,128 @@ namespace Viry3D
 
 	void Camera::AddRenderer(const Ref<Renderer>& renderer)
 	{
+		if (renderer->GetCamera() == this)
+		{
+			return;
+		}
+
+		this->WaitInstanceCmds();
+
+		const Ref<Material>& material = renderer->GetMaterial();
+		if (material)
+		{
+			material->SetMatrix(VIEW_MATRIX, this->GetViewMatrix());
+			material->SetMatrix(PROJECTION_MATRIX, this->GetProjectionMatrix());
+		}
+
+		int slot;
+		if (m_free_renderer_slots.Size() > 0)
+		{
+			slot = m_free_renderer_slots[m_free_renderer_slots.Size() - 1];
+			m_free_renderer_slots.Resize(m_free_renderer_slots.Size() - 1);
+		}
+		else
+		{
+			slot = m_renderer_slots.Size();
+			m_renderer_slots.Add(RendererSlot());
+		}
+		m_renderer_slots[slot].index = m_renderers.Size();
+
 		RendererInstance instance;
 		instance.renderer = renderer;
+		instance.add_index = m_renderer_add_count++;
+		instance.slot = slot;
+		m_renderers.Add(instance);
+
+		// appended last, the sort places it and batch indices must be rebuilt
+		this->MarkRendererOrderDirty();
+		m_instance_batches_dirty = true;
+
+		RendererHandle handle;
+		handle.slot = slot;
+		handle.generation = m_renderer_slots[slot].generation;
+		renderer->OnAddToCamera(this, handle);
+	}
 
-		if (!m_renderers.Contains(instance))
+	void Camera::RemoveRenderer(const Ref<Renderer>& renderer)
+	{
+		RendererInstance* instance = nullptr;
+		if (renderer->GetCamera() == this)
 		{
-            const Ref<Material>& material = renderer->GetMaterial();
-            if (material)
-            {
-                material->SetMatrix(VIEW_MATRIX, this->GetViewMatrix());
-                material->SetMatrix(PROJECTION_MATRIX, this->GetProjectionMatrix());
-            }
+			instance = this->GetRendererInstance(renderer->GetCameraHandle());
+		}
+		if (instance == nullptr)
+		{
+			return;
+		}
 
-			m_renderers.AddLast(instance);
-			this->MarkRendererOrderDirty();
+		this->WaitInstanceCmds();
+
+		// the cmd and the renderer buffers may still be used by frames in flight
+		if (instance->cmd)
+		{
+			RetiredRendererCmd retired;
+			retired.renderer = renderer;
+			retired.cmd = instance->cmd;
+			retired.cmd_worker = instance->cmd_worker;
+			retired.frame = Display::Instance()->GetFrameCount();
+			m_retired_cmds.Add(retired);
+		}
 
-			renderer->OnAddToCamera(this);
+		// move the last renderer into the hole, the sort restores draw order
+		int slot = instance->slot;
+		int index = m_renderer_slots[slot].index;
+		int last = m_renderers.Size() - 1;
+		if (index != last)
+		{
+			m_renderers[index] = m_renderers[last];
+			m_renderer_slots[m_renderers[index].slot].index = index;
+			this->MarkRendererOrderDirty();
 		}
+		m_renderers.Resize(last);
+
+		m_renderer_slots[slot].index = -1;
+		m_renderer_slots[slot].generation++;
+		m_free_renderer_slots.Add(slot);
+
+		m_instance_batches_dirty = true;
+
+		Display::Instance()->MarkPrimaryCmdDirty(this);
+
+		renderer->OnRemoveFromCamera(this);
 	}
 
-	void Camera::RemoveRenderer(const Ref<Renderer>& renderer)
+	RendererInstance* Camera::GetRendererInstance(const RendererHandle& handle)
 	{
-		VkDevice device = Display::Instance()->GetDevice();
+		if (handle.slot < 0 || handle.slot >= m_renderer_slots.Size())
+		{
+			return nullptr;
+		}
 
-		Display::Instance()->WaitDevice();
+		const RendererSlot& slot = m_renderer_slots[handle.slot];
+		if (slot.index < 0 || slot.generation != handle.generation)
+		{
+			return nullptr;
+		}
+
+		return &m_renderers[slot.index];
+	}
 
-		for (auto i = m_renderers.begin(); i != m_renderers.end(); ++i)
+	void Camera::FreeRetiredCmds(bool all)
+	{
+		for (int i = 0; i < m_retired_cmds.Size(); )
 		{
-			if (i->renderer == renderer)
+			RetiredRendererCmd& retired = m_retired_cmds[i];
+			if (all || Display::Instance()->IsFrameComplete(retired.frame))
 			{
-				if (i->cmd)
-				{
-					vkFreeCommandBuffers(device, m_cmd_pool, 1, &i->cmd);
-				}
-				m_renderers.Remove(i);
-				break;
+				this->FreeInstanceCmd(&retired.cmd, retired.cmd_worker);
+				m_retired_cmds.Remove(i);
+			}
+			else
+			{
+				++i;
 			}
 		}
-
-		Display::Instance()->MarkPrimaryCmdDirty();
-
-		renderer->OnRemoveFromCamera(this);
 	}
 
 	void Camera::MarkRendererOrderDirty()
@@ -442,12 +949,15 @@ namespace Viry3D
 
 	void Camera::MarkInstanceCmdDirty(Renderer* renderer)
 	{
-		for (auto& i : m_renderers)
+		RendererInstance* instance = this->GetRendererInstance(renderer->GetCameraHandle());
+		if (instance)
 		{
-			if (i.renderer.get() == renderer)
+			instance->cmd_dirty = true;
+
+			// mesh, material or property block may have changed the batch
+			if (instance->instance_batch >= 0 || GetInstancingRenderer(instance->renderer))
 			{
-				i.cmd_dirty = true;
-				break;
+				m_instance_batches_dirty = true;
 			}
 		}
 	}
@@ -465,39 +975,45 @@ namespace Viry3D
 			return;
 		}
 
-		const Ref<Material>& instance_material = renderer->GetInstanceMaterial();
+		const Ref<MaterialPropertyBlock>& property_block = renderer->GetPropertyBlock();
 		const Ref<Shader>& shader = material->GetShader();
 
-		Vector<VkDescriptorSet> descriptor_sets = material->GetDescriptorSets();
+		// instancing shaders need the instance stream, only mesh renderers are batched
+		if (shader->IsInstancing())
+		{
+			Display::Instance()->BuildEmptyInstanceCmd(cmd, m_render_pass);
+			return;
+		}
 
-		if (instance_material)
+		Vector<VkDescriptorSet> descriptor_sets = material->GetDescriptorSets();
+		Vector<uint32_t> dynamic_offsets;
+		for (int i = 0; i < descriptor_sets.Size(); ++i)
 		{
-			const Vector<VkDescriptorSet>& instance_descriptor_sets = instance_material->GetDescriptorSets();
-			const Map<String, MaterialProperty>& instance_properties = instance_material->GetProperties();
-			for (const auto& i : instance_properties)
+			// sets holding per renderer values come from the block, the rest from the material
+			VkDescriptorSet block_set = VK_NULL_HANDLE;
+			if (property_block && property_block->GetShader() == shader)
 			{
-				int instance_set_index = instance_material->FindUniformSetIndex(i.second.name);
-				if (instance_set_index >= 0)
-				{
-					descriptor_sets[instance_set_index] = instance_descriptor_sets[instance_set_index];
-				}
+				block_set = property_block->GetDescriptorSet(i);
 			}
-		}
 
-		bool color_attachment = true;
-		bool depth_attachment = true;
-		if (this->HasRenderTarget())
-		{
-			color_attachment = (bool) this->GetRenderTargetColor();
-			depth_attachment = (bool) this->GetRenderTargetDepth();
+			if (block_set != VK_NULL_HANDLE)
+			{
+				descriptor_sets[i] = block_set;
+				property_block->GetDynamicOffsets(i, dynamic_offsets);
+			}
+			else
+			{
+				material->GetDynamicOffsets(i, dynamic_offsets);
+			}
 		}
 
 		Display::Instance()->BuildInstanceCmd(
 			cmd,
 			m_render_pass,
 			shader->GetPipelineLayout(),
-			shader->GetPipeline(m_render_pass, color_attachment, depth_attachment),
+			shader->GetPipeline(m_render_pass_key),
 			descriptor_sets,
+			dynamic_offsets,
 			this->GetTargetWidth(),
 			this->GetTargetHeight(),
 			m_viewport_rect,
@@ -513,4 +1029,314 @@ namespace Viry3D
 			i.renderer->Update();
 		}
 	}
+
+	void Camera::CullRenderers()
+	{
+		Frustum frustum(this->GetProjectionMatrix() * this->GetViewMatrix());
+		bool visible_changed = false;
+
+		m_visible_renderer_count = 0;
+		m_culled_renderer_count = 0;
+
+		for (auto& i : m_renderers)
+		{
+			bool visible = true;
+
+			Bounds bounds;
+			if (m_culling_enable && i.renderer->GetBounds(&bounds))
+			{
+				visible = frustum.ContainsBounds(bounds.Min(), bounds.Max()) != ContainsResult::Out;
+			}
+
+			if (i.visible != visible)
+			{
+				i.visible = visible;
+
+				if (i.instance_batch >= 0)
+				{
+					m_instance_batches[i.instance_batch].data_dirty = true;
+				}
+				else
+				{
+					visible_changed = true;
+				}
+			}
+
+			if (visible)
+			{
+				m_visible_renderer_count++;
+			}
+			else
+			{
+				m_culled_renderer_count++;
+			}
+		}
+
+		// primary cmd only executes visible instance cmds
+		if (visible_changed)
+		{
+			Display::Instance()->MarkPrimaryCmdDirty(this);
+		}
+	}
+
+	void Camera::BuildInstanceBatches()
+	{
+		Vector<InstanceBatch> batches;
+		Vector<DrawGroup> old_groups = m_draw_groups;
+		m_draw_groups.Clear();
+
+		for (int i = 0; i < m_renderers.Size(); ++i)
+		{
+			m_renderers[i].instance_batch = -1;
+
+			Ref<MeshRenderer> renderer = GetInstancingRenderer(m_renderers[i].renderer);
+			if (!renderer)
+			{
+				continue;
+			}
+
+			const Ref<Mesh>& mesh = renderer->GetMesh();
+			const Ref<Material>& material = renderer->GetMaterial();
+			int submesh = renderer->GetSubmesh();
+
+			int index = -1;
+			for (int j = 0; j < batches.Size(); ++j)
+			{
+				if (batches[j].mesh == mesh && batches[j].submesh == submesh && batches[j].material == material)
+				{
+					index = j;
+					break;
+				}
+			}
+
+			if (index < 0)
+			{
+				InstanceBatch batch;
+				batch.mesh = mesh;
+				batch.submesh = submesh;
+				batch.material = material;
+
+				for (int j = 0; j < m_draw_groups.Size(); ++j)
+				{
+					if (m_draw_groups[j].mesh == mesh && m_draw_groups[j].material == material)
+					{
+						batch.group = j;
+						break;
+					}
+				}
+
+				if (batch.group < 0)
+				{
+					DrawGroup group;
+					group.mesh = mesh;
+					group.material = material;
+					group.first_renderer = i;
+
+					// keep the cmd of the same group from the last build
+					for (auto& j : old_groups)
+					{
+						if (j.mesh == mesh && j.material == material && j.cmd)
+						{
+							group.cmd = j.cmd;
+							group.cmd_worker = j.cmd_worker;
+							j.cmd = VK_NULL_HANDLE;
+							break;
+						}
+					}
+
+					batch.group = m_draw_groups.Size();
+					m_draw_groups.Add(group);
+				}
+
+				index = batches.Size();
+				batches.Add(batch);
+			}
+
+			batches[index].instances.Add(i);
+		}
+
+		// order draws by group so every group is a contiguous range of the draw buffer
+		m_instance_batches.Clear();
+		int instance_count = 0;
+		for (int i = 0; i < m_draw_groups.Size(); ++i)
+		{
+			m_draw_groups[i].first_draw = m_instance_batches.Size();
+
+			for (int j = 0; j < batches.Size(); ++j)
+			{
+				if (batches[j].group == i)
+				{
+					batches[j].first_instance = instance_count;
+					instance_count += batches[j].instances.Size();
+
+					for (int k = 0; k < batches[j].instances.Size(); ++k)
+					{
+						m_renderers[batches[j].instances[k]].instance_batch = m_instance_batches.Size();
+					}
+					m_instance_batches.Add(batches[j]);
+				}
+			}
+
+			m_draw_groups[i].draw_count = m_instance_batches.Size() - m_draw_groups[i].first_draw;
+		}
+
+		// old cmds and buffers may be used by frames in flight
+		for (auto& i : old_groups)
+		{
+			if (i.cmd)
+			{
+				RetiredRendererCmd retired;
+				retired.cmd = i.cmd;
+				retired.cmd_worker = i.cmd_worker;
+				retired.frame = Display::Instance()->GetFrameCount();
+				m_retired_cmds.Add(retired);
+			}
+		}
+
+		if (instance_count > m_instance_capacity)
+		{
+			if (m_instance_buffer)
+			{
+				Display::Instance()->RetireBuffer(m_instance_buffer);
+			}
+
+			m_instance_capacity = Mathf::Max(instance_count, m_instance_capacity * 2);
+			m_instance_buffer = Display::Instance()->CreateBuffer(nullptr, m_instance_capacity * sizeof(Matrix4x4), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, true);
+		}
+		if (m_instance_batches.Size() > m_draw_capacity)
+		{
+			if (m_draw_buffer)
+			{
+				Display::Instance()->RetireBuffer(m_draw_buffer);
+			}
+
+			m_draw_capacity = Mathf::Max(m_instance_batches.Size(), m_draw_capacity * 2);
+			m_draw_buffer = Display::Instance()->CreateBuffer(nullptr, m_draw_capacity * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, true);
+		}
+
+		m_instance_matrices.Resize(instance_count);
+
+		// draw ranges or shared buffers changed, every group cmd is recorded again
+		for (auto& i : m_draw_groups)
+		{
+			i.cmd_dirty = true;
+		}
+	}
+
+	void Camera::UpdateInstanceBatches()
+	{
+		bool multi_draw = Display::Instance()->IsMultiDrawIndirectEnable();
+
+		for (int i = 0; i < m_instance_batches.Size(); ++i)
+		{
+			InstanceBatch& batch = m_instance_batches[i];
+
+			uint32_t matrix_version = 0;
+			for (int j = 0; j < batch.instances.Size(); ++j)
+			{
+				matrix_version += m_renderers[batch.instances[j]].renderer->GetMatrixVersion();
+			}
+
+			// versions only grow, so the sum changes whenever any matrix does
+			if (batch.matrix_version != matrix_version)
+			{
+				batch.matrix_version = matrix_version;
+				batch.data_dirty = true;
+			}
+
+			if (!batch.data_dirty)
+			{
+				continue;
+			}
+			batch.data_dirty = false;
+
+			int instance_count = 0;
+			for (int j = 0; j < batch.instances.Size(); ++j)
+			{
+				const RendererInstance& instance = m_renderers[batch.instances[j]];
+				if (instance.visible)
+				{
+					m_instance_matrices[batch.first_instance + instance_count] = instance.renderer->GetLocalToWorldMatrix();
+					instance_count++;
+				}
+			}
+			batch.instance_count = instance_count;
+
+			if (instance_count > 0)
+			{
+				Display::Instance()->UpdateBuffer(
+					m_instance_buffer,
+					batch.first_instance * sizeof(Matrix4x4),
+					&m_instance_matrices[batch.first_instance],
+					instance_count * sizeof(Matrix4x4));
+			}
+
+			// first instance must stay 0 without the feature, the stream is bound at the batch offset instead
+			VkDrawIndexedIndirectCommand draw;
+			draw.indexCount = batch.mesh->GetSubmesh(batch.submesh).index_count;
+			draw.instanceCount = instance_count;
+			draw.firstIndex = batch.mesh->GetSubmesh(batch.submesh).index_first;
+			draw.vertexOffset = 0;
+			draw.firstInstance = multi_draw ? batch.first_instance : 0;
+
+			Display::Instance()->UpdateBuffer(m_draw_buffer, i * sizeof(VkDrawIndexedIndirectCommand), &draw, sizeof(draw));
+		}
+	}
+
+	void Camera::ClearInstanceBatches()
+	{
+		VkDevice device = Display::Instance()->GetDevice();
+
+		if (m_instance_buffer)
+		{
+			m_instance_buffer->Destroy(device);
+			m_instance_buffer.reset();
+		}
+		if (m_draw_buffer)
+		{
+			m_draw_buffer->Destroy(device);
+			m_draw_buffer.reset();
+		}
+		m_instance_capacity = 0;
+		m_draw_capacity = 0;
+		m_instance_batches.Clear();
+		m_draw_groups.Clear();
+	}
+
+	void Camera::BuildDrawGroupCmd(DrawGroup& group)
+	{
+		const Ref<Material>& material = group.material;
+		const Ref<Shader>& shader = material->GetShader();
+		const Vector<VkDescriptorSet>& descriptor_sets = material->GetDescriptorSets();
+
+		Vector<uint32_t> dynamic_offsets;
+		for (int i = 0; i < descriptor_sets.Size(); ++i)
+		{
+			material->GetDynamicOffsets(i, dynamic_offsets);
+		}
+
+		Vector<int> first_instances(group.draw_count);
+		for (int i = 0; i < group.draw_count; ++i)
+		{
+			first_instances[i] = m_instance_batches[group.first_draw + i].first_instance;
+		}
+
+		Display::Instance()->BuildInstanceCmd(
+			group.cmd,
+			m_render_pass,
+			shader->GetPipelineLayout(),
+			shader->GetPipeline(m_render_pass_key),
+			descriptor_sets,
+			dynamic_offsets,
+			this->GetTargetWidth(),
+			this->GetTargetHeight(),
+			m_viewport_rect,
+			group.mesh->GetVertexBuffer(),
+			group.mesh->GetIndexBuffer(),
+			m_draw_buffer,
+			group.first_draw,
+			group.draw_count,
+			m_instance_buffer,
+			first_instances);
+	}
 }
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "Node.h"
+#include "Renderer.h"
 #include "Display.h"
 #include "CameraClearFlags.h"
 #include "Color.h"
@@ -25,22 +26,88 @@
 #include "math/Matrix4x4.h"
 #include "container/Vector.h"
 #include "container/List.h"
+#include "thread/ThreadPool.h"
 
 namespace Viry3D
 {
     class Texture;
-    class Renderer;
+    class Mesh;
+    class Material;
+    class BufferObject;
+
+    // mesh renderers sharing mesh, submesh and an instancing material, one indirect draw of the camera draw buffer.
+    // instances own a fixed range of the camera instance stream starting at first_instance, visible ones are packed first.
+    struct InstanceBatch
+    {
+        Ref<Mesh> mesh;
+        int submesh = 0;
+        Ref<Material> material;
+        // indices into the camera renderer array, valid until the next batch build
+        Vector<int> instances;
+        int group = -1;
+        int first_instance = 0;
+        int instance_count = 0;
+        uint32_t matrix_version = 0;
+        bool data_dirty = true;
+    };
+
+    // consecutive batches sharing material and mesh buffers, recorded as one multi draw
+    struct DrawGroup
+    {
+        Ref<Mesh> mesh;
+        Ref<Material> material;
+        // index of the renderer the group is drawn in place of
+        int first_renderer = -1;
+        int first_draw = 0;
+        int draw_count = 0;
+        bool cmd_dirty = true;
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        int cmd_worker = -1;
+    };
 
     struct RendererInstance
     {
         Ref<Renderer> renderer;
         bool cmd_dirty = true;
+        bool visible = true;
+        int instance_batch = -1;
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        // cmd is allocated from and recorded by this record thread pool worker
+        int cmd_worker = -1;
+        uint64_t sort_key = 0;
+        // insertion order, ties of the queue only order
+        uint32_t add_index = 0;
+        int slot = -1;
+    };
+
+    struct RendererSlot
+    {
+        // index into the camera renderer array, -1 when free
+        int index = -1;
+        uint32_t generation = 0;
+    };
+
+    // secondary cmd of a removed renderer or draw group, freed with the renderer ref once its last frame completed
+    struct RetiredRendererCmd
+    {
+        Ref<Renderer> renderer;
         VkCommandBuffer cmd = VK_NULL_HANDLE;
+        int cmd_worker = -1;
+        int frame = 0;
+    };
 
-        bool operator ==(const RendererInstance& a) const
-        {
-            return this->renderer == a.renderer;
-        }
+    // state changes between consecutive draws of the sorted order,
+    // *_unsorted counts are for the queue only order renderers were added in
+    struct RenderSortStats
+    {
+        int draw_count = 0;
+        int pipeline_binds = 0;
+        int material_binds = 0;
+        int mesh_binds = 0;
+        int pipeline_binds_unsorted = 0;
+        int material_binds_unsorted = 0;
+        int mesh_binds_unsorted = 0;
+        float sort_ms = 0;
     };
 
     class Camera : public Node
@@ -66,6 +133,7 @@ namespace Viry3D
         void OnResize(int width, int height);
         void OnPause();
         VkRenderPass GetRenderPass() const { return m_render_pass; }
+        const RenderPassKey& GetRenderPassKey() const { return m_render_pass_key; }
         VkFramebuffer GetFramebuffer(int index) const;
         int GetTargetWidth() const;
         int GetTargetHeight() const;
@@ -74,6 +142,10 @@ namespace Viry3D
         void MarkRendererOrderDirty();
         void MarkInstanceCmdDirty(Renderer* renderer);
         Vector<VkCommandBuffer> GetInstanceCmds() const;
+        // blocks until instance cmds dispatched to the record thread pool are recorded
+        void WaitInstanceCmds();
+        float GetInstanceCmdRecordMs() const { return m_record_ms; }
+        int GetInstanceCmdRecordCount() const { return m_record_cmd_count; }
         float GetFieldOfView() const { return m_field_of_view; }
         void SetFieldOfView(float fov);
         float GetNearClip() const { return m_near_clip; }
@@ -86,6 +158,13 @@ namespace Viry3D
         void SetOrthographicSize(float size);
         const Matrix4x4& GetViewMatrix();
         const Matrix4x4& GetProjectionMatrix();
+        void SetCullingEnable(bool enable);
+        bool IsCullingEnable() const { return m_culling_enable; }
+        int GetVisibleRendererCount() const { return m_visible_renderer_count; }
+        int GetCulledRendererCount() const { return m_culled_renderer_count; }
+        int GetInstanceBatchCount() const { return m_instance_batches.Size(); }
+        int GetDrawGroupCount() const { return m_draw_groups.Size(); }
+        const RenderSortStats& GetRenderSortStats() const { return m_sort_stats; }
 
     protected:
         virtual void OnMatrixDirty();
@@ -93,11 +172,21 @@ namespace Viry3D
     private:
         void UpdateRenderPass();
         void ClearRenderPass();
-        void SortRenderers();
+        bool SortRenderers();
         void UpdateInstanceCmds();
         void ClearInstanceCmds();
+        void FreeRetiredCmds(bool all);
+        RendererInstance* GetRendererInstance(const RendererHandle& handle);
+        void AllocInstanceCmd(VkCommandBuffer* cmd, int* worker);
+        void FreeInstanceCmd(VkCommandBuffer* cmd, int worker);
+        void RetireInstanceCmd(VkCommandBuffer* cmd, int worker);
         void BuildInstanceCmd(VkCommandBuffer cmd, const Ref<Renderer>& renderer);
         void UpdateRenderers();
+        void CullRenderers();
+        void BuildInstanceBatches();
+        void UpdateInstanceBatches();
+        void ClearInstanceBatches();
+        void BuildDrawGroupCmd(DrawGroup& group);
 
     private:
         bool m_render_pass_dirty;
@@ -110,9 +199,24 @@ namespace Viry3D
         Ref<Texture> m_render_target_color;
         Ref<Texture> m_render_target_depth;
         VkRenderPass m_render_pass;
+        RenderPassKey m_render_pass_key;
         Vector<VkFramebuffer> m_framebuffers;
-        List<RendererInstance> m_renderers;
-        VkCommandPool m_cmd_pool;
+        // dense in draw order, slots map stable handles to array indices
+        Vector<RendererInstance> m_renderers;
+        Vector<RendererSlot> m_renderer_slots;
+        Vector<int> m_free_renderer_slots;
+        Vector<RetiredRendererCmd> m_retired_cmds;
+        uint32_t m_renderer_add_count;
+        int m_transparent_count;
+        RenderSortStats m_sort_stats;
+        Vector<VkCommandPool> m_cmd_pools;
+        int m_next_cmd_worker;
+        Mutex m_record_mutex;
+        std::condition_variable m_record_condition;
+        int m_record_jobs;
+        float m_record_begin_time;
+        float m_record_ms;
+        int m_record_cmd_count;
         Matrix4x4 m_view_matrix;
         bool m_view_matrix_dirty;
         Matrix4x4 m_projection_matrix;
@@ -122,5 +226,16 @@ namespace Viry3D
         float m_far_clip;
         bool m_orthographic;
         float m_orthographic_size;
+        bool m_culling_enable;
+        int m_visible_renderer_count;
+        int m_culled_renderer_count;
+        bool m_instance_batches_dirty;
+        Vector<InstanceBatch> m_instance_batches;
+        Vector<DrawGroup> m_draw_groups;
+        Vector<Matrix4x4> m_instance_matrices;
+        Ref<BufferObject> m_instance_buffer;
+        int m_instance_capacity;
+        Ref<BufferObject> m_draw_buffer;
+        int m_draw_capacity;
     };
 }
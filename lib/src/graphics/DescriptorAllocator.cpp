@@ -0,0 +1,204 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "DescriptorAllocator.h"
+#include "Display.h"
+#include "memory/Memory.h"
+#include "Debug.h"
+
+#define DESCRIPTOR_PAGE_SETS_MIN 16
+#define DESCRIPTOR_PAGE_SETS_MAX 1024
+
+namespace Viry3D
+{
+    DescriptorAllocator::DescriptorAllocator(const Vector<UniformSet>& uniform_sets, const Vector<VkDescriptorSetLayout>& descriptor_layouts)
+    {
+        m_sets.Resize(uniform_sets.Size());
+
+        for (int i = 0; i < uniform_sets.Size(); ++i)
+        {
+            SetPages& pages = m_sets[i];
+            pages.layout = descriptor_layouts[i];
+
+            int buffer_count = 0;
+            int storage_count = 0;
+            for (int j = 0; j < uniform_sets[i].buffers.Size(); ++j)
+            {
+                if (uniform_sets[i].buffers[j].storage)
+                {
+                    ++storage_count;
+                }
+                else
+                {
+                    ++buffer_count;
+                }
+            }
+            int texture_count = uniform_sets[i].textures.Size();
+
+            VkDescriptorPoolSize pool_size;
+            if (buffer_count > 0)
+            {
+                pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                pool_size.descriptorCount = (uint32_t) buffer_count;
+                pages.descriptor_counts.Add(pool_size);
+            }
+            if (storage_count > 0)
+            {
+                pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+                pool_size.descriptorCount = (uint32_t) storage_count;
+                pages.descriptor_counts.Add(pool_size);
+            }
+            if (texture_count > 0)
+            {
+                pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                pool_size.descriptorCount = (uint32_t) texture_count;
+                pages.descriptor_counts.Add(pool_size);
+            }
+        }
+    }
+
+    DescriptorAllocator::~DescriptorAllocator()
+    {
+        VkDevice device = Display::Instance()->GetDevice();
+
+        // destroying a pool frees all sets allocated from it
+        for (int i = 0; i < m_sets.Size(); ++i)
+        {
+            for (int j = 0; j < m_sets[i].pools.Size(); ++j)
+            {
+                vkDestroyDescriptorPool(device, m_sets[i].pools[j], nullptr);
+            }
+        }
+        m_sets.Clear();
+    }
+
+    void DescriptorAllocator::AddPage(SetPages& pages)
+    {
+        if (pages.page_set_count == 0)
+        {
+            pages.page_set_count = DESCRIPTOR_PAGE_SETS_MIN;
+        }
+        else if (pages.page_set_count < DESCRIPTOR_PAGE_SETS_MAX)
+        {
+            pages.page_set_count *= 2;
+        }
+
+        Vector<VkDescriptorPoolSize> pool_sizes = pages.descriptor_counts;
+        for (int i = 0; i < pool_sizes.Size(); ++i)
+        {
+            pool_sizes[i].descriptorCount *= (uint32_t) pages.page_set_count;
+        }
+
+        VkDescriptorPoolCreateInfo pool_info;
+        Memory::Zero(&pool_info, sizeof(pool_info));
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.pNext = nullptr;
+        pool_info.flags = 0;
+        pool_info.maxSets = (uint32_t) pages.page_set_count;
+        pool_info.poolSizeCount = (uint32_t) pool_sizes.Size();
+        pool_info.pPoolSizes = pool_sizes.Size() > 0 ? &pool_sizes[0] : nullptr;
+
+        VkDescriptorPool pool;
+        VkResult err = vkCreateDescriptorPool(Display::Instance()->GetDevice(), &pool_info, nullptr, &pool);
+        assert(!err);
+
+        pages.pools.Add(pool);
+        pages.page_free_count = pages.page_set_count;
+    }
+
+    VkDescriptorSet DescriptorAllocator::Alloc(int set_index)
+    {
+        std::lock_guard<Mutex> lock(m_mutex);
+
+        SetPages& pages = m_sets[set_index];
+        pages.live_set_count++;
+
+        if (pages.free_sets.Size() > 0)
+        {
+            VkDescriptorSet descriptor_set = pages.free_sets[pages.free_sets.Size() - 1];
+            pages.free_sets.Remove(pages.free_sets.Size() - 1);
+            return descriptor_set;
+        }
+
+        if (pages.page_free_count == 0)
+        {
+            this->AddPage(pages);
+        }
+
+        VkDescriptorSetAllocateInfo desc_info;
+        desc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        desc_info.pNext = nullptr;
+        desc_info.descriptorPool = pages.pools[pages.pools.Size() - 1];
+        desc_info.descriptorSetCount = 1;
+        desc_info.pSetLayouts = &pages.layout;
+
+        VkDescriptorSet descriptor_set;
+        VkResult err = vkAllocateDescriptorSets(Display::Instance()->GetDevice(), &desc_info, &descriptor_set);
+        assert(!err);
+
+        pages.page_free_count--;
+
+        return descriptor_set;
+    }
+
+    void DescriptorAllocator::Free(int set_index, VkDescriptorSet descriptor_set)
+    {
+        {
+            std::lock_guard<Mutex> lock(m_mutex);
+            m_sets[set_index].live_set_count--;
+        }
+
+        // retired resources are destroyed in order, so this runs before the shader destroys the allocator
+        Display::Instance()->RetireResource([=]() {
+            std::lock_guard<Mutex> lock(m_mutex);
+            m_sets[set_index].free_sets.Add(descriptor_set);
+        });
+    }
+
+    void DescriptorAllocator::GetStats(DescriptorStats& stats)
+    {
+        std::lock_guard<Mutex> lock(m_mutex);
+
+        for (int i = 0; i < m_sets.Size(); ++i)
+        {
+            const SetPages& pages = m_sets[i];
+
+            int descriptor_count = 0;
+            for (int j = 0; j < pages.descriptor_counts.Size(); ++j)
+            {
+                descriptor_count += (int) pages.descriptor_counts[j].descriptorCount;
+            }
+
+            // page sizes double up to the max
+            int page_set_count = DESCRIPTOR_PAGE_SETS_MIN;
+            for (int j = 0; j < pages.pools.Size(); ++j)
+            {
+                stats.reserved_set_count += page_set_count;
+                stats.reserved_descriptor_count += page_set_count * descriptor_count;
+
+                if (page_set_count < DESCRIPTOR_PAGE_SETS_MAX)
+                {
+                    page_set_count *= 2;
+                }
+            }
+
+            stats.pool_count += pages.pools.Size();
+            stats.live_set_count += pages.live_set_count;
+            stats.free_set_count += pages.free_sets.Size();
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "UniformSet.h"
+#include "vulkan/vulkan_include.h"
+#include "container/Vector.h"
+#include "thread/ThreadPool.h"
+
+namespace Viry3D
+{
+    struct DescriptorStats
+    {
+        int pool_count = 0;
+        int reserved_set_count = 0;
+        // descriptors reserved by all pools, driver memory of a pool scales with it
+        int reserved_descriptor_count = 0;
+        int live_set_count = 0;
+        // freed sets waiting for reuse
+        int free_set_count = 0;
+        // sets shared by property blocks on the same buffers
+        int cached_set_count = 0;
+    };
+
+    // allocates the descriptor sets of one shader.
+    // each set index grows its own pages of pools sized to its layout, a page holds twice the sets of the previous one.
+    // freed sets are never returned to the pool, they are reused once no frame in flight binds them.
+    class DescriptorAllocator
+    {
+    public:
+        DescriptorAllocator(const Vector<UniformSet>& uniform_sets, const Vector<VkDescriptorSetLayout>& descriptor_layouts);
+        ~DescriptorAllocator();
+        VkDescriptorSet Alloc(int set_index);
+        void Free(int set_index, VkDescriptorSet descriptor_set);
+        void GetStats(DescriptorStats& stats);
+
+    private:
+        struct SetPages
+        {
+            VkDescriptorSetLayout layout;
+            Vector<VkDescriptorPoolSize> descriptor_counts;
+            Vector<VkDescriptorPool> pools;
+            int page_set_count = 0;
+            // sets left in the last page
+            int page_free_count = 0;
+            Vector<VkDescriptorSet> free_sets;
+            int live_set_count = 0;
+        };
+
+    private:
+        void AddPage(SetPages& pages);
+
+    private:
+        Vector<SetPages> m_sets;
+        Mutex m_mutex;
+    };
+}
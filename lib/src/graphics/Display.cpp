@@ -28,17 +28,21 @@
 #include "Mesh.h"
 #include "Material.h"
 #include "MeshRenderer.h"
+#include "MemoryAllocator.h"
+#include "SpirvCache.h"
+#include "TransformHierarchy.h"
 #include "container/List.h"
+#include "container/Map.h"
 #include "string/String.h"
 #include "memory/Memory.h"
 #include "math/Matrix4x4.h"
 #include "io/File.h"
 #include "thread/ThreadPool.h"
+#include "time/Time.h"
 #include "Debug.h"
 
 extern "C"
 {
-#include "crypto/md5/md5.h"
 }
 
 #ifdef max
@@ -71,7 +75,17 @@ static PFN_vkGetDeviceProcAddr g_gdpa = nullptr;
     }
 
 #define VSYNC 0
-#define DESCRIPTOR_POOL_SIZE_MAX 65536
+#define STAGING_RING_SIZE (8 * 1024 * 1024)
+#define STAGING_ALIGNMENT 16
+#define FRAMES_IN_FLIGHT 2
+#define FRAMES_IN_FLIGHT_MAX 3
+#define FRAME_STAGING_SIZE (256 * 1024)
+#define UNIFORM_PAGE_SIZE (1024 * 1024)
+#define PIPELINE_CACHE_FILE "pipeline.cache"
+#define PIPELINE_CACHE_MAGIC 0x43505256
+#define SPIRV_CACHE_FILE "spirv.cache"
+#define INSTANCE_MATRIX_LOCATION 8
+#define GPU_READ_BUFFER_USAGE (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
 
 namespace Viry3D
 {
@@ -92,75 +106,173 @@ namespace Viry3D
         vec.Clear();
     }
 
-    static void GlslToSpirvCached(const String& glsl, VkShaderStageFlagBits shader_type, Vector<unsigned int>& spirv)
+    static void GlslToSpirv(const String& glsl, VkShaderStageFlagBits shader_type, Vector<unsigned int>& spirv)
     {
-        unsigned char hash_bytes[16];
-        MD5_CTX md5_context;
-        MD5_Init(&md5_context);
-        MD5_Update(&md5_context, (void*) glsl.CString(), glsl.Size());
-        MD5_Final(hash_bytes, &md5_context);
-        String md5_str;
-        for (int i = 0; i < sizeof(hash_bytes); ++i)
+#if VR_WINDOWS || VR_ANDROID
+        String error;
+        bool success = GlslToSpv(shader_type, glsl.CString(), spirv, error);
+        if (!success)
+        {
+            Log("shader compile error: %s", error.CString());
+        }
+        assert(success);
+#elif VR_IOS || VR_MAC
+        MVKShaderStage stage;
+        switch (shader_type) {
+            case VK_SHADER_STAGE_VERTEX_BIT:
+                stage = kMVKShaderStageVertex;
+                break;
+            case VK_SHADER_STAGE_FRAGMENT_BIT:
+                stage = kMVKShaderStageFragment;
+                break;
+            default:
+                stage = kMVKShaderStageAuto;
+                break;
+        }
+        uint32_t* spirv_code = nullptr;
+        size_t size = 0;
+        char* log = nullptr;
+        bool success = mvkConvertGLSLToSPIRV(glsl.CString(),
+                                   stage,
+                                   &spirv_code,
+                                   &size,
+                                   &log,
+                                   true,
+                                   true);
+        if (!success)
+        {
+            Log("shader compile error: %s", log);
+        }
+        assert(success);
+        
+        spirv.Resize((int) size / 4);
+        Memory::Copy(&spirv[0], spirv_code, spirv.SizeInBytes());
+        
+        free(log);
+        free(spirv_code);
+#endif
+    }
+
+    // reflection of a stage is cached with its spirv, so a cache hit skips spirv cross
+    static void WriteReflectionInt(Vector<byte>& data, int value)
+    {
+        int offset = data.Size();
+        data.Resize(offset + (int) sizeof(value));
+        Memory::Copy(&data[offset], &value, sizeof(value));
+    }
+
+    static void WriteReflectionString(Vector<byte>& data, const String& str)
+    {
+        WriteReflectionInt(data, str.Size());
+        if (str.Size() > 0)
         {
-            md5_str += String::Format("%02x", hash_bytes[i]);
+            int offset = data.Size();
+            data.Resize(offset + str.Size());
+            Memory::Copy(&data[offset], str.CString(), str.Size());
         }
+    }
 
-        String cache_path = Application::Instance()->GetSavePath() + "/" + md5_str + ".cache";
-        if (File::Exist(cache_path))
+    static int ReadReflectionInt(const Vector<byte>& data, int& pos)
+    {
+        int value = 0;
+        if (pos + (int) sizeof(value) <= data.Size())
         {
-            auto buffer = File::ReadAllBytes(cache_path);
-            spirv.Resize(buffer.Size() / 4);
-            Memory::Copy(&spirv[0], buffer.Bytes(), buffer.Size());
+            Memory::Copy(&value, &data[pos], sizeof(value));
         }
-        else
+        pos += (int) sizeof(value);
+        return value;
+    }
+
+    static String ReadReflectionString(const Vector<byte>& data, int& pos)
+    {
+        int size = ReadReflectionInt(data, pos);
+        if (size <= 0 || pos + size > data.Size())
         {
-#if VR_WINDOWS || VR_ANDROID
-            String error;
-            bool success = GlslToSpv(shader_type, glsl.CString(), spirv, error);
-            if (!success)
+            return String();
+        }
+        String str((const char*) &data[pos], size);
+        pos += size;
+        return str;
+    }
+
+    static void WriteReflection(Vector<byte>& data, const Vector<UniformSet>& uniform_sets, bool instancing)
+    {
+        WriteReflectionInt(data, instancing ? 1 : 0);
+        WriteReflectionInt(data, uniform_sets.Size());
+        for (const auto& i : uniform_sets)
+        {
+            WriteReflectionInt(data, i.set);
+
+            WriteReflectionInt(data, i.buffers.Size());
+            for (const auto& j : i.buffers)
             {
-                Log("shader compile error: %s", error.CString());
+                WriteReflectionString(data, j.name);
+                WriteReflectionInt(data, j.binding);
+                WriteReflectionInt(data, j.stage);
+                WriteReflectionInt(data, j.size);
+                WriteReflectionInt(data, j.storage ? 1 : 0);
+
+                WriteReflectionInt(data, j.members.Size());
+                for (const auto& k : j.members)
+                {
+                    WriteReflectionString(data, k.name);
+                    WriteReflectionInt(data, k.offset);
+                    WriteReflectionInt(data, k.size);
+                }
             }
-            assert(success);
-#elif VR_IOS || VR_MAC
-            MVKShaderStage stage;
-            switch (shader_type) {
-                case VK_SHADER_STAGE_VERTEX_BIT:
-                    stage = kMVKShaderStageVertex;
-                    break;
-                case VK_SHADER_STAGE_FRAGMENT_BIT:
-                    stage = kMVKShaderStageFragment;
-                    break;
-                default:
-                    stage = kMVKShaderStageAuto;
-                    break;
+
+            WriteReflectionInt(data, i.textures.Size());
+            for (const auto& j : i.textures)
+            {
+                WriteReflectionString(data, j.name);
+                WriteReflectionInt(data, j.binding);
+                WriteReflectionInt(data, j.stage);
+            }
+        }
+    }
+
+    static void ReadReflection(const Vector<byte>& data, Vector<UniformSet>& uniform_sets, bool* instancing)
+    {
+        int pos = 0;
+        *instancing = ReadReflectionInt(data, pos) != 0;
+
+        uniform_sets.Resize(ReadReflectionInt(data, pos));
+        for (int i = 0; i < uniform_sets.Size(); ++i)
+        {
+            UniformSet& set = uniform_sets[i];
+            set.set = ReadReflectionInt(data, pos);
+
+            set.buffers.Resize(ReadReflectionInt(data, pos));
+            for (int j = 0; j < set.buffers.Size(); ++j)
+            {
+                UniformBuffer& buffer = set.buffers[j];
+                buffer.name = ReadReflectionString(data, pos);
+                buffer.binding = ReadReflectionInt(data, pos);
+                buffer.stage = ReadReflectionInt(data, pos);
+                buffer.size = ReadReflectionInt(data, pos);
+                buffer.storage = ReadReflectionInt(data, pos) != 0;
+                buffer.offset = 0;
+                buffer.dirty = false;
+                buffer.shared = false;
+
+                buffer.members.Resize(ReadReflectionInt(data, pos));
+                for (int k = 0; k < buffer.members.Size(); ++k)
+                {
+                    UniformMember& member = buffer.members[k];
+                    member.name = ReadReflectionString(data, pos);
+                    member.offset = ReadReflectionInt(data, pos);
+                    member.size = ReadReflectionInt(data, pos);
+                }
+            }
+
+            set.textures.Resize(ReadReflectionInt(data, pos));
+            for (int j = 0; j < set.textures.Size(); ++j)
+            {
+                UniformTexture& texture = set.textures[j];
+                texture.name = ReadReflectionString(data, pos);
+                texture.binding = ReadReflectionInt(data, pos);
+                texture.stage = ReadReflectionInt(data, pos);
             }
-            uint32_t* spirv_code = nullptr;
-            size_t size = 0;
-            char* log = nullptr;
-            bool success = mvkConvertGLSLToSPIRV(glsl.CString(),
-                                       stage,
-                                       &spirv_code,
-                                       &size,
-                                       &log,
-                                       true,
-                                       true);
-            if (!success)
-            {
-                Log("shader compile error: %s", log);
-            }
-            assert(success);
-            
-            spirv.Resize((int) size / 4);
-            Memory::Copy(&spirv[0], spirv_code, spirv.SizeInBytes());
-            
-            free(log);
-            free(spirv_code);
-#endif
-            
-            ByteBuffer buffer(spirv.SizeInBytes());
-            Memory::Copy(buffer.Bytes(), &spirv[0], buffer.Size());
-            File::WriteAllBytes(cache_path, buffer);
         }
     }
 
@@ -172,6 +284,7 @@ namespace Viry3D
             "#extension GL_ARB_shading_language_420pack : enable\n"
             "#define VR_VULKAN 1\n"
             "#define UniformBuffer(set_index, binding_index) layout(std140, set = set_index, binding = binding_index)\n"
+            "#define StorageBuffer(set_index, binding_index) layout(std430, set = set_index, binding = binding_index)\n"
             "#define UniformTexture(set_index, binding_index) layout(set = set_index, binding = binding_index)\n"
             "#define Input(location_index) layout(location = location_index) in\n"
             "#define Output(location_index) layout(location = location_index) out\n";
@@ -179,12 +292,23 @@ namespace Viry3D
         String source = s_shader_header;
         source += predefine + "\n";
 
+        // include files are read once, every variant of a shader shares them
+        static Map<String, String> s_include_cache;
+        static Mutex s_include_mutex;
+
         for (const auto& i : includes)
         {
-            auto include_path = Application::Instance()->GetDataPath() + "/shader/Include/" + i;
-            auto bytes = File::ReadAllBytes(include_path);
-            auto include_str = String(bytes);
-            source += include_str + "\n";
+            std::lock_guard<Mutex> lock(s_include_mutex);
+
+            String* include_str;
+            if (!s_include_cache.TryGet(i, &include_str))
+            {
+                auto include_path = Application::Instance()->GetDataPath() + "/shader/Include/" + i;
+                auto bytes = File::ReadAllBytes(include_path);
+                s_include_cache.Add(i, String(bytes));
+                s_include_cache.TryGet(i, &include_str);
+            }
+            source += *include_str + "\n";
         }
         source += glsl;
 
@@ -224,6 +348,13 @@ namespace Viry3D
         return false;
     }
 
+    struct PrimaryCmd
+    {
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        bool dirty = true;
+        int build_count = 0;
+    };
+
     struct SwapchainImageResources
     {
         int width;
@@ -231,7 +362,109 @@ namespace Viry3D
         VkFormat format;
         VkImage image;
         VkImageView image_view;
+        // one primary cmd per camera, submitted in camera depth order
+        Map<Camera*, PrimaryCmd> camera_cmds;
+        // fence of the last submit using this image's cmds
+        VkFence submit_fence = VK_NULL_HANDLE;
+    };
+
+    struct StagingCopy
+    {
+        Ref<BufferObject> src;
+        VkDeviceSize src_offset;
+        Ref<BufferObject> dst;
+        VkDeviceSize size;
+    };
+
+    struct StagingBatch
+    {
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        // staging ring ranges read by the batch
+        Vector<uint64_t> ring_ranges;
+        Vector<Ref<BufferObject>> temp_buffers;
+    };
+
+    // staging ring space taken by one upload, the tail moves over ranges in allocation order once their batches complete
+    struct StagingRingRange
+    {
+        uint64_t id = 0;
+        VkDeviceSize end = 0;
+        VkDeviceSize size = 0;
+        bool done = false;
+    };
+
+    struct FrameBufferCopy
+    {
+        Ref<BufferObject> src;
+        Ref<BufferObject> dst;
+        VkDeviceSize src_offset;
+        VkDeviceSize dst_offset;
+        VkDeviceSize size;
+        bool barrier;
+    };
+
+    struct FrameCopyRanges
+    {
+        // dst offset to copy index
+        Map<VkDeviceSize, int> offsets;
+        VkDeviceSize max_size = 0;
+    };
+
+    struct FrameResources
+    {
+        VkFence draw_complete_fence = VK_NULL_HANDLE;
+        VkSemaphore image_acquired_semaphore = VK_NULL_HANDLE;
+        VkSemaphore draw_complete_semaphore = VK_NULL_HANDLE;
+        VkCommandBuffer copy_cmd = VK_NULL_HANDLE;
+        // frame count of the last submit in this slot
+        int submit_frame = -1;
+        Vector<Ref<BufferObject>> staging_buffers;
+        VkDeviceSize staging_offset = 0;
+        Vector<FrameBufferCopy> copies;
+        Map<BufferObject*, FrameCopyRanges> copy_ranges;
+    };
+
+    struct RetiredResource
+    {
+        int frame = 0;
+        std::function<void()> destroy;
+    };
+
+    struct ImageBatch
+    {
         VkCommandBuffer cmd = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        UploadToken token = 0;
+        Vector<uint64_t> ring_ranges;
+        Vector<Ref<BufferObject>> temp_buffers;
+        // frame whose draw waited on the semaphore, -1 before that
+        int wait_frame = -1;
+    };
+
+    // saved before the driver data, a cache from another device or driver is dropped
+    struct PipelineCacheHeader
+    {
+        uint32_t magic;
+        uint32_t data_size;
+        uint32_t vendor_id;
+        uint32_t device_id;
+        uint32_t driver_version;
+        uint8_t uuid[VK_UUID_SIZE];
+    };
+
+    struct UniformRange
+    {
+        int offset;
+        int size;
+    };
+
+    struct UniformPage
+    {
+        Ref<BufferObject> buffer;
+        List<UniformRange> free_ranges;
     };
 
     class DisplayPrivate
@@ -252,10 +485,14 @@ namespace Viry3D
         VkSurfaceKHR m_surface = VK_NULL_HANDLE;
         VkDevice m_device = VK_NULL_HANDLE;
         VkQueue m_graphics_queue = VK_NULL_HANDLE;
-        VkQueue m_image_queue = VK_NULL_HANDLE;
+        // image batches can be submitted by WaitUpload from any thread
+        Mutex m_graphics_queue_mutex;
+        VkQueue m_transfer_queue = VK_NULL_HANDLE;
         VkPhysicalDeviceProperties m_gpu_properties;
         Vector<VkQueueFamilyProperties> m_queue_properties;
         VkPhysicalDeviceFeatures m_gpu_features;
+        bool m_multi_draw_indirect = false;
+        bool m_multi_draw_indirect_supported = false;
         VkPhysicalDeviceMemoryProperties m_memory_properties;
         PFN_vkCreateDebugReportCallbackEXT fpCreateDebugReportCallbackEXT = nullptr;
         PFN_vkDestroyDebugReportCallbackEXT fpDestroyDebugReportCallbackEXT = nullptr;
@@ -269,21 +506,58 @@ namespace Viry3D
         PFN_vkAcquireNextImageKHR fpAcquireNextImageKHR = nullptr;
         PFN_vkQueuePresentKHR fpQueuePresentKHR = nullptr;
         int m_graphics_queue_family_index = -1;
+        int m_transfer_queue_family_index = -1;
         VkSurfaceFormatKHR m_surface_format;
         VkSwapchainKHR m_swapchain = VK_NULL_HANDLE;
         Vector<SwapchainImageResources> m_swapchain_image_resources;
-        VkFence m_image_fence = VK_NULL_HANDLE;
-        VkFence m_draw_complete_fence = VK_NULL_HANDLE;
-        VkSemaphore m_image_acquired_semaphore = VK_NULL_HANDLE;
-        VkSemaphore m_draw_complete_semaphore = VK_NULL_HANDLE;
+        Vector<FrameResources> m_frames;
+        int m_frame_index = 0;
+        int m_frames_in_flight = FRAMES_IN_FLIGHT;
+        VkCommandPool m_frame_cmd_pool = VK_NULL_HANDLE;
+        Mutex m_frame_copy_mutex;
+        FramePacingStats m_frame_stats;
+        Vector<UniformPage> m_uniform_pages;
+        Mutex m_uniform_mutex;
+        VkPipelineCache m_pipeline_cache = VK_NULL_HANDLE;
+        String m_pipeline_cache_path;
+        Mutex m_pipeline_cache_mutex;
+        SpirvCache* m_spirv_cache = nullptr;
+        Mutex m_spirv_cache_mutex;
+        Map<RenderPassKey, VkRenderPass> m_compatible_render_passes;
+        Mutex m_compatible_render_pass_mutex;
         int m_image_index = 0;
         VkCommandPool m_graphics_cmd_pool = VK_NULL_HANDLE;
         VkCommandPool m_image_cmd_pool = VK_NULL_HANDLE;
         VkCommandBuffer m_image_cmd = VK_NULL_HANDLE;
+        ImageBatch m_image_batch;
+        List<ImageBatch> m_image_batches;
+        List<ImageBatch> m_image_free_batches;
+        UploadToken m_image_token = 0;
+        UploadToken m_image_done_token = 0;
         Mutex m_image_cmd_mutex;
+        MemoryAllocator* m_memory_allocator = nullptr;
+        VkCommandPool m_staging_cmd_pool = VK_NULL_HANDLE;
+        Ref<BufferObject> m_staging_ring;
+        VkDeviceSize m_staging_ring_head = 0;
+        VkDeviceSize m_staging_ring_tail = 0;
+        VkDeviceSize m_staging_ring_used = 0;
+        // ranges of buffer uploads not submitted yet
+        Vector<uint64_t> m_staging_ring_pending;
+        List<StagingRingRange> m_staging_ring_ranges;
+        uint64_t m_staging_ring_range_id = 0;
+        Vector<StagingCopy> m_staging_copies;
+        Vector<Ref<BufferObject>> m_staging_temp_buffers;
+        List<StagingBatch> m_staging_batches;
+        List<StagingBatch> m_staging_free_batches;
+        Mutex m_staging_mutex;
         Ref<Texture> m_depth_texture;
         List<Ref<Camera>> m_cameras;
-        bool m_primary_cmd_dirty = true;
+        bool m_camera_order_dirty = true;
+        // highest frame count whose submit is known to be complete
+        int m_completed_frame = -1;
+        // in retire order, so frames never decrease
+        List<RetiredResource> m_retired_resources;
+        Mutex m_retire_mutex;
         Ref<Shader> m_blit_shader;
         Ref<Mesh> m_blit_mesh;
         bool m_pause_draw = false;
@@ -306,13 +580,17 @@ namespace Viry3D
             m_cameras.Clear();
 
             this->DestroySizeDependentResources();
-
-            vkFreeCommandBuffers(m_device, m_image_cmd_pool, 1, &m_image_cmd);
-            vkDestroyCommandPool(m_device, m_image_cmd_pool, nullptr);
-            vkDestroyFence(m_device, m_image_fence, nullptr);
-            vkDestroyFence(m_device, m_draw_complete_fence, nullptr);
-            vkDestroySemaphore(m_device, m_image_acquired_semaphore, nullptr);
-            vkDestroySemaphore(m_device, m_draw_complete_semaphore, nullptr);
+            this->FreeRetiredResources(true);
+            this->DestroyUniformPages();
+            this->DestroyStagingResources();
+
+            this->DestroyImageCmd();
+            this->DestroyFrameResources();
+            this->DestroyCompatibleRenderPasses();
+            this->DestroyPipelineCache();
+            this->DestroySpirvCache();
+            delete m_memory_allocator;
+            m_memory_allocator = nullptr;
             vkDestroyDevice(m_device, nullptr);
             if (m_surface != VK_NULL_HANDLE)
             {
@@ -687,28 +965,63 @@ namespace Viry3D
         {
             VkResult err;
 
-            float queue_priorities[2] = { 0.0, 0.0 };
-            VkDeviceQueueCreateInfo queue_info;
-            Memory::Zero(&queue_info, sizeof(queue_info));
-            queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queue_info.pNext = nullptr;
-            queue_info.flags = 0;
-            queue_info.queueFamilyIndex = m_graphics_queue_family_index;
-            queue_info.queueCount = 2;
-            queue_info.pQueuePriorities = queue_priorities;
+            // use a transfer only queue family for staging uploads if there is one
+            m_transfer_queue_family_index = m_graphics_queue_family_index;
+            for (int i = 0; i < m_queue_properties.Size(); ++i)
+            {
+                VkQueueFlags flags = m_queue_properties[i].queueFlags;
+                if ((flags & VK_QUEUE_TRANSFER_BIT) != 0 && (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0)
+                {
+                    m_transfer_queue_family_index = i;
+                    break;
+                }
+            }
+
+            float queue_priorities[1] = { 0.0 };
+            VkDeviceQueueCreateInfo queue_infos[2];
+            Memory::Zero(queue_infos, sizeof(queue_infos));
+            queue_infos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queue_infos[0].pNext = nullptr;
+            queue_infos[0].flags = 0;
+            queue_infos[0].queueFamilyIndex = m_graphics_queue_family_index;
+            queue_infos[0].queueCount = 1;
+            queue_infos[0].pQueuePriorities = queue_priorities;
+            queue_infos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queue_infos[1].pNext = nullptr;
+            queue_infos[1].flags = 0;
+            queue_infos[1].queueFamilyIndex = m_transfer_queue_family_index;
+            queue_infos[1].queueCount = 1;
+            queue_infos[1].pQueuePriorities = queue_priorities;
+
+            uint32_t queue_info_count = 1;
+            if (m_transfer_queue_family_index != m_graphics_queue_family_index)
+            {
+                queue_info_count = 2;
+            }
+
+            // multi draw batches need both, otherwise each draw is issued alone
+            VkPhysicalDeviceFeatures enabled_features;
+            Memory::Zero(&enabled_features, sizeof(enabled_features));
+            if (m_gpu_features.multiDrawIndirect && m_gpu_features.drawIndirectFirstInstance)
+            {
+                enabled_features.multiDrawIndirect = VK_TRUE;
+                enabled_features.drawIndirectFirstInstance = VK_TRUE;
+                m_multi_draw_indirect = true;
+                m_multi_draw_indirect_supported = true;
+            }
 
             VkDeviceCreateInfo device_info;
             Memory::Zero(&device_info, sizeof(device_info));
             device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
             device_info.pNext = nullptr;
             device_info.flags = 0;
-            device_info.queueCreateInfoCount = 1;
-            device_info.pQueueCreateInfos = &queue_info;
+            device_info.queueCreateInfoCount = queue_info_count;
+            device_info.pQueueCreateInfos = queue_infos;
             device_info.enabledLayerCount = m_enabled_layers.Size();
             device_info.ppEnabledLayerNames = &m_enabled_layers[0];
             device_info.enabledExtensionCount = m_device_extension_names.Size();
             device_info.ppEnabledExtensionNames = &m_device_extension_names[0];
-            device_info.pEnabledFeatures = nullptr;
+            device_info.pEnabledFeatures = &enabled_features;
 
             err = vkCreateDevice(m_gpu, &device_info, nullptr, &m_device);
             assert(!err);
@@ -718,15 +1031,26 @@ namespace Viry3D
             GET_DEVICE_PROC_ADDR(m_device, GetSwapchainImagesKHR);
             GET_DEVICE_PROC_ADDR(m_device, AcquireNextImageKHR);
             GET_DEVICE_PROC_ADDR(m_device, QueuePresentKHR);
+
+            m_memory_allocator = new MemoryAllocator(m_device, m_memory_properties);
         }
 
         void GetQueues()
         {
             vkGetDeviceQueue(m_device, m_graphics_queue_family_index, 0, &m_graphics_queue);
-            vkGetDeviceQueue(m_device, m_graphics_queue_family_index, 1, &m_image_queue);
+
+            if (m_transfer_queue_family_index != m_graphics_queue_family_index)
+            {
+                vkGetDeviceQueue(m_device, m_transfer_queue_family_index, 0, &m_transfer_queue);
+            }
+            else
+            {
+                // staging uploads are submitted from OnDraw only, so sharing the graphics queue is safe
+                m_transfer_queue = m_graphics_queue;
+            }
         }
 
-        void CreateSignals()
+        void CreateFrameResources()
         {
             VkFenceCreateInfo fence_info;
             Memory::Zero(&fence_info, sizeof(fence_info));
@@ -740,30 +1064,832 @@ namespace Viry3D
             semaphore_info.pNext = nullptr;
             semaphore_info.flags = 0;
 
-            VkResult err = vkCreateFence(m_device, &fence_info, nullptr, &m_image_fence);
+            this->CreateCommandPool(&m_frame_cmd_pool);
+
+            // always create the max count, SetFramesInFlight only changes how many are cycled
+            m_frames.Resize(FRAMES_IN_FLIGHT_MAX);
+            for (int i = 0; i < m_frames.Size(); ++i)
+            {
+                FrameResources& frame = m_frames[i];
+
+                VkResult err = vkCreateFence(m_device, &fence_info, nullptr, &frame.draw_complete_fence);
+                assert(!err);
+                err = vkCreateSemaphore(m_device, &semaphore_info, nullptr, &frame.image_acquired_semaphore);
+                assert(!err);
+                err = vkCreateSemaphore(m_device, &semaphore_info, nullptr, &frame.draw_complete_semaphore);
+                assert(!err);
+
+                this->CreateCommandBuffer(m_frame_cmd_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &frame.copy_cmd);
+                frame.staging_buffers.Add(this->CreateBuffer(nullptr, FRAME_STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT));
+            }
+
+            m_frame_index = 0;
+            m_frame_stats.frames_in_flight = m_frames_in_flight;
+        }
+
+        void DestroyFrameResources()
+        {
+            for (int i = 0; i < m_frames.Size(); ++i)
+            {
+                FrameResources& frame = m_frames[i];
+
+                for (int j = 0; j < frame.staging_buffers.Size(); ++j)
+                {
+                    frame.staging_buffers[j]->Destroy(m_device);
+                }
+                vkFreeCommandBuffers(m_device, m_frame_cmd_pool, 1, &frame.copy_cmd);
+                vkDestroyFence(m_device, frame.draw_complete_fence, nullptr);
+                vkDestroySemaphore(m_device, frame.image_acquired_semaphore, nullptr);
+                vkDestroySemaphore(m_device, frame.draw_complete_semaphore, nullptr);
+            }
+            m_frames.Clear();
+
+            if (m_frame_cmd_pool != VK_NULL_HANDLE)
+            {
+                vkDestroyCommandPool(m_device, m_frame_cmd_pool, nullptr);
+                m_frame_cmd_pool = VK_NULL_HANDLE;
+            }
+        }
+
+        void SetFramesInFlight(int count)
+        {
+            if (count < 1)
+            {
+                count = 1;
+            }
+            if (count > FRAMES_IN_FLIGHT_MAX)
+            {
+                count = FRAMES_IN_FLIGHT_MAX;
+            }
+            if (count == m_frames_in_flight)
+            {
+                return;
+            }
+
+            vkDeviceWaitIdle(m_device);
+
+            // keep the copies already staged for the current frame
+            if (m_frame_index >= count)
+            {
+                std::swap(m_frames[0], m_frames[m_frame_index]);
+                m_frame_index = 0;
+            }
+
+            m_frames_in_flight = count;
+            m_frame_stats.frames_in_flight = count;
+        }
+
+        void WaitFramesInFlight()
+        {
+            Vector<VkFence> fences(m_frames_in_flight);
+            for (int i = 0; i < m_frames_in_flight; ++i)
+            {
+                fences[i] = m_frames[i].draw_complete_fence;
+            }
+
+            VkResult err = vkWaitForFences(m_device, fences.Size(), &fences[0], VK_TRUE, UINT64_MAX);
             assert(!err);
-            err = vkCreateFence(m_device, &fence_info, nullptr, &m_draw_complete_fence);
+
+            m_completed_frame = m_frame_stats.frame_count - 1;
+        }
+
+        void RetireResource(const std::function<void()>& destroy)
+        {
+            RetiredResource resource;
+            // the frame being built may still record a use of the resource
+            resource.frame = m_frame_stats.frame_count;
+            resource.destroy = destroy;
+
+            m_retire_mutex.lock();
+            m_retired_resources.AddLast(resource);
+            m_retire_mutex.unlock();
+        }
+
+        void FreeRetiredResources(bool all)
+        {
+            List<RetiredResource> resources;
+
+            m_retire_mutex.lock();
+            while (m_retired_resources.Size() > 0)
+            {
+                const RetiredResource& resource = m_retired_resources.First();
+                if (!all && resource.frame > m_completed_frame)
+                {
+                    break;
+                }
+                resources.AddLast(resource);
+                m_retired_resources.RemoveFirst();
+            }
+            m_retire_mutex.unlock();
+
+            // destroy outside the lock, a destroyed object may retire its own resources
+            for (auto& i : resources)
+            {
+                i.destroy();
+            }
+
+            if (all && m_retired_resources.Size() > 0)
+            {
+                this->FreeRetiredResources(true);
+            }
+        }
+
+        // wait until the gpu is done with the current frame slot, then its staging memory can be reused
+        void BeginFrame()
+        {
+            FrameResources& frame = m_frames[m_frame_index];
+
+            int pending_count = 0;
+            for (int i = 0; i < m_frames_in_flight; ++i)
+            {
+                if (vkGetFenceStatus(m_device, m_frames[i].draw_complete_fence) == VK_NOT_READY)
+                {
+                    pending_count += 1;
+                }
+            }
+            m_frame_stats.gpu_pending_frames = pending_count;
+
+            float wait_begin = Time::GetRealTimeSinceStartup();
+            VkResult err = vkWaitForFences(m_device, 1, &frame.draw_complete_fence, VK_TRUE, UINT64_MAX);
             assert(!err);
-            err = vkCreateSemaphore(m_device, &semaphore_info, nullptr, &m_image_acquired_semaphore);
+            float wait_time = (Time::GetRealTimeSinceStartup() - wait_begin) * 1000;
+
+            // gpu still had other frames queued after this wait, cpu and gpu are overlapping
+            if (pending_count > 1 || (pending_count == 1 && wait_time <= 0))
+            {
+                m_frame_stats.overlapped_frame_count += 1;
+            }
+            if (wait_time > 0)
+            {
+                m_frame_stats.cpu_stall_frame_count += 1;
+            }
+            m_frame_stats.fence_wait_ms = wait_time;
+            m_frame_stats.fence_wait_ms_total += wait_time;
+
+            // submits complete in order, so every frame up to this slot's last one is done
+            if (frame.submit_frame > m_completed_frame)
+            {
+                m_completed_frame = frame.submit_frame;
+            }
+            this->FreeRetiredResources(false);
+            Shader::SweepInstanceDescriptorSets();
+
+            m_frame_copy_mutex.lock();
+
+            if (frame.staging_buffers.Size() > 1)
+            {
+                // merge overflow buffers into one big enough for next time
+                VkDeviceSize size = 0;
+                for (int i = 0; i < frame.staging_buffers.Size(); ++i)
+                {
+                    size += frame.staging_buffers[i]->GetSize();
+                    frame.staging_buffers[i]->Destroy(m_device);
+                }
+                frame.staging_buffers.Clear();
+                frame.staging_buffers.Add(this->CreateBuffer(nullptr, (int) size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT));
+            }
+            frame.staging_offset = 0;
+            frame.copies.Clear();
+            frame.copy_ranges.Clear();
+
+            m_frame_copy_mutex.unlock();
+        }
+
+        // gpu read buffers are written through the frame staging memory and copied on the gpu timeline,
+        // so cpu writes never touch memory that a frame in flight is reading
+        void StageBufferUpdate(const Ref<BufferObject>& buffer, int buffer_offset, const void* data, int size)
+        {
+            Memory::Copy(this->MapStagingUpdate(buffer, buffer_offset, size), data, size);
+        }
+
+        // staging memory of the frame copied to the buffer range before the frame draws
+        void* MapStagingUpdate(const Ref<BufferObject>& buffer, int buffer_offset, int size)
+        {
+            m_frame_copy_mutex.lock();
+
+            FrameResources& frame = m_frames[m_frame_index];
+            bool barrier = false;
+            VkDeviceSize begin = (VkDeviceSize) buffer_offset;
+            VkDeviceSize end = begin + (VkDeviceSize) size;
+
+            FrameCopyRanges* ranges;
+            if (frame.copy_ranges.TryGet(buffer.get(), &ranges))
+            {
+                int* index;
+                if (ranges->offsets.TryGet(begin, &index))
+                {
+                    FrameBufferCopy& copy = frame.copies[*index];
+
+                    // same range written again this frame, overwrite the staged data,
+                    // unless a later copy overlaps it and would be applied on top of the new data
+                    if (copy.size == (VkDeviceSize) size)
+                    {
+                        bool overlapped = false;
+                        for (int i = *index + 1; i < frame.copies.Size(); ++i)
+                        {
+                            const FrameBufferCopy& later = frame.copies[i];
+                            if (later.dst == buffer && later.dst_offset < end && later.dst_offset + later.size > begin)
+                            {
+                                overlapped = true;
+                                break;
+                            }
+                        }
+
+                        if (!overlapped)
+                        {
+                            m_frame_copy_mutex.unlock();
+                            return ((byte*) copy.src->GetMappedData()) + copy.src_offset;
+                        }
+                    }
+                }
+
+                // copies starting inside the range, or starting before it and reaching into it
+                auto iter = ranges->offsets.LowerBound(begin);
+                if (iter != ranges->offsets.end() && iter->first < end)
+                {
+                    barrier = true;
+                }
+                while (!barrier && iter != ranges->offsets.begin())
+                {
+                    --iter;
+                    if (iter->first + ranges->max_size <= begin)
+                    {
+                        break;
+                    }
+                    const FrameBufferCopy& copy = frame.copies[iter->second];
+                    if (copy.dst_offset + copy.size > begin)
+                    {
+                        barrier = true;
+                    }
+                }
+            }
+            else
+            {
+                frame.copy_ranges.Add(buffer.get(), FrameCopyRanges());
+                frame.copy_ranges.TryGet(buffer.get(), &ranges);
+            }
+
+            VkDeviceSize aligned_size = (size + STAGING_ALIGNMENT - 1) & ~((VkDeviceSize) STAGING_ALIGNMENT - 1);
+            Ref<BufferObject> staging = frame.staging_buffers[frame.staging_buffers.Size() - 1];
+            if (frame.staging_offset + aligned_size > (VkDeviceSize) staging->GetSize())
+            {
+                int staging_size = FRAME_STAGING_SIZE;
+                if (staging_size < size)
+                {
+                    staging_size = size;
+                }
+                staging = this->CreateBuffer(nullptr, staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+                frame.staging_buffers.Add(staging);
+                frame.staging_offset = 0;
+            }
+
+            FrameBufferCopy copy;
+            copy.src = staging;
+            copy.dst = buffer;
+            copy.src_offset = frame.staging_offset;
+            copy.dst_offset = buffer_offset;
+            copy.size = size;
+            copy.barrier = barrier;
+
+            void* mapped = ((byte*) staging->GetMappedData()) + copy.src_offset;
+            frame.staging_offset += aligned_size;
+
+            // keep the widest copy at each offset, overlap checks rely on it
+            int* index;
+            if (ranges->offsets.TryGet(begin, &index))
+            {
+                if (copy.size >= frame.copies[*index].size)
+                {
+                    *index = frame.copies.Size();
+                }
+            }
+            else
+            {
+                ranges->offsets.Add(begin, frame.copies.Size());
+            }
+            if (copy.size > ranges->max_size)
+            {
+                ranges->max_size = copy.size;
+            }
+            frame.copies.Add(copy);
+
+            m_frame_copy_mutex.unlock();
+
+            return mapped;
+        }
+
+        bool BuildFrameCopyCmd(FrameResources& frame)
+        {
+            if (frame.copies.Empty())
+            {
+                return false;
+            }
+
+            VkCommandBuffer cmd = frame.copy_cmd;
+
+            VkCommandBufferBeginInfo cmd_info;
+            Memory::Zero(&cmd_info, sizeof(cmd_info));
+            cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            cmd_info.pNext = nullptr;
+            cmd_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            cmd_info.pInheritanceInfo = nullptr;
+
+            VkResult err = vkBeginCommandBuffer(cmd, &cmd_info);
+            assert(!err);
+
+            const VkPipelineStageFlags read_stages =
+                VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+            // earlier frames may still read the destination buffers
+            vkCmdPipelineBarrier(cmd, read_stages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+            VkMemoryBarrier barrier;
+            Memory::Zero(&barrier, sizeof(barrier));
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.pNext = nullptr;
+
+            Vector<VkBufferCopy> regions;
+            for (int i = 0; i < frame.copies.Size(); ++i)
+            {
+                const FrameBufferCopy& copy = frame.copies[i];
+
+                // destination destroyed after update
+                if (copy.dst->GetBuffer() == VK_NULL_HANDLE)
+                {
+                    continue;
+                }
+
+                if (copy.barrier)
+                {
+                    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+                }
+
+                VkBufferCopy region;
+                region.srcOffset = copy.src_offset;
+                region.dstOffset = copy.dst_offset;
+                region.size = copy.size;
+                regions.Add(region);
+
+                // merge regions between the same buffers into one copy command
+                bool merge = false;
+                if (i + 1 < frame.copies.Size())
+                {
+                    const FrameBufferCopy& next = frame.copies[i + 1];
+                    merge = !next.barrier && next.src == copy.src && next.dst == copy.dst;
+                }
+
+                if (!merge)
+                {
+                    vkCmdCopyBuffer(cmd, copy.src->GetBuffer(), copy.dst->GetBuffer(), regions.Size(), &regions[0]);
+                    regions.Clear();
+                }
+            }
+
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask =
+                VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                VK_ACCESS_INDEX_READ_BIT |
+                VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                VK_ACCESS_UNIFORM_READ_BIT |
+                VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, read_stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            err = vkEndCommandBuffer(cmd);
             assert(!err);
-            err = vkCreateSemaphore(m_device, &semaphore_info, nullptr, &m_draw_complete_semaphore);
+
+            return true;
+        }
+
+        void CreateImageCmd()
+        {
+            this->CreateCommandPool(&m_image_cmd_pool);
+        }
+
+        void DestroyImageCmd()
+        {
+            if (m_image_cmd != VK_NULL_HANDLE)
+            {
+                m_image_batches.AddLast(m_image_batch);
+                m_image_batch = ImageBatch();
+                m_image_cmd = VK_NULL_HANDLE;
+            }
+            m_image_batches.AddRangeBefore(m_image_batches.end(), m_image_free_batches.begin(), m_image_free_batches.end());
+            m_image_free_batches.Clear();
+
+            for (auto& i : m_image_batches)
+            {
+                for (int j = 0; j < i.temp_buffers.Size(); ++j)
+                {
+                    i.temp_buffers[j]->Destroy(m_device);
+                }
+                vkFreeCommandBuffers(m_device, m_image_cmd_pool, 1, &i.cmd);
+                vkDestroyFence(m_device, i.fence, nullptr);
+                vkDestroySemaphore(m_device, i.semaphore, nullptr);
+            }
+            m_image_batches.Clear();
+
+            vkDestroyCommandPool(m_device, m_image_cmd_pool, nullptr);
+            m_image_cmd_pool = VK_NULL_HANDLE;
+        }
+
+        // call with m_image_cmd_mutex locked
+        void RecycleImageBatches()
+        {
+            // batches complete in submit order
+            for (auto& i : m_image_batches)
+            {
+                if (vkGetFenceStatus(m_device, i.fence) != VK_SUCCESS)
+                {
+                    break;
+                }
+
+                if (i.token > m_image_done_token)
+                {
+                    m_image_done_token = i.token;
+                }
+
+                if (i.ring_ranges.Size() > 0)
+                {
+                    m_staging_mutex.lock();
+                    this->ReleaseStagingRing(i.ring_ranges);
+                    m_staging_mutex.unlock();
+                    i.ring_ranges.Clear();
+                }
+
+                for (int j = 0; j < i.temp_buffers.Size(); ++j)
+                {
+                    i.temp_buffers[j]->Destroy(m_device);
+                }
+                i.temp_buffers.Clear();
+            }
+
+            // semaphore can be signaled again once the draw that waited on it is complete
+            while (!m_image_batches.Empty())
+            {
+                const ImageBatch& batch = m_image_batches.First();
+                if (batch.token > m_image_done_token ||
+                    batch.wait_frame < 0 ||
+                    batch.wait_frame + m_frames_in_flight >= m_frame_stats.frame_count)
+                {
+                    break;
+                }
+
+                m_image_free_batches.AddLast(batch);
+                m_image_batches.RemoveFirst();
+            }
+        }
+
+        // call with m_image_cmd_mutex locked
+        void SubmitImageBatch()
+        {
+            if (m_image_cmd == VK_NULL_HANDLE)
+            {
+                return;
+            }
+
+            VkResult err = vkEndCommandBuffer(m_image_cmd);
+            assert(!err);
+
+            VkSubmitInfo submit_info;
+            Memory::Zero(&submit_info, sizeof(submit_info));
+            submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submit_info.pNext = nullptr;
+            submit_info.waitSemaphoreCount = 0;
+            submit_info.pWaitSemaphores = nullptr;
+            submit_info.pWaitDstStageMask = nullptr;
+            submit_info.commandBufferCount = 1;
+            submit_info.pCommandBuffers = &m_image_batch.cmd;
+            submit_info.signalSemaphoreCount = 1;
+            submit_info.pSignalSemaphores = &m_image_batch.semaphore;
+
+            // same queue as the frames, so the batch runs after frames already submitted that sample its images
+            m_graphics_queue_mutex.lock();
+            err = vkQueueSubmit(m_graphics_queue, 1, &submit_info, m_image_batch.fence);
+            m_graphics_queue_mutex.unlock();
+            assert(!err);
+
+            m_image_batches.AddLast(m_image_batch);
+            m_image_batch = ImageBatch();
+            m_image_cmd = VK_NULL_HANDLE;
+        }
+
+        // submit image cmds recorded since the last frame, draw waits on the returned semaphores
+        void FlushImageCmds(Vector<VkSemaphore>& wait_semaphores)
+        {
+            m_image_cmd_mutex.lock();
+
+            this->SubmitImageBatch();
+
+            for (auto& i : m_image_batches)
+            {
+                if (i.wait_frame < 0)
+                {
+                    i.wait_frame = m_frame_stats.frame_count;
+                    wait_semaphores.Add(i.semaphore);
+                }
+            }
+
+            m_image_cmd_mutex.unlock();
+        }
+
+        bool IsUploadDone(UploadToken token)
+        {
+            m_image_cmd_mutex.lock();
+
+            this->RecycleImageBatches();
+            bool done = token <= m_image_done_token;
+
+            m_image_cmd_mutex.unlock();
+
+            return done;
+        }
+
+        void WaitUpload(UploadToken token)
+        {
+            m_image_cmd_mutex.lock();
+
+            if (m_image_cmd != VK_NULL_HANDLE && token >= m_image_batch.token)
+            {
+                this->SubmitImageBatch();
+            }
+
+            for (const auto& i : m_image_batches)
+            {
+                if (i.token >= token)
+                {
+                    VkResult err = vkWaitForFences(m_device, 1, &i.fence, VK_TRUE, UINT64_MAX);
+                    assert(!err);
+                    break;
+                }
+            }
+
+            this->RecycleImageBatches();
+
+            m_image_cmd_mutex.unlock();
+        }
+
+        void CreateStagingResources()
+        {
+            this->CreateCommandPool(&m_staging_cmd_pool, m_transfer_queue_family_index);
+            m_staging_ring = this->CreateBuffer(nullptr, STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        }
+
+        void DestroyStagingResources()
+        {
+            m_staging_batches.AddRangeBefore(m_staging_batches.end(), m_staging_free_batches.begin(), m_staging_free_batches.end());
+            m_staging_free_batches.Clear();
+
+            for (auto& i : m_staging_batches)
+            {
+                for (int j = 0; j < i.temp_buffers.Size(); ++j)
+                {
+                    i.temp_buffers[j]->Destroy(m_device);
+                }
+                vkFreeCommandBuffers(m_device, m_staging_cmd_pool, 1, &i.cmd);
+                vkDestroyFence(m_device, i.fence, nullptr);
+                vkDestroySemaphore(m_device, i.semaphore, nullptr);
+            }
+            m_staging_batches.Clear();
+
+            for (int i = 0; i < m_staging_temp_buffers.Size(); ++i)
+            {
+                m_staging_temp_buffers[i]->Destroy(m_device);
+            }
+            m_staging_temp_buffers.Clear();
+            m_staging_copies.Clear();
+
+            if (m_staging_ring)
+            {
+                m_staging_ring->Destroy(m_device);
+                m_staging_ring.reset();
+            }
+            if (m_staging_cmd_pool != VK_NULL_HANDLE)
+            {
+                vkDestroyCommandPool(m_device, m_staging_cmd_pool, nullptr);
+                m_staging_cmd_pool = VK_NULL_HANDLE;
+            }
+        }
+
+        // call with m_staging_mutex locked
+        bool AllocStagingRing(VkDeviceSize size, VkDeviceSize* offset, uint64_t* range_id)
+        {
+            size = (size + STAGING_ALIGNMENT - 1) & ~((VkDeviceSize) STAGING_ALIGNMENT - 1);
+
+            if (m_staging_ring_used == 0)
+            {
+                m_staging_ring_head = 0;
+                m_staging_ring_tail = 0;
+            }
+            else if (m_staging_ring_head == m_staging_ring_tail)
+            {
+                // head caught up with the tail of batches in flight, the ring is full
+                return false;
+            }
+
+            VkDeviceSize range_size = 0;
+            if (m_staging_ring_head >= m_staging_ring_tail)
+            {
+                if (STAGING_RING_SIZE - m_staging_ring_head >= size)
+                {
+                    *offset = m_staging_ring_head;
+                    range_size = size;
+                }
+                else if (m_staging_ring_tail >= size && m_staging_ring_used > 0)
+                {
+                    // wrap around, the end of the ring is wasted until this range is released
+                    *offset = 0;
+                    range_size = STAGING_RING_SIZE - m_staging_ring_head + size;
+                }
+            }
+            else if (m_staging_ring_tail - m_staging_ring_head >= size)
+            {
+                *offset = m_staging_ring_head;
+                range_size = size;
+            }
+
+            if (range_size == 0)
+            {
+                return false;
+            }
+
+            m_staging_ring_head = *offset + size;
+            m_staging_ring_used += range_size;
+
+            StagingRingRange range;
+            range.id = ++m_staging_ring_range_id;
+            range.end = m_staging_ring_head;
+            range.size = range_size;
+            m_staging_ring_ranges.AddLast(range);
+
+            *range_id = range.id;
+
+            return true;
+        }
+
+        // call with m_staging_mutex locked
+        void ReleaseStagingRing(const Vector<uint64_t>& range_ids)
+        {
+            for (int i = 0; i < range_ids.Size(); ++i)
+            {
+                for (auto& j : m_staging_ring_ranges)
+                {
+                    if (j.id == range_ids[i])
+                    {
+                        j.done = true;
+                        break;
+                    }
+                }
+            }
+
+            // buffer and image batches complete in any order, the tail stops at the oldest range in use
+            while (!m_staging_ring_ranges.Empty() && m_staging_ring_ranges.First().done)
+            {
+                const StagingRingRange& range = m_staging_ring_ranges.First();
+                m_staging_ring_tail = range.end;
+                m_staging_ring_used -= range.size;
+                m_staging_ring_ranges.RemoveFirst();
+            }
+        }
+
+        void RecycleStagingBatches()
+        {
+            while (!m_staging_batches.Empty())
+            {
+                StagingBatch& batch = m_staging_batches.First();
+                if (vkGetFenceStatus(m_device, batch.fence) != VK_SUCCESS)
+                {
+                    break;
+                }
+
+                this->ReleaseStagingRing(batch.ring_ranges);
+                batch.ring_ranges.Clear();
+
+                for (int i = 0; i < batch.temp_buffers.Size(); ++i)
+                {
+                    batch.temp_buffers[i]->Destroy(m_device);
+                }
+                batch.temp_buffers.Clear();
+
+                m_staging_free_batches.AddLast(batch);
+                m_staging_batches.RemoveFirst();
+            }
+        }
+
+        // submit all pending uploads in one batch, returns the semaphore draw must wait on
+        VkSemaphore FlushStagingUploads()
+        {
+            m_staging_mutex.lock();
+
+            this->RecycleStagingBatches();
+
+            if (m_staging_copies.Empty())
+            {
+                m_staging_mutex.unlock();
+                return VK_NULL_HANDLE;
+            }
+
+            if (m_staging_free_batches.Empty())
+            {
+                StagingBatch batch;
+                this->CreateCommandBuffer(m_staging_cmd_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &batch.cmd);
+
+                VkFenceCreateInfo fence_info;
+                Memory::Zero(&fence_info, sizeof(fence_info));
+                fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                fence_info.pNext = nullptr;
+                fence_info.flags = 0;
+
+                VkSemaphoreCreateInfo semaphore_info;
+                Memory::Zero(&semaphore_info, sizeof(semaphore_info));
+                semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                semaphore_info.pNext = nullptr;
+                semaphore_info.flags = 0;
+
+                VkResult err = vkCreateFence(m_device, &fence_info, nullptr, &batch.fence);
+                assert(!err);
+                err = vkCreateSemaphore(m_device, &semaphore_info, nullptr, &batch.semaphore);
+                assert(!err);
+
+                m_staging_free_batches.AddLast(batch);
+            }
+
+            StagingBatch batch = m_staging_free_batches.First();
+            m_staging_free_batches.RemoveFirst();
+
+            VkResult err = vkResetFences(m_device, 1, &batch.fence);
+            assert(!err);
+
+            VkCommandBufferBeginInfo cmd_info;
+            Memory::Zero(&cmd_info, sizeof(cmd_info));
+            cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            cmd_info.pNext = nullptr;
+            cmd_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            cmd_info.pInheritanceInfo = nullptr;
+
+            err = vkBeginCommandBuffer(batch.cmd, &cmd_info);
+            assert(!err);
+
+            for (int i = 0; i < m_staging_copies.Size(); ++i)
+            {
+                const StagingCopy& copy = m_staging_copies[i];
+
+                // destination destroyed before upload
+                if (copy.dst->GetBuffer() == VK_NULL_HANDLE)
+                {
+                    continue;
+                }
+
+                VkBufferCopy region;
+                region.srcOffset = copy.src_offset;
+                region.dstOffset = 0;
+                region.size = copy.size;
+
+                vkCmdCopyBuffer(batch.cmd, copy.src->GetBuffer(), copy.dst->GetBuffer(), 1, &region);
+            }
+
+            err = vkEndCommandBuffer(batch.cmd);
+            assert(!err);
+
+            VkSubmitInfo submit_info;
+            Memory::Zero(&submit_info, sizeof(submit_info));
+            submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submit_info.pNext = nullptr;
+            submit_info.waitSemaphoreCount = 0;
+            submit_info.pWaitSemaphores = nullptr;
+            submit_info.pWaitDstStageMask = nullptr;
+            submit_info.commandBufferCount = 1;
+            submit_info.pCommandBuffers = &batch.cmd;
+            submit_info.signalSemaphoreCount = 1;
+            submit_info.pSignalSemaphores = &batch.semaphore;
+
+            // the transfer queue is the graphics queue when there is no transfer family
+            m_graphics_queue_mutex.lock();
+            err = vkQueueSubmit(m_transfer_queue, 1, &submit_info, batch.fence);
+            m_graphics_queue_mutex.unlock();
             assert(!err);
-        }
 
-        void CreateImageCmd()
-        {
-            this->CreateCommandPool(&m_image_cmd_pool);
-            this->CreateCommandBuffer(m_image_cmd_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &m_image_cmd);
+            batch.ring_ranges = m_staging_ring_pending;
+            batch.temp_buffers = m_staging_temp_buffers;
+            m_staging_batches.AddLast(batch);
+
+            m_staging_ring_pending.Clear();
+            m_staging_temp_buffers.Clear();
+            m_staging_copies.Clear();
+
+            m_staging_mutex.unlock();
+
+            return batch.semaphore;
         }
 
         void CreateSizeDependentResources()
         {
             this->CreateSwapChain();
             this->CreateCommandPool(&m_graphics_cmd_pool);
-            for (int i = 0; i < m_swapchain_image_resources.Size(); ++i)
-            {
-                this->CreateCommandBuffer(m_graphics_cmd_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &m_swapchain_image_resources[i].cmd);
-            }
             m_depth_texture = Texture::CreateRenderTexture(
                 m_width,
                 m_height,
@@ -775,11 +1901,18 @@ namespace Viry3D
 
         void DestroySizeDependentResources()
         {
+            // callers wait for the device idle, retired cmds must go before their pool
+            m_completed_frame = m_frame_stats.frame_count - 1;
+            this->FreeRetiredResources(false);
+
             m_depth_texture.reset();
 
             for (int i = 0; i < m_swapchain_image_resources.Size(); ++i)
             {
-                vkFreeCommandBuffers(m_device, m_graphics_cmd_pool, 1, &m_swapchain_image_resources[i].cmd);
+                for (auto& j : m_swapchain_image_resources[i].camera_cmds)
+                {
+                    vkFreeCommandBuffers(m_device, m_graphics_cmd_pool, 1, &j.second.cmd);
+                }
             }
             if (m_graphics_cmd_pool != VK_NULL_HANDLE)
             {
@@ -817,8 +1950,6 @@ namespace Viry3D
             this->CreateSurface();
             this->GetQueues();
             this->CreateSizeDependentResources();
-
-            m_primary_cmd_dirty = true;
         }
 
         void OnPause()
@@ -835,6 +1966,9 @@ namespace Viry3D
             this->DestroySizeDependentResources();
             vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
             m_surface = VK_NULL_HANDLE;
+
+            // paused apps may be killed without shutdown
+            this->SavePipelineCache();
         }
 
         void OnResume()
@@ -987,14 +2121,19 @@ namespace Viry3D
             }
         }
 
-        void CreateCommandPool(VkCommandPool* cmd_pool)
+        void CreateCommandPool(VkCommandPool* cmd_pool, int queue_family_index = -1)
         {
+            if (queue_family_index < 0)
+            {
+                queue_family_index = m_graphics_queue_family_index;
+            }
+
             VkCommandPoolCreateInfo pool_info;
             Memory::Zero(&pool_info, sizeof(pool_info));
             pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
             pool_info.pNext = nullptr;
             pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-            pool_info.queueFamilyIndex = m_graphics_queue_family_index;
+            pool_info.queueFamilyIndex = queue_family_index;
 
             VkResult err = vkCreateCommandPool(m_device, &pool_info, nullptr, cmd_pool);
             assert(!err);
@@ -1017,6 +2156,7 @@ namespace Viry3D
         void CreateRenderPass(
             VkFormat color_format,
             VkFormat depth_format,
+            VkSampleCountFlagBits sample_count,
             CameraClearFlags clear_flag,
             bool present,
             VkRenderPass* render_pass)
@@ -1089,7 +2229,7 @@ namespace Viry3D
                 Memory::Zero(&attachment, sizeof(attachment));
                 attachment.flags = 0;
                 attachment.format = color_format;
-                attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+                attachment.samples = sample_count;
                 attachment.loadOp = color_load;
                 attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
                 attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -1108,7 +2248,7 @@ namespace Viry3D
                 Memory::Zero(&attachment, sizeof(attachment));
                 attachment.flags = 0;
                 attachment.format = depth_format;
-                attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+                attachment.samples = sample_count;
                 attachment.loadOp = depth_load;
                 attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
                 attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -1197,24 +2337,6 @@ namespace Viry3D
             assert(!err);
         }
 
-        bool CheckMemoryType(uint32_t mem_type_bits, VkFlags requirements_mask, uint32_t* type_index)
-        {
-            for (int i = 0; i < VK_MAX_MEMORY_TYPES; ++i)
-            {
-                if ((mem_type_bits & 1) == 1)
-                {
-                    if ((m_memory_properties.memoryTypes[i].propertyFlags & requirements_mask) == requirements_mask)
-                    {
-                        *type_index = i;
-                        return true;
-                    }
-                }
-                mem_type_bits >>= 1;
-            }
-
-            return false;
-        }
-
         VkFormat ChooseFormatSupported(const Vector<VkFormat>& formats, VkFormatFeatureFlags features)
         {
             for (int i = 0; i < formats.Size(); ++i)
@@ -1290,19 +2412,10 @@ namespace Viry3D
             VkMemoryRequirements mem_reqs;
             vkGetImageMemoryRequirements(m_device, texture->m_image, &mem_reqs);
 
-            Memory::Zero(&texture->m_memory_info, sizeof(texture->m_memory_info));
-            texture->m_memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            texture->m_memory_info.pNext = nullptr;
-            texture->m_memory_info.allocationSize = mem_reqs.size;
-            texture->m_memory_info.memoryTypeIndex = 0;
-
-            bool pass = this->CheckMemoryType(mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texture->m_memory_info.memoryTypeIndex);
+            bool pass = m_memory_allocator->Alloc(mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, &texture->m_memory);
             assert(pass);
 
-            err = vkAllocateMemory(m_device, &texture->m_memory_info, nullptr, &texture->m_memory);
-            assert(!err);
-
-            err = vkBindImageMemory(m_device, texture->m_image, texture->m_memory, 0);
+            err = vkBindImageMemory(m_device, texture->m_image, texture->m_memory.memory, texture->m_memory.offset);
             assert(!err);
 
             VkImageViewCreateInfo view_info;
@@ -1352,10 +2465,12 @@ namespace Viry3D
             assert(!err);
         }
 
-        Ref<BufferObject> CreateBuffer(const void* data, int size, VkBufferUsageFlags usage)
+        Ref<BufferObject> CreateBuffer(const void* data, int size, VkBufferUsageFlags usage, bool device_local = false)
         {
             Ref<BufferObject> buffer = RefMake<BufferObject>(size);
 
+            uint32_t queue_family_indices[2] = { (uint32_t) m_graphics_queue_family_index, (uint32_t) m_transfer_queue_family_index };
+
             VkBufferCreateInfo buffer_info;
             Memory::Zero(&buffer_info, sizeof(buffer_info));
             buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1367,106 +2482,230 @@ namespace Viry3D
             buffer_info.queueFamilyIndexCount = 0;
             buffer_info.pQueueFamilyIndices = nullptr;
 
+            // gpu read buffers are updated by per frame copies
+            if (device_local || (usage & GPU_READ_BUFFER_USAGE))
+            {
+                buffer_info.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            }
+
+            if (device_local)
+            {
+                // written by transfer queue, read by graphics queue, no ownership transfer needed
+                if (m_transfer_queue_family_index != m_graphics_queue_family_index)
+                {
+                    buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+                    buffer_info.queueFamilyIndexCount = 2;
+                    buffer_info.pQueueFamilyIndices = queue_family_indices;
+                }
+            }
+
             VkResult err = vkCreateBuffer(m_device, &buffer_info, nullptr, &buffer->m_buffer);
             assert(!err);
+            buffer->m_usage = buffer_info.usage;
 
             VkMemoryRequirements mem_reqs;
             vkGetBufferMemoryRequirements(m_device, buffer->m_buffer, &mem_reqs);
 
-            Memory::Zero(&buffer->m_memory_info, sizeof(buffer->m_memory_info));
-            buffer->m_memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            buffer->m_memory_info.pNext = nullptr;
-            buffer->m_memory_info.allocationSize = mem_reqs.size;
-            buffer->m_memory_info.memoryTypeIndex = 0;
+            VkMemoryPropertyFlags memory_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            if (device_local)
+            {
+                memory_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            }
 
-            bool pass = this->CheckMemoryType(mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffer->m_memory_info.memoryTypeIndex);
+            bool pass = m_memory_allocator->Alloc(mem_reqs, memory_flags, true, &buffer->m_memory);
             assert(pass);
 
-            err = vkAllocateMemory(m_device, &buffer->m_memory_info, nullptr, &buffer->m_memory);
-            assert(!err);
-
-            err = vkBindBufferMemory(m_device, buffer->m_buffer, buffer->m_memory, 0);
+            err = vkBindBufferMemory(m_device, buffer->m_buffer, buffer->m_memory.memory, buffer->m_memory.offset);
             assert(!err);
 
             if (data)
             {
-                void* map_data = nullptr;
-                err = vkMapMemory(m_device, buffer->m_memory, 0, size, 0, (void**) &map_data);
-                assert(!err);
+                if (buffer->m_memory.mapped)
+                {
+                    Memory::Copy(buffer->m_memory.mapped, data, size);
+                }
+                else
+                {
+                    this->UploadBuffer(buffer, data, size);
+                }
+            }
+
+            return buffer;
+        }
+
+        void UploadBuffer(const Ref<BufferObject>& buffer, const void* data, int size)
+        {
+            m_staging_mutex.lock();
 
-                Memory::Copy(map_data, data, size);
+            StagingCopy copy;
+            copy.dst = buffer;
+            copy.size = (VkDeviceSize) size;
 
-                vkUnmapMemory(m_device, buffer->m_memory);
+            VkDeviceSize offset = 0;
+            uint64_t range_id = 0;
+            if (this->AllocStagingRing(size, &offset, &range_id))
+            {
+                copy.src = m_staging_ring;
+                copy.src_offset = offset;
+                m_staging_ring_pending.Add(range_id);
+            }
+            else
+            {
+                // ring is full or upload is too big, use a temporary buffer freed with the batch
+                copy.src = this->CreateBuffer(nullptr, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+                copy.src_offset = 0;
+                m_staging_temp_buffers.Add(copy.src);
             }
 
-            return buffer;
+            Memory::Copy(((byte*) copy.src->GetMappedData()) + copy.src_offset, data, size);
+
+            m_staging_copies.Add(copy);
+
+            m_staging_mutex.unlock();
         }
 
         void UpdateBuffer(const Ref<BufferObject>& buffer, int buffer_offset, const void* data, int size)
         {
-            void* map_data = nullptr;
-            VkResult err = vkMapMemory(m_device, buffer->GetMemory(), buffer_offset, size, 0, (void**) &map_data);
-            assert(!err);
+            // frames in flight may still read this buffer
+            if (buffer->GetUsage() & GPU_READ_BUFFER_USAGE)
+            {
+                this->StageBufferUpdate(buffer, buffer_offset, data, size);
+                return;
+            }
+
+            byte* map_data = (byte*) buffer->GetMappedData();
+            assert(map_data);
+
+            Memory::Copy(map_data + buffer_offset, data, size);
+        }
 
-            Memory::Copy(map_data, data, size);
+        void* MapBufferUpdate(const Ref<BufferObject>& buffer, int buffer_offset, int size)
+        {
+            // frames in flight may still read this buffer
+            if (buffer->GetUsage() & GPU_READ_BUFFER_USAGE)
+            {
+                return this->MapStagingUpdate(buffer, buffer_offset, size);
+            }
+
+            byte* map_data = (byte*) buffer->GetMappedData();
+            assert(map_data);
 
-            vkUnmapMemory(m_device, buffer->GetMemory());
+            return map_data + buffer_offset;
         }
 
         void ReadBuffer(const Ref<BufferObject>& buffer, ByteBuffer& data)
         {
             data = ByteBuffer(buffer->GetSize());
 
-            void* map_data = nullptr;
-            VkResult err = vkMapMemory(m_device, buffer->GetMemory(), 0, buffer->GetSize(), 0, (void**) &map_data);
-            assert(!err);
+            const byte* map_data = (const byte*) buffer->GetMappedData();
+            assert(map_data);
 
             Memory::Copy(&data[0], map_data, buffer->GetSize());
-
-            vkUnmapMemory(m_device, buffer->GetMemory());
         }
 
+        // image cmds from all threads are appended to one open batch, submitted once per frame
         void BeginImageCmd()
         {
             m_image_cmd_mutex.lock();
 
+            if (m_image_cmd != VK_NULL_HANDLE)
+            {
+                return;
+            }
+
+            this->RecycleImageBatches();
+
+            if (m_image_free_batches.Empty())
+            {
+                ImageBatch batch;
+                this->CreateCommandBuffer(m_image_cmd_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &batch.cmd);
+
+                VkFenceCreateInfo fence_info;
+                Memory::Zero(&fence_info, sizeof(fence_info));
+                fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                fence_info.pNext = nullptr;
+                fence_info.flags = 0;
+
+                VkSemaphoreCreateInfo semaphore_info;
+                Memory::Zero(&semaphore_info, sizeof(semaphore_info));
+                semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                semaphore_info.pNext = nullptr;
+                semaphore_info.flags = 0;
+
+                VkResult err = vkCreateFence(m_device, &fence_info, nullptr, &batch.fence);
+                assert(!err);
+                err = vkCreateSemaphore(m_device, &semaphore_info, nullptr, &batch.semaphore);
+                assert(!err);
+
+                m_image_free_batches.AddLast(batch);
+            }
+
+            m_image_batch = m_image_free_batches.First();
+            m_image_free_batches.RemoveFirst();
+
+            m_image_batch.token = ++m_image_token;
+            m_image_batch.wait_frame = -1;
+
+            VkResult err = vkResetFences(m_device, 1, &m_image_batch.fence);
+            assert(!err);
+
             VkCommandBufferBeginInfo cmd_info;
+            Memory::Zero(&cmd_info, sizeof(cmd_info));
             cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
             cmd_info.pNext = nullptr;
-            cmd_info.flags = 0;
+            cmd_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
             cmd_info.pInheritanceInfo = nullptr;
 
-            VkResult err = vkBeginCommandBuffer(m_image_cmd, &cmd_info);
+            err = vkBeginCommandBuffer(m_image_batch.cmd, &cmd_info);
             assert(!err);
+
+            m_image_cmd = m_image_batch.cmd;
         }
 
-        void EndImageCmd()
+        UploadToken EndImageCmd()
         {
-            VkResult err = vkEndCommandBuffer(m_image_cmd);
-            assert(!err);
+            UploadToken token = m_image_batch.token;
 
-            VkSubmitInfo submit_info;
-            Memory::Zero(&submit_info, sizeof(submit_info));
-            submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submit_info.pNext = nullptr;
-            submit_info.waitSemaphoreCount = 0;
-            submit_info.pWaitSemaphores = nullptr;
-            submit_info.pWaitDstStageMask = nullptr;
-            submit_info.commandBufferCount = 1;
-            submit_info.pCommandBuffers = &m_image_cmd;
-            submit_info.signalSemaphoreCount = 0;
-            submit_info.pSignalSemaphores = nullptr;
+            m_image_cmd_mutex.unlock();
 
-            err = vkResetFences(m_device, 1, &m_image_fence);
-            assert(!err);
+            return token;
+        }
 
-            err = vkQueueSubmit(m_image_queue, 1, &submit_info, m_image_fence);
-            assert(!err);
+        // call between BeginImageCmd and EndImageCmd,
+        // memory to copy to the image from, taken from the staging ring and released when the image batch completes
+        void* MapImageStaging(int size, Ref<BufferObject>& buffer, int* offset)
+        {
+            assert(m_image_cmd != VK_NULL_HANDLE);
 
-            err = vkWaitForFences(m_device, 1, &m_image_fence, VK_TRUE, UINT64_MAX);
-            assert(!err);
+            m_staging_mutex.lock();
 
-            m_image_cmd_mutex.unlock();
+            VkDeviceSize ring_offset = 0;
+            uint64_t range_id = 0;
+            if (this->AllocStagingRing(size, &ring_offset, &range_id))
+            {
+                buffer = m_staging_ring;
+                *offset = (int) ring_offset;
+                m_image_batch.ring_ranges.Add(range_id);
+            }
+            else
+            {
+                // ring is full or upload is too big, use a temporary buffer freed with the batch
+                buffer = this->CreateBuffer(nullptr, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+                *offset = 0;
+                m_image_batch.temp_buffers.Add(buffer);
+            }
+
+            m_staging_mutex.unlock();
+
+            return ((byte*) buffer->GetMappedData()) + *offset;
+        }
+
+        // call between BeginImageCmd and EndImageCmd
+        void DestroyBufferAfterImageCmd(const Ref<BufferObject>& buffer)
+        {
+            assert(m_image_cmd != VK_NULL_HANDLE);
+
+            m_image_batch.temp_buffers.Add(buffer);
         }
 
         void SetImageLayout(
@@ -1540,32 +2779,61 @@ namespace Viry3D
             assert(!err);
         }
 
+        SpirvCache* GetSpirvCache()
+        {
+            std::lock_guard<Mutex> lock(m_spirv_cache_mutex);
+
+            if (m_spirv_cache == nullptr)
+            {
+                m_spirv_cache = new SpirvCache(Application::Instance()->GetSavePath() + "/" + SPIRV_CACHE_FILE);
+            }
+
+            return m_spirv_cache;
+        }
+
         void CreateGlslShaderModule(
             const String& glsl,
             VkShaderStageFlagBits shader_type,
             VkShaderModule* module,
-            Vector<UniformSet>& uniform_sets)
+            Vector<UniformSet>& uniform_sets,
+            bool* instancing)
         {
+            SpirvCache* spirv_cache = this->GetSpirvCache();
+            SpirvCacheKey key = SpirvCache::Hash(glsl.CString(), glsl.Size(), (uint32_t) shader_type);
+
             Vector<unsigned int> spirv;
-            GlslToSpirvCached(glsl, shader_type, spirv);
-            this->CreateSpirvShaderModule(spirv, module);
+            Vector<byte> reflection;
+            Vector<UniformSet> stage_sets;
+            bool stage_instancing = false;
 
-            // reflect spirv
-            spirv_cross::CompilerGLSL compiler(&spirv[0], spirv.Size());
-            spirv_cross::ShaderResources resources = compiler.get_shader_resources();
+            if (spirv_cache->Find(key, spirv, reflection))
+            {
+                ReadReflection(reflection, stage_sets, &stage_instancing);
+            }
+            else
+            {
+                GlslToSpirv(glsl, shader_type, spirv);
+                this->ReflectSpirv(spirv, shader_type, stage_sets, &stage_instancing);
+                WriteReflection(reflection, stage_sets, stage_instancing);
+                spirv_cache->Add(key, spirv, reflection);
+            }
+
+            this->CreateSpirvShaderModule(spirv, module);
 
-            for (const auto& resource : resources.uniform_buffers)
+            if (instancing && stage_instancing)
             {
-                uint32_t set = compiler.get_decoration(resource.id, spv::DecorationDescriptorSet);
-                uint32_t binding = compiler.get_decoration(resource.id, spv::DecorationBinding);
-                const std::string& name = compiler.get_name(resource.id);
+                *instancing = true;
+            }
 
+            // merge the stage sets with the sets of the other stage
+            for (const auto& i : stage_sets)
+            {
                 UniformSet* set_ptr = nullptr;
-                for (int i = 0; i < uniform_sets.Size(); ++i)
+                for (int j = 0; j < uniform_sets.Size(); ++j)
                 {
-                    if (set == uniform_sets[i].set)
+                    if (i.set == uniform_sets[j].set)
                     {
-                        set_ptr = &uniform_sets[i];
+                        set_ptr = &uniform_sets[j];
                         break;
                     }
                 }
@@ -1573,41 +2841,102 @@ namespace Viry3D
                 {
                     uniform_sets.Add(UniformSet());
                     set_ptr = &uniform_sets[uniform_sets.Size() - 1];
-                    set_ptr->set = set;
+                    set_ptr->set = i.set;
+                }
+
+                for (int j = 0; j < i.buffers.Size(); ++j)
+                {
+                    set_ptr->buffers.Add(i.buffers[j]);
                 }
+                for (int j = 0; j < i.textures.Size(); ++j)
+                {
+                    set_ptr->textures.Add(i.textures[j]);
+                }
+            }
+        }
 
-                UniformBuffer buffer;
-                buffer.name = name.c_str();
-                buffer.binding = (int) binding;
-                buffer.stage = shader_type;
+        void ReflectSpirv(
+            const Vector<unsigned int>& spirv,
+            VkShaderStageFlagBits shader_type,
+            Vector<UniformSet>& uniform_sets,
+            bool* instancing)
+        {
+            spirv_cross::CompilerGLSL compiler(&spirv[0], spirv.Size());
+            spirv_cross::ShaderResources resources = compiler.get_shader_resources();
 
-                const spirv_cross::SPIRType& type = compiler.get_type(resource.base_type_id);
+            // instance model matrix rows are read from the per instance vertex stream
+            for (const auto& resource : resources.stage_inputs)
+            {
+                uint32_t location = compiler.get_decoration(resource.id, spv::DecorationLocation);
+                if (location == INSTANCE_MATRIX_LOCATION)
+                {
+                    *instancing = true;
+                }
+            }
 
-                int max_offset_member = -1;
-                int max_offset = -1;
-                for (size_t i = 0; i < type.member_types.size(); ++i)
+            // storage blocks are reflected like uniform blocks and bound with dynamic offsets too
+            for (int storage = 0; storage < 2; ++storage)
+            {
+                const auto& buffer_resources = storage ? resources.storage_buffers : resources.uniform_buffers;
+                for (const auto& resource : buffer_resources)
                 {
-                    const std::string& member_name = compiler.get_member_name(type.self, (uint32_t) i);
-                    int member_offset = (int) compiler.type_struct_member_offset(type, (uint32_t) i);
-                    int member_size = (int) compiler.get_declared_struct_member_size(type, (uint32_t) i);
+                    uint32_t set = compiler.get_decoration(resource.id, spv::DecorationDescriptorSet);
+                    uint32_t binding = compiler.get_decoration(resource.id, spv::DecorationBinding);
+                    const std::string& name = compiler.get_name(resource.id);
+
+                    UniformSet* set_ptr = nullptr;
+                    for (int i = 0; i < uniform_sets.Size(); ++i)
+                    {
+                        if ((int) set == uniform_sets[i].set)
+                        {
+                            set_ptr = &uniform_sets[i];
+                            break;
+                        }
+                    }
+                    if (set_ptr == nullptr)
+                    {
+                        uniform_sets.Add(UniformSet());
+                        set_ptr = &uniform_sets[uniform_sets.Size() - 1];
+                        set_ptr->set = set;
+                    }
 
-                    UniformMember member;
-                    member.name = member_name.c_str();
-                    member.offset = member_offset;
-                    member.size = member_size;
+                    UniformBuffer buffer;
+                    buffer.name = name.c_str();
+                    buffer.binding = (int) binding;
+                    buffer.stage = shader_type;
+                    buffer.offset = 0;
+                    buffer.dirty = false;
+                    buffer.shared = false;
+                    buffer.storage = storage != 0;
 
-                    buffer.members.Add(member);
+                    const spirv_cross::SPIRType& type = compiler.get_type(resource.base_type_id);
 
-                    if (member.offset > max_offset)
+                    int max_offset_member = -1;
+                    int max_offset = -1;
+                    for (size_t i = 0; i < type.member_types.size(); ++i)
                     {
-                        max_offset = member.offset;
-                        max_offset_member = (int) i;
+                        const std::string& member_name = compiler.get_member_name(type.self, (uint32_t) i);
+                        int member_offset = (int) compiler.type_struct_member_offset(type, (uint32_t) i);
+                        int member_size = (int) compiler.get_declared_struct_member_size(type, (uint32_t) i);
+
+                        UniformMember member;
+                        member.name = member_name.c_str();
+                        member.offset = member_offset;
+                        member.size = member_size;
+
+                        buffer.members.Add(member);
+
+                        if (member.offset > max_offset)
+                        {
+                            max_offset = member.offset;
+                            max_offset_member = (int) i;
+                        }
                     }
-                }
 
-                buffer.size = buffer.members[max_offset_member].offset + buffer.members[max_offset_member].size;
+                    buffer.size = buffer.members[max_offset_member].offset + buffer.members[max_offset_member].size;
 
-                set_ptr->buffers.Add(buffer);
+                    set_ptr->buffers.Add(buffer);
+                }
             }
 
             for (const auto& resource : resources.sampled_images)
@@ -1641,19 +2970,161 @@ namespace Viry3D
             }
         }
 
-        void CreatePipelineCache(VkPipelineCache* pipeline_cache)
+        // one cache for all shaders, loaded from save path on first use
+        VkPipelineCache GetPipelineCache()
         {
-            VkPipelineCacheCreateInfo create_info;
-            Memory::Zero(&create_info, sizeof(create_info));
-            create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-            create_info.pNext = nullptr;
-            create_info.flags = 0;
-            create_info.initialDataSize = 0;
-            create_info.pInitialData = nullptr;
+            m_pipeline_cache_mutex.lock();
 
-            VkResult err;
-            err = vkCreatePipelineCache(m_device, &create_info, nullptr, pipeline_cache);
-            assert(!err);
+            if (m_pipeline_cache == VK_NULL_HANDLE)
+            {
+                m_pipeline_cache_path = Application::Instance()->GetSavePath() + "/" + PIPELINE_CACHE_FILE;
+
+                ByteBuffer buffer;
+                const void* initial_data = nullptr;
+                size_t initial_data_size = 0;
+
+                if (File::Exist(m_pipeline_cache_path))
+                {
+                    buffer = File::ReadAllBytes(m_pipeline_cache_path);
+
+                    if (buffer.Size() >= (int) sizeof(PipelineCacheHeader))
+                    {
+                        PipelineCacheHeader header;
+                        Memory::Copy(&header, buffer.Bytes(), sizeof(header));
+
+                        if (header.magic == PIPELINE_CACHE_MAGIC &&
+                            header.data_size == buffer.Size() - sizeof(header) &&
+                            header.vendor_id == m_gpu_properties.vendorID &&
+                            header.device_id == m_gpu_properties.deviceID &&
+                            header.driver_version == m_gpu_properties.driverVersion &&
+                            memcmp(header.uuid, m_gpu_properties.pipelineCacheUUID, VK_UUID_SIZE) == 0)
+                        {
+                            initial_data = buffer.Bytes() + sizeof(header);
+                            initial_data_size = header.data_size;
+                        }
+                        else
+                        {
+                            Log("pipeline cache from another device or driver, ignored");
+                        }
+                    }
+                }
+
+                VkPipelineCacheCreateInfo create_info;
+                Memory::Zero(&create_info, sizeof(create_info));
+                create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+                create_info.pNext = nullptr;
+                create_info.flags = 0;
+                create_info.initialDataSize = initial_data_size;
+                create_info.pInitialData = initial_data;
+
+                VkResult err = vkCreatePipelineCache(m_device, &create_info, nullptr, &m_pipeline_cache);
+                if (err && initial_data_size > 0)
+                {
+                    // driver rejected the data, start empty
+                    create_info.initialDataSize = 0;
+                    create_info.pInitialData = nullptr;
+                    err = vkCreatePipelineCache(m_device, &create_info, nullptr, &m_pipeline_cache);
+                }
+                assert(!err);
+            }
+
+            m_pipeline_cache_mutex.unlock();
+
+            return m_pipeline_cache;
+        }
+
+        void SavePipelineCache()
+        {
+            m_pipeline_cache_mutex.lock();
+
+            if (m_pipeline_cache != VK_NULL_HANDLE)
+            {
+                size_t data_size = 0;
+                VkResult err = vkGetPipelineCacheData(m_device, m_pipeline_cache, &data_size, nullptr);
+                assert(!err);
+
+                if (data_size > 0)
+                {
+                    PipelineCacheHeader header;
+                    Memory::Zero(&header, sizeof(header));
+                    header.magic = PIPELINE_CACHE_MAGIC;
+                    header.data_size = (uint32_t) data_size;
+                    header.vendor_id = m_gpu_properties.vendorID;
+                    header.device_id = m_gpu_properties.deviceID;
+                    header.driver_version = m_gpu_properties.driverVersion;
+                    Memory::Copy(header.uuid, m_gpu_properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+                    ByteBuffer buffer((int) (sizeof(header) + data_size));
+                    Memory::Copy(buffer.Bytes(), &header, sizeof(header));
+                    err = vkGetPipelineCacheData(m_device, m_pipeline_cache, &data_size, buffer.Bytes() + sizeof(header));
+                    assert(!err);
+
+                    File::WriteAllBytes(m_pipeline_cache_path, buffer);
+                }
+            }
+
+            m_pipeline_cache_mutex.unlock();
+
+            // compiled shader stages are saved with the pipelines
+            std::lock_guard<Mutex> lock(m_spirv_cache_mutex);
+            if (m_spirv_cache)
+            {
+                m_spirv_cache->Save();
+            }
+        }
+
+        // load ops and layouts do not affect compatibility, so one pass per key is enough to build pipelines against
+        VkRenderPass GetCompatibleRenderPass(const RenderPassKey& key)
+        {
+            std::lock_guard<Mutex> lock(m_compatible_render_pass_mutex);
+
+            VkRenderPass* find;
+            if (m_compatible_render_passes.TryGet(key, &find))
+            {
+                return *find;
+            }
+
+            VkRenderPass render_pass;
+            this->CreateRenderPass(
+                key.color_format,
+                key.depth_format,
+                key.sample_count,
+                CameraClearFlags::Invalidate,
+                false,
+                &render_pass);
+            m_compatible_render_passes.Add(key, render_pass);
+
+            return render_pass;
+        }
+
+        void DestroyCompatibleRenderPasses()
+        {
+            for (auto i : m_compatible_render_passes)
+            {
+                vkDestroyRenderPass(m_device, i.second, nullptr);
+            }
+            m_compatible_render_passes.Clear();
+        }
+
+        void DestroySpirvCache()
+        {
+            if (m_spirv_cache)
+            {
+                m_spirv_cache->Save();
+                delete m_spirv_cache;
+                m_spirv_cache = nullptr;
+            }
+        }
+
+        void DestroyPipelineCache()
+        {
+            if (m_pipeline_cache != VK_NULL_HANDLE)
+            {
+                this->SavePipelineCache();
+
+                vkDestroyPipelineCache(m_device, m_pipeline_cache, nullptr);
+                m_pipeline_cache = VK_NULL_HANDLE;
+            }
         }
 
         void CreateShaderModule(
@@ -1665,7 +3136,8 @@ namespace Viry3D
             const String& fs_source,
             VkShaderModule* vs_module,
             VkShaderModule* fs_module,
-            Vector<UniformSet>& uniform_sets)
+            Vector<UniformSet>& uniform_sets,
+            bool* instancing)
         {
             Vector<String> includes;
             includes.Add("Base.in");
@@ -1676,8 +3148,9 @@ namespace Viry3D
             String vs = ProcessShaderSource(vs_source, vs_predefine, includes);
             String fs = ProcessShaderSource(fs_source, fs_predefine, fs_includes);
 
-            this->CreateGlslShaderModule(vs, VK_SHADER_STAGE_VERTEX_BIT, vs_module, uniform_sets);
-            this->CreateGlslShaderModule(fs, VK_SHADER_STAGE_FRAGMENT_BIT, fs_module, uniform_sets);
+            *instancing = false;
+            this->CreateGlslShaderModule(vs, VK_SHADER_STAGE_VERTEX_BIT, vs_module, uniform_sets, instancing);
+            this->CreateGlslShaderModule(fs, VK_SHADER_STAGE_FRAGMENT_BIT, fs_module, uniform_sets, nullptr);
 
             // sort by set
             List<UniformSet*> sets;
@@ -1692,6 +3165,21 @@ namespace Viry3D
             Vector<UniformSet> sets_sorted;
             for (auto i : sets)
             {
+                // dynamic offsets are bound in binding order
+                List<UniformBuffer> buffers;
+                for (int j = 0; j < i->buffers.Size(); ++j)
+                {
+                    buffers.AddLast(i->buffers[j]);
+                }
+                buffers.Sort([](const UniformBuffer& a, const UniformBuffer& b) {
+                    return a.binding < b.binding;
+                });
+                i->buffers.Clear();
+                for (const auto& j : buffers)
+                {
+                    i->buffers.Add(j);
+                }
+
                 sets_sorted.Add(*i);
             }
             uniform_sets = sets_sorted;
@@ -1716,7 +3204,7 @@ namespace Viry3D
                     VkDescriptorSetLayoutBinding layout_binding;
                     Memory::Zero(&layout_binding, sizeof(layout_binding));
                     layout_binding.binding = buffer.binding;
-                    layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                    layout_binding.descriptorType = buffer.storage ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
                     layout_binding.descriptorCount = 1;
                     layout_binding.stageFlags = buffer.stage;
                     layout_binding.pImmutableSamplers = nullptr;
@@ -1774,7 +3262,8 @@ namespace Viry3D
             VkPipelineCache pipeline_cache,
             VkPipeline* pipeline,
             bool color_attachment,
-            bool depth_attachment)
+            bool depth_attachment,
+            bool instancing)
         {
             Vector<VkPipelineShaderStageCreateInfo> shader_stages;
             {
@@ -1806,11 +3295,11 @@ namespace Viry3D
                 shader_stages.Add(stage_info);
             }
 
-            VkVertexInputBindingDescription vi_bind;
-            Memory::Zero(&vi_bind, sizeof(vi_bind));
-            vi_bind.binding = 0;
-            vi_bind.stride = sizeof(Vertex);
-            vi_bind.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            Vector<VkVertexInputBindingDescription> vi_binds(1);
+            Memory::Zero(&vi_binds[0], vi_binds.SizeInBytes());
+            vi_binds[0].binding = 0;
+            vi_binds[0].stride = sizeof(Vertex);
+            vi_binds[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
             Vector<VkVertexInputAttributeDescription> vi_attrs((int) VertexAttributeType::Count);
             Memory::Zero(&vi_attrs[0], vi_attrs.SizeInBytes());
@@ -1855,13 +3344,34 @@ namespace Viry3D
             vi_attrs[location].format = VK_FORMAT_R32G32B32A32_SFLOAT;
             vi_attrs[location].offset = VERTEX_ATTR_OFFSETS[location];
 
+            if (instancing)
+            {
+                VkVertexInputBindingDescription instance_bind;
+                Memory::Zero(&instance_bind, sizeof(instance_bind));
+                instance_bind.binding = 1;
+                instance_bind.stride = sizeof(Matrix4x4);
+                instance_bind.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+                vi_binds.Add(instance_bind);
+
+                for (int i = 0; i < 4; ++i)
+                {
+                    VkVertexInputAttributeDescription attr;
+                    Memory::Zero(&attr, sizeof(attr));
+                    attr.location = INSTANCE_MATRIX_LOCATION + i;
+                    attr.binding = 1;
+                    attr.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+                    attr.offset = sizeof(Vector4) * i;
+                    vi_attrs.Add(attr);
+                }
+            }
+
             VkPipelineVertexInputStateCreateInfo vi;
             Memory::Zero(&vi, sizeof(vi));
             vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
             vi.pNext = nullptr;
             vi.flags = 0;
-            vi.vertexBindingDescriptionCount = 1;
-            vi.pVertexBindingDescriptions = &vi_bind;
+            vi.vertexBindingDescriptionCount = (uint32_t) vi_binds.Size();
+            vi.pVertexBindingDescriptions = &vi_binds[0];
             vi.vertexAttributeDescriptionCount = (uint32_t) vi_attrs.Size();
             vi.pVertexAttributeDescriptions = &vi_attrs[0];
 
@@ -2007,76 +3517,141 @@ namespace Viry3D
             assert(!err);
         }
 
-        void CreateDescriptorSetPool(const Vector<UniformSet>& uniform_sets, VkDescriptorPool* descriptor_pool)
+        // uniform blocks are sub allocated from shared device local pages and bound with dynamic offsets,
+        // cpu writes go to the frame staging ring and are copied before the frame draws
+        void AllocUniformRange(int size, Ref<BufferObject>& buffer, int* offset)
         {
-            int buffer_count = 0;
-            int texture_count = 0;
+            int alignment = (int) m_gpu_properties.limits.minUniformBufferOffsetAlignment;
+            size = (size + alignment - 1) & ~(alignment - 1);
 
-            for (int i = 0; i < uniform_sets.Size(); ++i)
+            m_uniform_mutex.lock();
+
+            for (int i = 0; i < m_uniform_pages.Size(); ++i)
             {
-                for (int j = 0; j < uniform_sets[i].buffers.Size(); ++j)
+                UniformPage& page = m_uniform_pages[i];
+
+                for (auto j = page.free_ranges.begin(); j != page.free_ranges.end(); ++j)
                 {
-                    ++buffer_count;
+                    if (j->size >= size)
+                    {
+                        buffer = page.buffer;
+                        *offset = j->offset;
+
+                        j->offset += size;
+                        j->size -= size;
+                        if (j->size == 0)
+                        {
+                            page.free_ranges.Remove(j);
+                        }
+
+                        m_uniform_mutex.unlock();
+                        return;
+                    }
                 }
+            }
 
-                for (int j = 0; j < uniform_sets[i].textures.Size(); ++j)
+            int page_size = UNIFORM_PAGE_SIZE;
+            if (page_size < size)
+            {
+                page_size = size;
+            }
+
+            UniformPage page;
+            page.buffer = this->CreateBuffer(nullptr, page_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, true);
+            if (page_size > size)
+            {
+                UniformRange range;
+                range.offset = size;
+                range.size = page_size - size;
+                page.free_ranges.AddLast(range);
+            }
+            m_uniform_pages.Add(page);
+
+            buffer = page.buffer;
+            *offset = 0;
+
+            m_uniform_mutex.unlock();
+        }
+
+        // the range may be read by frames in flight, it returns to the free list once they complete
+        void FreeUniformRange(const Ref<BufferObject>& buffer, int offset, int size)
+        {
+            this->RetireResource([=]() {
+                this->ReleaseUniformRange(buffer, offset, size);
+            });
+        }
+
+        void ReleaseUniformRange(const Ref<BufferObject>& buffer, int offset, int size)
+        {
+            int alignment = (int) m_gpu_properties.limits.minUniformBufferOffsetAlignment;
+            size = (size + alignment - 1) & ~(alignment - 1);
+
+            m_uniform_mutex.lock();
+
+            for (int i = 0; i < m_uniform_pages.Size(); ++i)
+            {
+                UniformPage& page = m_uniform_pages[i];
+                if (page.buffer != buffer)
                 {
-                    ++texture_count;
+                    continue;
                 }
-            }
 
-            Vector<VkDescriptorPoolSize> pool_sizes;
-			if (buffer_count > 0)
-			{
-				VkDescriptorPoolSize pool_size;
-				pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-				pool_size.descriptorCount = (uint32_t) buffer_count * DESCRIPTOR_POOL_SIZE_MAX;
-				pool_sizes.Add(pool_size);
-			}
-			if (texture_count > 0)
-			{
-				VkDescriptorPoolSize pool_size;
-				pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				pool_size.descriptorCount = (uint32_t) texture_count * DESCRIPTOR_POOL_SIZE_MAX;
-				pool_sizes.Add(pool_size);
-			}
-            
-            VkDescriptorPoolCreateInfo pool_info;
-            Memory::Zero(&pool_info, sizeof(pool_info));
-            pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-            pool_info.pNext = nullptr;
-            pool_info.flags = 0;
-            pool_info.maxSets = DESCRIPTOR_POOL_SIZE_MAX;
-            pool_info.poolSizeCount = (uint32_t) pool_sizes.Size();
-            pool_info.pPoolSizes = &pool_sizes[0];
+                // keep ranges sorted by offset and merge neighbours
+                auto next = page.free_ranges.begin();
+                while (next != page.free_ranges.end() && next->offset < offset)
+                {
+                    ++next;
+                }
 
-            VkResult err = vkCreateDescriptorPool(m_device, &pool_info, nullptr, descriptor_pool);
-            assert(!err);
+                UniformRange range;
+                range.offset = offset;
+                range.size = size;
+
+                if (next != page.free_ranges.begin())
+                {
+                    auto prev = next;
+                    --prev;
+                    if (prev->offset + prev->size == offset)
+                    {
+                        range.offset = prev->offset;
+                        range.size += prev->size;
+                        page.free_ranges.Remove(prev);
+                    }
+                }
+                if (next != page.free_ranges.end() && offset + size == next->offset)
+                {
+                    range.size += next->size;
+                    next = page.free_ranges.Remove(next);
+                }
+                page.free_ranges.AddBefore(next, range);
+                break;
+            }
+
+            m_uniform_mutex.unlock();
         }
 
-        void CreateDescriptorSets(
-            const Vector<UniformSet>& uniform_sets,
-            VkDescriptorPool descriptor_pool,
-            const Vector<VkDescriptorSetLayout>& descriptor_layouts,
-            Vector<VkDescriptorSet>& descriptor_sets)
-        {
-            VkDescriptorSetAllocateInfo desc_info;
-            desc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            desc_info.pNext = nullptr;
-            desc_info.descriptorPool = descriptor_pool;
-            desc_info.descriptorSetCount = descriptor_layouts.Size();
-            desc_info.pSetLayouts = &descriptor_layouts[0];
-
-            descriptor_sets.Resize(descriptor_layouts.Size());
-            VkResult err = vkAllocateDescriptorSets(m_device, &desc_info, &descriptor_sets[0]);
-            assert(!err);
+        void DestroyUniformPages()
+        {
+            for (int i = 0; i < m_uniform_pages.Size(); ++i)
+            {
+                m_uniform_pages[i].buffer->Destroy(m_device);
+            }
+            m_uniform_pages.Clear();
         }
 
         void CreateUniformBuffer(VkDescriptorSet descriptor_set, UniformBuffer& buffer)
         {
             assert(!buffer.buffer);
-            buffer.buffer = this->CreateBuffer(nullptr, buffer.size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+            this->AllocUniformRange(buffer.size, buffer.buffer, &buffer.offset);
+
+            if (descriptor_set != VK_NULL_HANDLE)
+            {
+                this->BindUniformBuffer(descriptor_set, buffer);
+            }
+        }
 
+        void BindUniformBuffer(VkDescriptorSet descriptor_set, const UniformBuffer& buffer)
+        {
             VkDescriptorBufferInfo buffer_info;
             buffer_info.buffer = buffer.buffer->GetBuffer();
             buffer_info.offset = 0;
@@ -2090,7 +3665,7 @@ namespace Viry3D
             desc_write.dstBinding = buffer.binding;
             desc_write.dstArrayElement = 0;
             desc_write.descriptorCount = 1;
-            desc_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            desc_write.descriptorType = buffer.storage ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             desc_write.pImageInfo = nullptr;
             desc_write.pBufferInfo = &buffer_info;
             desc_write.pTexelBufferView = nullptr;
@@ -2098,6 +3673,16 @@ namespace Viry3D
             vkUpdateDescriptorSets(m_device, 1, &desc_write, 0, nullptr);
         }
 
+        void DestroyUniformBuffer(UniformBuffer& buffer)
+        {
+            if (buffer.buffer)
+            {
+                this->FreeUniformRange(buffer.buffer, buffer.offset, buffer.size);
+                buffer.buffer.reset();
+                buffer.offset = 0;
+            }
+        }
+
         void UpdateUniformTexture(VkDescriptorSet descriptor_set, int binding, const Ref<Texture>& texture)
         {
             VkDescriptorImageInfo image_info;
@@ -2127,12 +3712,17 @@ namespace Viry3D
             VkPipelineLayout pipeline_layout,
             VkPipeline pipeline,
             const Vector<VkDescriptorSet>& descriptor_sets,
+            const Vector<uint32_t>& dynamic_offsets,
             int image_width,
             int image_height,
             const Rect& view_rect,
             const Ref<BufferObject>& vertex_buffer,
             const Ref<BufferObject>& index_buffer,
-            const Ref<BufferObject>& draw_buffer)
+            const Ref<BufferObject>& draw_buffer,
+            int first_draw,
+            int draw_count,
+            const Ref<BufferObject>& instance_buffer,
+            const Vector<int>& first_instances)
         {
             VkCommandBufferInheritanceInfo inheritance_info;
             Memory::Zero(&inheritance_info, sizeof(inheritance_info));
@@ -2156,7 +3746,12 @@ namespace Viry3D
             assert(!err);
 
             vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, descriptor_sets.Size(), &descriptor_sets[0], 0, nullptr);
+            vkCmdBindDescriptorSets(
+                cmd,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                pipeline_layout,
+                0, descriptor_sets.Size(), &descriptor_sets[0],
+                dynamic_offsets.Size(), dynamic_offsets.Size() > 0 ? &dynamic_offsets[0] : nullptr);
 
             VkViewport viewport;
             Memory::Zero(&viewport, sizeof(viewport));
@@ -2179,7 +3774,29 @@ namespace Viry3D
             VkDeviceSize offset = 0;
             vkCmdBindVertexBuffers(cmd, 0, 1, &vertex_buffer->GetBuffer(), &offset);
             vkCmdBindIndexBuffer(cmd, index_buffer->GetBuffer(), 0, VK_INDEX_TYPE_UINT16);
-            vkCmdDrawIndexedIndirect(cmd, draw_buffer->GetBuffer(), 0, 1, 0);
+
+            uint32_t draw_stride = sizeof(VkDrawIndexedIndirectCommand);
+            if (m_multi_draw_indirect)
+            {
+                if (instance_buffer)
+                {
+                    vkCmdBindVertexBuffers(cmd, 1, 1, &instance_buffer->GetBuffer(), &offset);
+                }
+                vkCmdDrawIndexedIndirect(cmd, draw_buffer->GetBuffer(), first_draw * draw_stride, draw_count, draw_stride);
+            }
+            else
+            {
+                // without first instance support each draw rebinds the instance stream at its first instance
+                for (int i = 0; i < draw_count; ++i)
+                {
+                    if (instance_buffer)
+                    {
+                        VkDeviceSize instance_offset = first_instances[i] * sizeof(Matrix4x4);
+                        vkCmdBindVertexBuffers(cmd, 1, 1, &instance_buffer->GetBuffer(), &instance_offset);
+                    }
+                    vkCmdDrawIndexedIndirect(cmd, draw_buffer->GetBuffer(), (first_draw + i) * draw_stride, 1, draw_stride);
+                }
+            }
 
             err = vkEndCommandBuffer(cmd);
             assert(!err);
@@ -2344,50 +3961,127 @@ namespace Viry3D
                 0, nullptr);
         }
 
-        void BuildPrimaryCmds()
+        // records dirty camera cmds of one swapchain image, cmds of other images stay dirty until they are acquired
+        void BuildPrimaryCmds(int swapchain_image_index, Vector<VkCommandBuffer>& cmds)
         {
-            m_cameras.Sort([](const Ref<Camera>& a, const Ref<Camera>& b) {
-                return a->GetDepth() < b->GetDepth();
-            });
+            if (m_camera_order_dirty)
+            {
+                m_camera_order_dirty = false;
 
-            for (int i = 0; i < m_swapchain_image_resources.Size(); ++i)
+                m_cameras.Sort([](const Ref<Camera>& a, const Ref<Camera>& b) {
+                    return a->GetDepth() < b->GetDepth();
+                });
+            }
+
+            SwapchainImageResources& image = m_swapchain_image_resources[swapchain_image_index];
+            bool fence_waited = false;
+
+            for (auto i : m_cameras)
             {
-                VkCommandBuffer cmd = m_swapchain_image_resources[i].cmd;
+                PrimaryCmd* primary;
+                if (!image.camera_cmds.TryGet(i.get(), &primary))
+                {
+                    image.camera_cmds.Add(i.get(), PrimaryCmd());
+                    image.camera_cmds.TryGet(i.get(), &primary);
+                }
 
-                this->BuildPrimaryCmdBegin(cmd);
+                if (primary->cmd == VK_NULL_HANDLE)
+                {
+                    this->CreateCommandBuffer(m_graphics_cmd_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &primary->cmd);
+                }
 
-                for (auto j : m_cameras)
+                if (primary->dirty)
                 {
+                    primary->dirty = false;
+
+                    // only the last submit of this image can still hold its cmds
+                    if (!fence_waited && image.submit_fence != VK_NULL_HANDLE)
+                    {
+                        VkResult err = vkWaitForFences(m_device, 1, &image.submit_fence, VK_TRUE, UINT64_MAX);
+                        assert(!err);
+                        fence_waited = true;
+                    }
+
+                    this->BuildPrimaryCmdBegin(primary->cmd);
                     this->BuildPrimaryCmd(
-                        cmd,
-                        i,
-                        j->GetInstanceCmds(),
-                        j->GetRenderPass(),
-                        j->GetFramebuffer(i),
-                        j->GetTargetWidth(),
-                        j->GetTargetHeight(),
-                        j->GetClearFlags(),
-                        j->GetClearColor(),
-						j->GetRenderTargetColor(),
-						j->GetRenderTargetDepth());
+                        primary->cmd,
+                        swapchain_image_index,
+                        i->GetInstanceCmds(),
+                        i->GetRenderPass(),
+                        i->GetFramebuffer(swapchain_image_index),
+                        i->GetTargetWidth(),
+                        i->GetTargetHeight(),
+                        i->GetClearFlags(),
+                        i->GetClearColor(),
+                        i->GetRenderTargetColor(),
+                        i->GetRenderTargetDepth());
+                    this->BuildPrimaryCmdEnd(primary->cmd);
+
+                    primary->build_count += 1;
+                    m_frame_stats.primary_cmd_build_count += 1;
+                    m_frame_stats.primary_cmd_build_count_total += 1;
+                }
+
+                cmds.Add(primary->cmd);
+            }
+        }
+
+        void MarkPrimaryCmdDirty(Camera* camera)
+        {
+            for (int i = 0; i < m_swapchain_image_resources.Size(); ++i)
+            {
+                PrimaryCmd* primary;
+                if (m_swapchain_image_resources[i].camera_cmds.TryGet(camera, &primary))
+                {
+                    primary->dirty = true;
+                }
+            }
+        }
+
+        void MarkPrimaryCmdDirty()
+        {
+            for (int i = 0; i < m_swapchain_image_resources.Size(); ++i)
+            {
+                for (auto& j : m_swapchain_image_resources[i].camera_cmds)
+                {
+                    j.second.dirty = true;
                 }
+            }
+        }
 
-                this->BuildPrimaryCmdEnd(cmd);
+        void DestroyPrimaryCmds(Camera* camera)
+        {
+            for (int i = 0; i < m_swapchain_image_resources.Size(); ++i)
+            {
+                PrimaryCmd* primary;
+                if (m_swapchain_image_resources[i].camera_cmds.TryGet(camera, &primary))
+                {
+                    if (primary->cmd)
+                    {
+                        VkCommandBuffer cmd = primary->cmd;
+                        this->RetireResource([=]() {
+                            vkFreeCommandBuffers(m_device, m_graphics_cmd_pool, 1, &cmd);
+                        });
+                    }
+                    m_swapchain_image_resources[i].camera_cmds.Remove(camera);
+                }
             }
         }
 
         void Update()
         {
+            // batched world transforms must be final before renderers read them
+            TransformHierarchy::UpdateAll();
+
             for (auto i : m_cameras)
             {
                 i->Update();
             }
 
-            if (m_primary_cmd_dirty)
+            // secondary cmds of all cameras are recorded on workers, join them before primary cmds reference them
+            for (auto i : m_cameras)
             {
-                m_primary_cmd_dirty = false;
-
-                this->BuildPrimaryCmds();
+                i->WaitInstanceCmds();
             }
         }
 
@@ -2422,46 +4116,94 @@ namespace Viry3D
                 return;
             }
 
-            // wait for previous frame draw complete
-            VkResult err = vkWaitForFences(m_device, 1, &m_draw_complete_fence, VK_TRUE, UINT64_MAX);
-            assert(!err);
-            err = vkResetFences(m_device, 1, &m_draw_complete_fence);
-            assert(!err);
+            // fence of this frame slot was waited in BeginFrame, previous frames may still be in flight
+            FrameResources& frame = m_frames[m_frame_index];
+            float cpu_begin = Time::GetRealTimeSinceStartup();
+            m_frame_stats.primary_cmd_build_count = 0;
 
             this->Update();
 
-            err = fpAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_image_acquired_semaphore, VK_NULL_HANDLE, (uint32_t*) &m_image_index);
+            float acquire_begin = Time::GetRealTimeSinceStartup();
+            VkResult err = fpAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, frame.image_acquired_semaphore, VK_NULL_HANDLE, (uint32_t*) &m_image_index);
             assert(!err);
+            m_frame_stats.acquire_wait_ms = (Time::GetRealTimeSinceStartup() - acquire_begin) * 1000;
+
+            Vector<VkSemaphore> wait_semaphores;
+            Vector<VkPipelineStageFlags> wait_stages;
+            wait_semaphores.Add(frame.image_acquired_semaphore);
+            wait_stages.Add(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+            // static buffer uploads must land before vertex input
+            VkSemaphore upload_semaphore = this->FlushStagingUploads();
+            if (upload_semaphore != VK_NULL_HANDLE)
+            {
+                wait_semaphores.Add(upload_semaphore);
+                wait_stages.Add(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+            }
+
+            // texture uploads must land before sampling
+            int image_wait_begin = wait_semaphores.Size();
+            this->FlushImageCmds(wait_semaphores);
+            for (int i = image_wait_begin; i < wait_semaphores.Size(); ++i)
+            {
+                wait_stages.Add(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+            }
+
+            // buffer updates of this frame are copied before the draw cmd
+            Vector<VkCommandBuffer> cmds;
+            m_frame_copy_mutex.lock();
+            if (this->BuildFrameCopyCmd(frame))
+            {
+                cmds.Add(frame.copy_cmd);
+            }
+            m_frame_copy_mutex.unlock();
+
+            this->BuildPrimaryCmds(m_image_index, cmds);
 
-            VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
             VkSubmitInfo submit_info;
             Memory::Zero(&submit_info, sizeof(submit_info));
             submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
             submit_info.pNext = nullptr;
-            submit_info.waitSemaphoreCount = 1;
-            submit_info.pWaitSemaphores = &m_image_acquired_semaphore;
-            submit_info.pWaitDstStageMask = &pipe_stage_flags;
-            submit_info.commandBufferCount = 1;
-            submit_info.pCommandBuffers = &m_swapchain_image_resources[m_image_index].cmd;
+            submit_info.waitSemaphoreCount = wait_semaphores.Size();
+            submit_info.pWaitSemaphores = &wait_semaphores[0];
+            submit_info.pWaitDstStageMask = &wait_stages[0];
+            submit_info.commandBufferCount = cmds.Size();
+            submit_info.pCommandBuffers = &cmds[0];
             submit_info.signalSemaphoreCount = 1;
-            submit_info.pSignalSemaphores = &m_draw_complete_semaphore;
+            submit_info.pSignalSemaphores = &frame.draw_complete_semaphore;
 
-            err = vkQueueSubmit(m_graphics_queue, 1, &submit_info, m_draw_complete_fence);
+            // reset just before submit, so WaitFramesInFlight never waits on an unsignaled fence
+            err = vkResetFences(m_device, 1, &frame.draw_complete_fence);
             assert(!err);
 
+            m_graphics_queue_mutex.lock();
+            err = vkQueueSubmit(m_graphics_queue, 1, &submit_info, frame.draw_complete_fence);
+            m_graphics_queue_mutex.unlock();
+            assert(!err);
+            m_swapchain_image_resources[m_image_index].submit_fence = frame.draw_complete_fence;
+            frame.submit_frame = m_frame_stats.frame_count;
+
             VkPresentInfoKHR present_info;
             Memory::Zero(&present_info, sizeof(present_info));
             present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
             present_info.pNext = nullptr;
             present_info.waitSemaphoreCount = 1;
-            present_info.pWaitSemaphores = &m_draw_complete_semaphore;
+            present_info.pWaitSemaphores = &frame.draw_complete_semaphore;
             present_info.swapchainCount = 1;
             present_info.pSwapchains = &m_swapchain;
             present_info.pImageIndices = (uint32_t*) &m_image_index;
             present_info.pResults = nullptr;
 
+            m_graphics_queue_mutex.lock();
             err = fpQueuePresentKHR(m_graphics_queue, &present_info);
+            m_graphics_queue_mutex.unlock();
             assert(!err);
+
+            m_frame_stats.cpu_frame_ms = (Time::GetRealTimeSinceStartup() - cpu_begin) * 1000;
+            m_frame_stats.frame_count += 1;
+
+            m_frame_index = (m_frame_index + 1) % m_frames_in_flight;
+            this->BeginFrame();
         }
 
         void CreateBlitShader()
@@ -2552,8 +4294,9 @@ void main()
         m_private->CreateSurface();
         m_private->CreateDevice();
         m_private->GetQueues();
-        m_private->CreateSignals();
         m_private->CreateImageCmd();
+        m_private->CreateStagingResources();
+        m_private->CreateFrameResources();
         m_private->CreateSizeDependentResources();
     }
 
@@ -2605,13 +4348,67 @@ void main()
     void Display::WaitDevice() const
     {
         vkDeviceWaitIdle(m_private->m_device);
+        m_private->m_completed_frame = m_private->m_frame_stats.frame_count - 1;
+        m_private->FreeRetiredResources(false);
+    }
+
+    int Display::GetFrameCount() const
+    {
+        return m_private->m_frame_stats.frame_count;
+    }
+
+    bool Display::IsFrameComplete(int frame) const
+    {
+        return frame <= m_private->m_completed_frame;
+    }
+
+    void Display::RetireResource(const std::function<void()>& destroy)
+    {
+        m_private->RetireResource(destroy);
+    }
+
+    void Display::RetireBuffer(const Ref<BufferObject>& buffer)
+    {
+        m_private->RetireResource([=]() {
+            buffer->Destroy(m_private->m_device);
+        });
+    }
+
+    void Display::FreeMemory(MemoryAllocation& memory)
+    {
+        m_private->m_memory_allocator->Free(memory);
+    }
+
+    MemoryStats Display::GetMemoryStats() const
+    {
+        return m_private->m_memory_allocator->GetStats();
+    }
+
+    void Display::SetFramesInFlight(int count)
+    {
+        m_private->SetFramesInFlight(count);
+    }
+
+    int Display::GetFramesInFlight() const
+    {
+        return m_private->m_frames_in_flight;
+    }
+
+    void Display::WaitFramesInFlight()
+    {
+        m_private->WaitFramesInFlight();
+    }
+
+    const FramePacingStats& Display::GetFramePacingStats() const
+    {
+        return m_private->m_frame_stats;
     }
 
     Camera* Display::CreateCamera()
     {
         Ref<Camera> camera = RefMake<Camera>();
         m_private->m_cameras.AddLast(camera);
-        this->MarkPrimaryCmdDirty();
+        this->MarkCameraOrderDirty();
         return camera.get();
     }
 
@@ -2655,22 +4452,101 @@ void main()
 
     void Display::DestroyCamera(Camera* camera)
     {
-        this->WaitDevice();
-
+        Ref<Camera> retired;
         for (const auto& i : m_private->m_cameras)
         {
             if (i.get() == camera)
             {
+                retired = i;
                 m_private->m_cameras.Remove(i);
                 break;
             }
         }
-        this->MarkPrimaryCmdDirty();
+        m_private->DestroyPrimaryCmds(camera);
+
+        // cmds, render pass and buffers of the camera may be used by frames in flight, the last ref goes with them
+        m_private->RetireResource([retired]() mutable {
+            retired.reset();
+        });
     }
 
     void Display::MarkPrimaryCmdDirty()
     {
-        m_private->m_primary_cmd_dirty = true;
+        m_private->MarkPrimaryCmdDirty();
+    }
+
+    void Display::MarkPrimaryCmdDirty(Camera* camera)
+    {
+        m_private->MarkPrimaryCmdDirty(camera);
+    }
+
+    void Display::MarkCameraOrderDirty()
+    {
+        m_private->m_camera_order_dirty = true;
+    }
+
+    int Display::GetPrimaryCmdBuildCount(Camera* camera, int swapchain_image_index) const
+    {
+        PrimaryCmd* primary;
+        if (m_private->m_swapchain_image_resources[swapchain_image_index].camera_cmds.TryGet(camera, &primary))
+        {
+            return primary->build_count;
+        }
+        return 0;
+    }
+
+    int Display::GetSwapchainImageCount() const
+    {
+        return m_private->m_swapchain_image_resources.Size();
+    }
+
+    bool RenderPassKey::operator ==(const RenderPassKey& key) const
+    {
+        return color_format == key.color_format &&
+            depth_format == key.depth_format &&
+            sample_count == key.sample_count;
+    }
+
+    bool RenderPassKey::operator <(const RenderPassKey& key) const
+    {
+        if (color_format != key.color_format)
+        {
+            return color_format < key.color_format;
+        }
+        if (depth_format != key.depth_format)
+        {
+            return depth_format < key.depth_format;
+        }
+        return sample_count < key.sample_count;
+    }
+
+    RenderPassKey Display::GetRenderPassKey(const Ref<Texture>& color_texture, const Ref<Texture>& depth_texture) const
+    {
+        RenderPassKey key;
+
+        if (color_texture || depth_texture)
+        {
+            if (color_texture)
+            {
+                key.color_format = color_texture->GetFormat();
+            }
+            if (depth_texture)
+            {
+                key.depth_format = depth_texture->GetFormat();
+            }
+        }
+        else
+        {
+            key.color_format = m_private->m_swapchain_image_resources[0].format;
+            key.depth_format = m_private->m_depth_texture->GetFormat();
+        }
+
+        return key;
+    }
+
+    VkRenderPass Display::GetCompatibleRenderPass(const RenderPassKey& key)
+    {
+        return m_private->GetCompatibleRenderPass(key);
     }
 
     void Display::CreateRenderPass(
@@ -2678,19 +4554,22 @@ void main()
         const Ref<Texture>& depth_texture,
         CameraClearFlags clear_flag,
         VkRenderPass* render_pass,
-        Vector<VkFramebuffer>& framebuffers)
+        Vector<VkFramebuffer>& framebuffers,
+        RenderPassKey* render_pass_key)
     {
         bool present = !(color_texture || depth_texture);
+        RenderPassKey key = this->GetRenderPassKey(color_texture, depth_texture);
+
+        m_private->CreateRenderPass(
+            key.color_format,
+            key.depth_format,
+            key.sample_count,
+            clear_flag,
+            present,
+            render_pass);
 
         if (present)
         {
-            m_private->CreateRenderPass(
-                m_private->m_swapchain_image_resources[0].format,
-                m_private->m_depth_texture->GetFormat(),
-                clear_flag,
-                true,
-                render_pass);
-
             framebuffers.Resize(m_private->m_swapchain_image_resources.Size());
             for (int i = 0; i < framebuffers.Size(); ++i)
             {
@@ -2707,8 +4586,6 @@ void main()
         }
         else
         {
-            VkFormat color_format = VK_FORMAT_UNDEFINED;
-            VkFormat depth_format = VK_FORMAT_UNDEFINED;
             VkImageView color_image_view = VK_NULL_HANDLE;
             VkImageView depth_image_view = VK_NULL_HANDLE;
             int image_width = 0;
@@ -2716,7 +4593,6 @@ void main()
 
             if (color_texture)
             {
-                color_format = color_texture->GetFormat();
                 color_image_view = color_texture->GetImageView();
                 image_width = color_texture->GetWidth();
                 image_height = color_texture->GetHeight();
@@ -2724,19 +4600,11 @@ void main()
 
             if (depth_texture)
             {
-                depth_format = depth_texture->GetFormat();
                 depth_image_view = depth_texture->GetImageView();
                 image_width = depth_texture->GetWidth();
                 image_height = depth_texture->GetHeight();
             }
 
-            m_private->CreateRenderPass(
-                color_format,
-                depth_format,
-                clear_flag,
-                false,
-                render_pass);
-
             framebuffers.Resize(1);
             m_private->CreateFramebuffer(
                 color_image_view,
@@ -2746,6 +4614,26 @@ void main()
                 *render_pass,
                 &framebuffers[0]);
         }
+
+        if (render_pass_key)
+        {
+            *render_pass_key = key;
+        }
+    }
+
+    bool Display::IsMultiDrawIndirectSupported() const
+    {
+        return m_private->m_multi_draw_indirect_supported;
+    }
+
+    void Display::SetMultiDrawIndirectEnable(bool enable)
+    {
+        m_private->m_multi_draw_indirect = enable && m_private->m_multi_draw_indirect_supported;
+    }
+
+    bool Display::IsMultiDrawIndirectEnable() const
+    {
+        return m_private->m_multi_draw_indirect;
     }
 
     void Display::CreateCommandPool(VkCommandPool* cmd_pool)
@@ -2767,7 +4655,8 @@ void main()
         const String& fs_source,
         VkShaderModule* vs_module,
         VkShaderModule* fs_module,
-        Vector<UniformSet>& uniform_sets)
+        Vector<UniformSet>& uniform_sets,
+        bool* instancing)
     {
         m_private->CreateShaderModule(
             vs_predefine,
@@ -2778,12 +4667,18 @@ void main()
             fs_source,
             vs_module,
             fs_module,
-            uniform_sets);
+            uniform_sets,
+            instancing);
     }
 
-    void Display::CreatePipelineCache(VkPipelineCache* pipeline_cache)
+    VkPipelineCache Display::GetPipelineCache()
     {
-        m_private->CreatePipelineCache(pipeline_cache);
+        return m_private->GetPipelineCache();
+    }
+
+    void Display::SavePipelineCache()
+    {
+        m_private->SavePipelineCache();
     }
 
     void Display::CreatePipelineLayout(
@@ -2803,7 +4698,8 @@ void main()
         VkPipelineCache pipeline_cache,
         VkPipeline* pipeline,
         bool color_attachment,
-        bool depth_attachment)
+        bool depth_attachment,
+        bool instancing)
     {
         m_private->CreatePipeline(
             render_pass,
@@ -2814,30 +4710,23 @@ void main()
             pipeline_cache,
             pipeline,
             color_attachment,
-            depth_attachment);
+            depth_attachment,
+            instancing);
     }
 
-    void Display::CreateDescriptorSetPool(const Vector<UniformSet>& uniform_sets, VkDescriptorPool* descriptor_pool)
+    void Display::CreateUniformBuffer(VkDescriptorSet descriptor_set, UniformBuffer& buffer)
     {
-        m_private->CreateDescriptorSetPool(uniform_sets, descriptor_pool);
+        m_private->CreateUniformBuffer(descriptor_set, buffer);
     }
 
-    void Display::CreateDescriptorSets(
-        const Vector<UniformSet>& uniform_sets,
-        VkDescriptorPool descriptor_pool,
-        const Vector<VkDescriptorSetLayout>& descriptor_layouts,
-        Vector<VkDescriptorSet>& descriptor_sets)
+    void Display::BindUniformBuffer(VkDescriptorSet descriptor_set, const UniformBuffer& buffer)
     {
-        m_private->CreateDescriptorSets(
-            uniform_sets,
-            descriptor_pool,
-            descriptor_layouts,
-            descriptor_sets);
+        m_private->BindUniformBuffer(descriptor_set, buffer);
     }
 
-    void Display::CreateUniformBuffer(VkDescriptorSet descriptor_set, UniformBuffer& buffer)
+    void Display::DestroyUniformBuffer(UniformBuffer& buffer)
     {
-        m_private->CreateUniformBuffer(descriptor_set, buffer);
+        m_private->DestroyUniformBuffer(buffer);
     }
 
     void Display::UpdateUniformTexture(VkDescriptorSet descriptor_set, int binding, const Ref<Texture>& texture)
@@ -2845,9 +4734,9 @@ void main()
         m_private->UpdateUniformTexture(descriptor_set, binding, texture);
     }
 
-    Ref<BufferObject> Display::CreateBuffer(const void* data, int size, VkBufferUsageFlags usage)
+    Ref<BufferObject> Display::CreateBuffer(const void* data, int size, VkBufferUsageFlags usage, bool device_local)
     {
-        return m_private->CreateBuffer(data, size, usage);
+        return m_private->CreateBuffer(data, size, usage, device_local);
     }
 
     void Display::UpdateBuffer(const Ref<BufferObject>& buffer, int buffer_offset, const void* data, int size)
@@ -2855,6 +4744,11 @@ void main()
         m_private->UpdateBuffer(buffer, buffer_offset, data, size);
     }
 
+    void* Display::MapBufferUpdate(const Ref<BufferObject>& buffer, int buffer_offset, int size)
+    {
+        return m_private->MapBufferUpdate(buffer, buffer_offset, size);
+    }
+
     void Display::ReadBuffer(const Ref<BufferObject>& buffer, ByteBuffer& data)
     {
         m_private->ReadBuffer(buffer, data);
@@ -2866,12 +4760,17 @@ void main()
         VkPipelineLayout pipeline_layout,
         VkPipeline pipeline,
         const Vector<VkDescriptorSet>& descriptor_sets,
+        const Vector<uint32_t>& dynamic_offsets,
         int image_width,
         int image_height,
         const Rect& view_rect,
         const Ref<BufferObject>& vertex_buffer,
         const Ref<BufferObject>& index_buffer,
-        const Ref<BufferObject>& draw_buffer)
+        const Ref<BufferObject>& draw_buffer,
+        int first_draw,
+        int draw_count,
+        const Ref<BufferObject>& instance_buffer,
+        const Vector<int>& first_instances)
     {
         m_private->BuildInstanceCmd(
             cmd,
@@ -2879,12 +4778,17 @@ void main()
             pipeline_layout,
             pipeline,
             descriptor_sets,
+            dynamic_offsets,
             image_width,
             image_height,
             view_rect,
             vertex_buffer,
             index_buffer,
-            draw_buffer);
+            draw_buffer,
+            first_draw,
+            draw_count,
+            instance_buffer,
+            first_instances);
     }
 
 	void Display::BuildEmptyInstanceCmd(VkCommandBuffer cmd, VkRenderPass render_pass)
@@ -2937,9 +4841,29 @@ void main()
         m_private->BeginImageCmd();
     }
 
-    void Display::EndImageCmd()
+    UploadToken Display::EndImageCmd()
+    {
+        return m_private->EndImageCmd();
+    }
+
+    void* Display::MapImageStaging(int size, Ref<BufferObject>& buffer, int* offset)
+    {
+        return m_private->MapImageStaging(size, buffer, offset);
+    }
+
+    void Display::DestroyBufferAfterImageCmd(const Ref<BufferObject>& buffer)
+    {
+        m_private->DestroyBufferAfterImageCmd(buffer);
+    }
+
+    bool Display::IsUploadDone(UploadToken token)
+    {
+        return m_private->IsUploadDone(token);
+    }
+
+    void Display::WaitUpload(UploadToken token)
     {
-        m_private->EndImageCmd();
+        m_private->WaitUpload(token);
     }
 
     void Display::SetImageLayout(
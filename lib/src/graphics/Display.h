@@ -24,6 +24,7 @@
 #include "string/String.h"
 #include "math/Rect.h"
 #include "UniformSet.h"
+#include <functional>
 
 namespace Viry3D
 {
@@ -33,6 +34,42 @@ namespace Viry3D
     struct RenderState;
     class BufferObject;
     class DisplayPrivate;
+    struct MemoryAllocation;
+    struct MemoryStats;
+
+    // completion token of image cmds, tokens complete in increasing order
+    typedef uint64_t UploadToken;
+
+    struct FramePacingStats
+    {
+        int frames_in_flight = 0;
+        int frame_count = 0;
+        // frames begun while the gpu still had other frames queued
+        int overlapped_frame_count = 0;
+        // frames where the cpu blocked on the frame slot fence
+        int cpu_stall_frame_count = 0;
+        int gpu_pending_frames = 0;
+        float fence_wait_ms = 0;
+        float fence_wait_ms_total = 0;
+        float acquire_wait_ms = 0;
+        float cpu_frame_ms = 0;
+        // primary cmds re-recorded, one per dirty camera of the acquired swapchain image
+        int primary_cmd_build_count = 0;
+        int primary_cmd_build_count_total = 0;
+    };
+
+    // attachment config deciding render pass compatibility,
+    // pipelines built for one pass are reused by every pass with an equal key
+    struct RenderPassKey
+    {
+        VkFormat color_format = VK_FORMAT_UNDEFINED;
+        VkFormat depth_format = VK_FORMAT_UNDEFINED;
+        VkSampleCountFlagBits sample_count = VK_SAMPLE_COUNT_1_BIT;
+
+        bool operator ==(const RenderPassKey& key) const;
+        // ordered map key
+        bool operator <(const RenderPassKey& key) const;
+    };
 
     class Display
     {
@@ -48,16 +85,44 @@ namespace Viry3D
         int GetHeight() const;
         VkDevice GetDevice() const;
         void WaitDevice() const;
+        void FreeMemory(MemoryAllocation& memory);
+        MemoryStats GetMemoryStats() const;
+        void SetFramesInFlight(int count);
+        int GetFramesInFlight() const;
+        void WaitFramesInFlight();
+        // count of submitted frames, also the frame count of the frame being built
+        int GetFrameCount() const;
+        // gpu finished the submit of that frame count, checked at every frame begin without blocking
+        bool IsFrameComplete(int frame) const;
+        // runs destroy once every frame submitted so far has completed, instead of waiting for the device
+        void RetireResource(const std::function<void()>& destroy);
+        void RetireBuffer(const Ref<BufferObject>& buffer);
+        const FramePacingStats& GetFramePacingStats() const;
         Camera* CreateCamera();
         Camera* CreateBlitCamera(int depth, const Ref<Texture>& texture, const Ref<Material>& material = Ref<Material>(), const String& texture_name = "", CameraClearFlags clear_flags = CameraClearFlags::Invalidate, const Rect& rect = Rect(0, 0, 1, 1));
         void DestroyCamera(Camera* camera);
+        // invalidates the primary cmds of every camera
         void MarkPrimaryCmdDirty();
+        // invalidates only the primary cmds of the camera, each swapchain image rebuilds its own when acquired
+        void MarkPrimaryCmdDirty(Camera* camera);
+        // camera order only changes submit order, no cmd is rebuilt
+        void MarkCameraOrderDirty();
+        int GetPrimaryCmdBuildCount(Camera* camera, int swapchain_image_index) const;
+        int GetSwapchainImageCount() const;
         void CreateRenderPass(
             const Ref<Texture>& color_texture,
             const Ref<Texture>& depth_texture,
             CameraClearFlags clear_flag,
             VkRenderPass* render_pass,
-            Vector<VkFramebuffer>& framebuffers);
+            Vector<VkFramebuffer>& framebuffers,
+            RenderPassKey* render_pass_key = nullptr);
+        RenderPassKey GetRenderPassKey(const Ref<Texture>& color_texture, const Ref<Texture>& depth_texture) const;
+        VkRenderPass GetCompatibleRenderPass(const RenderPassKey& key);
+        // multi draw indirect with non zero first instance
+        bool IsMultiDrawIndirectSupported() const;
+        // off issues one draw per instance batch even when supported, cameras must rebuild their batches after a change
+        void SetMultiDrawIndirectEnable(bool enable);
+        bool IsMultiDrawIndirectEnable() const;
         void CreateCommandPool(VkCommandPool* cmd_pool);
         void CreateCommandBuffer(VkCommandPool cmd_pool, VkCommandBufferLevel level, VkCommandBuffer* cmd);
         void CreateShaderModule(
@@ -69,8 +134,11 @@ namespace Viry3D
             const String& fs_source,
             VkShaderModule* vs_module,
             VkShaderModule* fs_module,
-            Vector<UniformSet>& uniform_sets);
-        void CreatePipelineCache(VkPipelineCache* pipeline_cache);
+            Vector<UniformSet>& uniform_sets,
+            bool* instancing);
+        VkPipelineCache GetPipelineCache();
+        // also saves the compiled shader stages
+        void SavePipelineCache();
         void CreatePipelineLayout(
             const Vector<UniformSet>& uniform_sets,
             Vector<VkDescriptorSetLayout>& descriptor_layouts,
@@ -84,17 +152,19 @@ namespace Viry3D
             VkPipelineCache pipeline_cache,
             VkPipeline* pipeline,
             bool color_attachment,
-            bool depth_attachment);
-        void CreateDescriptorSetPool(const Vector<UniformSet>& uniform_sets, VkDescriptorPool* descriptor_pool);
-        void CreateDescriptorSets(
-            const Vector<UniformSet>& uniform_sets,
-            VkDescriptorPool descriptor_pool,
-            const Vector<VkDescriptorSetLayout>& descriptor_layouts,
-            Vector<VkDescriptorSet>& descriptor_sets);
+            bool depth_attachment,
+            bool instancing);
+        // a null descriptor set only allocates the block, other sets can bind it with BindUniformBuffer
         void CreateUniformBuffer(VkDescriptorSet descriptor_set, UniformBuffer& buffer);
+        // the set must not be bound by a frame in flight
+        void BindUniformBuffer(VkDescriptorSet descriptor_set, const UniformBuffer& buffer);
+        void DestroyUniformBuffer(UniformBuffer& buffer);
+        // the set must not be bound by a frame in flight
         void UpdateUniformTexture(VkDescriptorSet descriptor_set, int binding, const Ref<Texture>& texture);
-        Ref<BufferObject> CreateBuffer(const void* data, int size, VkBufferUsageFlags usage);
+        Ref<BufferObject> CreateBuffer(const void* data, int size, VkBufferUsageFlags usage, bool device_local = false);
         void UpdateBuffer(const Ref<BufferObject>& buffer, int buffer_offset, const void* data, int size);
+        // memory to write the range to directly, it reaches the buffer before this frame draws
+        void* MapBufferUpdate(const Ref<BufferObject>& buffer, int buffer_offset, int size);
         void ReadBuffer(const Ref<BufferObject>& buffer, ByteBuffer& data);
         void BuildInstanceCmd(
             VkCommandBuffer cmd,
@@ -102,12 +172,17 @@ namespace Viry3D
             VkPipelineLayout pipeline_layout,
             VkPipeline pipeline,
             const Vector<VkDescriptorSet>& descriptor_sets,
+            const Vector<uint32_t>& dynamic_offsets,
             int image_width,
             int image_height,
             const Rect& view_rect,
             const Ref<BufferObject>& vertex_buffer,
             const Ref<BufferObject>& index_buffer,
-            const Ref<BufferObject>& draw_buffer);
+            const Ref<BufferObject>& draw_buffer,
+            int first_draw = 0,
+            int draw_count = 1,
+            const Ref<BufferObject>& instance_buffer = Ref<BufferObject>(),
+            const Vector<int>& first_instances = Vector<int>());
 		void BuildEmptyInstanceCmd(VkCommandBuffer cmd, VkRenderPass render_pass);
         VkFormat ChooseFormatSupported(const Vector<VkFormat>& formats, VkFormatFeatureFlags features);
         Ref<Texture> CreateTexture(
@@ -127,7 +202,12 @@ namespace Viry3D
             VkFilter filter_mode,
             VkSamplerAddressMode wrap_mode);
         void BeginImageCmd();
-        void EndImageCmd();
+        UploadToken EndImageCmd();
+        // call between BeginImageCmd and EndImageCmd, staging memory released when the image cmds complete
+        void* MapImageStaging(int size, Ref<BufferObject>& buffer, int* offset);
+        void DestroyBufferAfterImageCmd(const Ref<BufferObject>& buffer);
+        bool IsUploadDone(UploadToken token);
+        void WaitUpload(UploadToken token);
         void SetImageLayout(
             VkImage image,
 			VkPipelineStageFlags src_stage,
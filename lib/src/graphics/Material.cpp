@@ -20,6 +20,7 @@
 #include "Renderer.h"
 #include "BufferObject.h"
 #include "Light.h"
+#include "Debug.h"
 
 namespace Viry3D
 {
@@ -27,6 +28,7 @@ namespace Viry3D
         m_shader(shader)
     {
         m_shader->CreateDescriptorSets(m_descriptor_sets, m_uniform_sets);
+        this->CreateUniformBuffers();
     }
 
     Material::~Material()
@@ -36,22 +38,38 @@ namespace Viry3D
 
     void Material::Release()
     {
-        VkDevice device = Display::Instance()->GetDevice();
-
+        m_shader->FreeDescriptorSets(m_descriptor_sets);
         m_descriptor_sets.Clear();
 
         for (int i = 0; i < m_uniform_sets.Size(); ++i)
         {
             for (int j = 0; j < m_uniform_sets[i].buffers.Size(); ++j)
             {
-                if (m_uniform_sets[i].buffers[j].buffer)
+                Display::Instance()->DestroyUniformBuffer(m_uniform_sets[i].buffers[j]);
+            }
+        }
+        m_uniform_sets.Clear();
+    }
+
+    void Material::CreateUniformBuffers()
+    {
+        for (int i = 0; i < m_uniform_sets.Size(); ++i)
+        {
+            for (int j = 0; j < m_uniform_sets[i].buffers.Size(); ++j)
+            {
+                auto& buffer = m_uniform_sets[i].buffers[j];
+                buffer.shared = false;
+
+                if (buffer.storage)
                 {
-                    m_uniform_sets[i].buffers[j].buffer->Destroy(device);
-                    m_uniform_sets[i].buffers[j].buffer.reset();
+                    continue;
                 }
+
+                Display::Instance()->CreateUniformBuffer(m_descriptor_sets[i], buffer);
+                buffer.data = Vector<byte>(buffer.size, 0);
+                buffer.dirty = true;
             }
         }
-        m_uniform_sets.Clear();
     }
     
     void Material::SetShader(const Ref<Shader>& shader)
@@ -60,6 +78,13 @@ namespace Viry3D
 
         m_shader = shader;
         m_shader->CreateDescriptorSets(m_descriptor_sets, m_uniform_sets);
+        this->CreateUniformBuffers();
+
+        // the new blocks are written from the property values
+        for (auto& i : m_properties)
+        {
+            i.dirty = true;
+        }
 
         this->MarkInstanceCmdDirty();
     }
@@ -93,70 +118,111 @@ namespace Viry3D
 
     const Matrix4x4* Material::GetMatrix(const String& name) const
     {
-        return this->GetProperty<Matrix4x4>(name, MaterialProperty::Type::Matrix);
+        return this->GetMatrix(Shader::PropertyToID(name));
     }
 
     void Material::SetMatrix(const String& name, const Matrix4x4& value)
     {
-        this->SetProperty(name, value, MaterialProperty::Type::Matrix);
+        this->SetMatrix(Shader::PropertyToID(name), value);
     }
 
     void Material::SetVector(const String& name, const Vector4& value)
     {
-        this->SetProperty(name, value, MaterialProperty::Type::Vector);
+        this->SetVector(Shader::PropertyToID(name), value);
     }
 
     void Material::SetColor(const String& name, const Color& value)
     {
-        this->SetProperty(name, value, MaterialProperty::Type::Color);
+        this->SetColor(Shader::PropertyToID(name), value);
     }
 
     void Material::SetFloat(const String& name, float value)
     {
-        this->SetProperty(name, value, MaterialProperty::Type::Float);
+        this->SetFloat(Shader::PropertyToID(name), value);
     }
 
     void Material::SetInt(const String& name, int value)
     {
-        this->SetProperty(name, value, MaterialProperty::Type::Int);
+        this->SetInt(Shader::PropertyToID(name), value);
     }
 
     void Material::SetTexture(const String& name, const Ref<Texture>& texture)
     {
-        MaterialProperty* property_ptr;
-        if (m_properties.TryGet(name, &property_ptr))
-        {
-            property_ptr->texture = texture;
-            property_ptr->dirty = true;
-        }
-        else
-        {
-            MaterialProperty property;
-            property.name = name;
-            property.type = MaterialProperty::Type::Texture;
-            property.texture = texture;
-            property.dirty = true;
-            m_properties.Add(name, property);
-        }
+        this->SetTexture(Shader::PropertyToID(name), texture);
     }
 
     void Material::SetVectorArray(const String& name, const Vector<Vector4>& array)
     {
-        MaterialProperty* property_ptr;
-        if (m_properties.TryGet(name, &property_ptr))
+        this->SetVectorArray(Shader::PropertyToID(name), array);
+    }
+
+    MaterialProperty* Material::AddProperty(int id, MaterialProperty::Type type)
+    {
+        if (id >= m_property_indices.Size())
         {
-            property_ptr->vector_array = array;
-            property_ptr->dirty = true;
+            m_property_indices.Resize(id + 1, -1);
         }
-        else
+
+        int index = m_property_indices[id];
+        if (index < 0)
         {
+            index = m_properties.Size();
+            m_property_indices[id] = index;
+
             MaterialProperty property;
-            property.name = name;
-            property.type = MaterialProperty::Type::VectorArray;
-            property.vector_array = array;
-            property.dirty = true;
-            m_properties.Add(name, property);
+            property.id = id;
+            property.size = 0;
+            m_properties.Add(property);
         }
+
+        MaterialProperty* property_ptr = &m_properties[index];
+        property_ptr->type = type;
+
+        return property_ptr;
+    }
+
+    const Matrix4x4* Material::GetMatrix(int id) const
+    {
+        return this->GetProperty<Matrix4x4>(id, MaterialProperty::Type::Matrix);
+    }
+
+    void Material::SetMatrix(int id, const Matrix4x4& value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Matrix);
+    }
+
+    void Material::SetVector(int id, const Vector4& value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Vector);
+    }
+
+    void Material::SetColor(int id, const Color& value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Color);
+    }
+
+    void Material::SetFloat(int id, float value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Float);
+    }
+
+    void Material::SetInt(int id, int value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Int);
+    }
+
+    void Material::SetTexture(int id, const Ref<Texture>& texture)
+    {
+        MaterialProperty* property_ptr = this->AddProperty(id, MaterialProperty::Type::Texture);
+        property_ptr->texture = texture;
+        property_ptr->dirty = true;
+    }
+
+    void Material::SetVectorArray(int id, const Vector<Vector4>& array)
+    {
+        MaterialProperty* property_ptr = this->AddProperty(id, MaterialProperty::Type::VectorArray);
+        property_ptr->vector_array = array;
+        property_ptr->dirty = true;
     }
 
     void Material::SetLightProperties(const Ref<Light>& light)
@@ -177,112 +243,130 @@ namespace Viry3D
     void Material::UpdateUniformSets()
     {
         bool instance_cmd_dirty = false;
+        Vector<int> texture_sets_dirty(m_descriptor_sets.Size(), 0);
 
         for (auto& i : m_properties)
         {
-            if (i.second.dirty)
+            if (i.dirty)
             {
-                i.second.dirty = false;
+                i.dirty = false;
 
-                if (i.second.type == MaterialProperty::Type::Texture)
+                if (i.type == MaterialProperty::Type::Texture)
                 {
-                    this->UpdateUniformTexture(i.second.name, i.second.texture, instance_cmd_dirty);
+                    int set_index = this->FindUniformSetIndex(i.id);
+                    if (set_index >= 0)
+                    {
+                        texture_sets_dirty[set_index] = 1;
+                    }
                 }
-                else if (i.second.type == MaterialProperty::Type::VectorArray)
+                else if (i.type == MaterialProperty::Type::VectorArray)
                 {
-                    this->UpdateUniformMember(i.second.name, i.second.vector_array.Bytes(), i.second.vector_array.SizeInBytes(), instance_cmd_dirty);
+                    this->UpdateUniformMember(i.id, i.vector_array.Bytes(), i.vector_array.SizeInBytes());
                 }
                 else
                 {
-                    this->UpdateUniformMember(i.second.name, &i.second.data, i.second.size, instance_cmd_dirty);
+                    this->UpdateUniformMember(i.id, &i.data, i.size);
                 }
             }
         }
 
-        if (instance_cmd_dirty)
-        {
-            this->MarkInstanceCmdDirty();
-        }
-    }
-
-    int Material::FindUniformSetIndex(const String& name)
-    {
+        // one write per changed block
         for (int i = 0; i < m_uniform_sets.Size(); ++i)
         {
-            Vector<VkDescriptorSetLayoutBinding> layout_bindings;
-
             for (int j = 0; j < m_uniform_sets[i].buffers.Size(); ++j)
             {
-                const auto& buffer = m_uniform_sets[i].buffers[j];
+                auto& buffer = m_uniform_sets[i].buffers[j];
 
-                for (int k = 0; k < buffer.members.Size(); ++k)
+                if (buffer.dirty && !buffer.storage)
                 {
-                    const auto& member = buffer.members[k];
+                    buffer.dirty = false;
 
-                    if (member.name == name)
-                    {
-                        return i;
-                    }
+                    Display::Instance()->UpdateBuffer(buffer.buffer, buffer.offset, &buffer.data[0], buffer.size);
                 }
+            }
+        }
 
-                for (int j = 0; j < m_uniform_sets[i].textures.Size(); ++j)
-                {
-                    const auto& uniform_texture = m_uniform_sets[i].textures[j];
-
-                    if (uniform_texture.name == name)
-                    {
-                        return i;
-                    }
-                }
+        // one new set per set with changed textures
+        for (int i = 0; i < texture_sets_dirty.Size(); ++i)
+        {
+            if (texture_sets_dirty[i])
+            {
+                this->UpdateUniformTextures(i);
+                instance_cmd_dirty = true;
             }
         }
 
-        return -1;
+        if (instance_cmd_dirty)
+        {
+            this->MarkInstanceCmdDirty();
+        }
     }
 
-    void Material::UpdateUniformMember(const String& name, const void* data, int size, bool& instance_cmd_dirty)
+    void Material::GetDynamicOffsets(int set_index, Vector<uint32_t>& offsets) const
     {
-        for (int i = 0; i < m_uniform_sets.Size(); ++i)
+        const auto& buffers = m_uniform_sets[set_index].buffers;
+        for (int i = 0; i < buffers.Size(); ++i)
         {
-            for (int j = 0; j < m_uniform_sets[i].buffers.Size(); ++j)
-            {
-                auto& buffer = m_uniform_sets[i].buffers[j];
+            offsets.Add((uint32_t) buffers[i].offset);
+        }
+    }
 
-                for (int k = 0; k < buffer.members.Size(); ++k)
-                {
-                    const auto& member = buffer.members[k];
+    int Material::FindUniformSetIndex(int id) const
+    {
+        const ShaderProperty* property = m_shader->GetProperty(id);
+        if (property)
+        {
+            return property->set_index;
+        }
 
-                    if (member.name == name && size <= member.size)
-                    {
-                        if (!buffer.buffer)
-                        {
-                            Display::Instance()->CreateUniformBuffer(m_descriptor_sets[i], buffer);
-                            instance_cmd_dirty = true;
-                        }
-                        Display::Instance()->UpdateBuffer(buffer.buffer, member.offset, data, size);
-                        return;
-                    }
-                }
+        return -1;
+    }
+
+    void Material::UpdateUniformMember(int id, const void* data, int size)
+    {
+        const ShaderProperty* property = m_shader->GetProperty(id);
+        if (property && property->buffer_index >= 0 && size <= property->size)
+        {
+            auto& buffer = m_uniform_sets[property->set_index].buffers[property->buffer_index];
+            if (!buffer.storage)
+            {
+                Memory::Copy(&buffer.data[property->offset], data, size);
+                buffer.dirty = true;
             }
         }
     }
 
-    void Material::UpdateUniformTexture(const String& name, const Ref<Texture>& texture, bool& instance_cmd_dirty)
+    void Material::UpdateUniformTextures(int set_index)
     {
-        for (int i = 0; i < m_uniform_sets.Size(); ++i)
+        // the old set may be bound by frames in flight, so the textures go to a new set and the old one is retired
+        VkDescriptorSet descriptor_set = m_shader->AllocDescriptorSet(set_index);
+
+        const auto& buffers = m_uniform_sets[set_index].buffers;
+        for (int i = 0; i < buffers.Size(); ++i)
         {
-            for (int j = 0; j < m_uniform_sets[i].textures.Size(); ++j)
+            if (buffers[i].buffer)
             {
-                const auto& uniform_texture = m_uniform_sets[i].textures[j];
+                Display::Instance()->BindUniformBuffer(descriptor_set, buffers[i]);
+            }
+        }
 
-                if (uniform_texture.name == name)
-                {
-                    Display::Instance()->UpdateUniformTexture(m_descriptor_sets[i], uniform_texture.binding, texture);
-                    instance_cmd_dirty = true;
-                    return;
-                }
+        for (const auto& i : m_properties)
+        {
+            if (i.type != MaterialProperty::Type::Texture || !i.texture)
+            {
+                continue;
+            }
+
+            const ShaderProperty* property = m_shader->GetProperty(i.id);
+            if (property && property->set_index == set_index && property->texture_index >= 0)
+            {
+                const auto& uniform_texture = m_uniform_sets[set_index].textures[property->texture_index];
+                Display::Instance()->UpdateUniformTexture(descriptor_set, uniform_texture.binding, i.texture);
             }
         }
+
+        m_shader->FreeDescriptorSet(set_index, m_descriptor_sets[set_index]);
+        m_descriptor_sets[set_index] = descriptor_set;
     }
 
     void Material::MarkRendererOrderDirty()
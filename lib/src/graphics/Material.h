@@ -65,7 +65,7 @@ namespace Viry3D
             int int_value;
         };
 
-        String name;
+        int id;
         Type type;
         Data data;
         Ref<Texture> texture;
@@ -94,50 +94,56 @@ namespace Viry3D
         void SetInt(const String& name, int value);
         void SetTexture(const String& name, const Ref<Texture>& texture);
         void SetVectorArray(const String& name, const Vector<Vector4>& array);
+        // id overloads take ids from Shader::PropertyToID and do not look up names
+        const Matrix4x4* GetMatrix(int id) const;
+        void SetMatrix(int id, const Matrix4x4& value);
+        void SetVector(int id, const Vector4& value);
+        void SetColor(int id, const Color& value);
+        void SetFloat(int id, float value);
+        void SetInt(int id, int value);
+        void SetTexture(int id, const Ref<Texture>& texture);
+        void SetVectorArray(int id, const Vector<Vector4>& array);
         void SetLightProperties(const Ref<Light>& light);
         void UpdateUniformSets();
-        int FindUniformSetIndex(const String& name);
-        const Map<String, MaterialProperty>& GetProperties() const { return m_properties; }
+        // set index of the property in this material, or -1
+        int FindUniformSetIndex(int id) const;
+        void GetDynamicOffsets(int set_index, Vector<uint32_t>& offsets) const;
+        const Vector<MaterialProperty>& GetProperties() const { return m_properties; }
 
     private:
-        template <class T>
-        const T* GetProperty(const String& name, MaterialProperty::Type type) const
+        const MaterialProperty* FindProperty(int id) const
         {
-            const MaterialProperty* property_ptr;
-            if (m_properties.TryGet(name, &property_ptr))
+            if (id < m_property_indices.Size() && m_property_indices[id] >= 0)
             {
-                if (property_ptr->type == type)
-                {
-                    return (const T*) &property_ptr->data;
-                }
+                return &m_properties[m_property_indices[id]];
             }
-
             return nullptr;
         }
+        MaterialProperty* AddProperty(int id, MaterialProperty::Type type);
         template <class T>
-        void SetProperty(const String& name, const T& v, MaterialProperty::Type type)
+        const T* GetProperty(int id, MaterialProperty::Type type) const
         {
-            MaterialProperty* property_ptr;
-            if (m_properties.TryGet(name, &property_ptr))
+            const MaterialProperty* property_ptr = this->FindProperty(id);
+            if (property_ptr && property_ptr->type == type)
             {
-                Memory::Copy(&property_ptr->data, &v, sizeof(v));
-                property_ptr->dirty = true;
-            }
-            else
-            {
-                MaterialProperty property;
-                property.name = name;
-                property.type = type;
-                Memory::Copy(&property.data, &v, sizeof(v));
-                property.size = sizeof(v);
-                property.dirty = true;
-                m_properties.Add(name, property);
+                return (const T*) &property_ptr->data;
             }
+
+            return nullptr;
+        }
+        template <class T>
+        void SetProperty(int id, const T& v, MaterialProperty::Type type)
+        {
+            MaterialProperty* property_ptr = this->AddProperty(id, type);
+            Memory::Copy(&property_ptr->data, &v, sizeof(v));
+            property_ptr->size = sizeof(v);
+            property_ptr->dirty = true;
         }
-        void UpdateUniformMember(const String& name, const void* data, int size, bool& instance_cmd_dirty);
-        void UpdateUniformTexture(const String& name, const Ref<Texture>& texture, bool& instance_cmd_dirty);
+        void UpdateUniformMember(int id, const void* data, int size);
+        void UpdateUniformTextures(int set_index);
         void MarkRendererOrderDirty();
         void MarkInstanceCmdDirty();
+        void CreateUniformBuffers();
         void Release();
 
     private:
@@ -146,6 +152,8 @@ namespace Viry3D
         List<Renderer*> m_renderers;
         Vector<VkDescriptorSet> m_descriptor_sets;
         Vector<UniformSet> m_uniform_sets;
-        Map<String, MaterialProperty> m_properties;
+        Vector<MaterialProperty> m_properties;
+        // property id to index in m_properties, -1 if not set
+        Vector<int> m_property_indices;
     };
 }
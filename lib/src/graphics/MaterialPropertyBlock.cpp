@@ -0,0 +1,347 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "MaterialPropertyBlock.h"
+#include "Shader.h"
+#include "BufferObject.h"
+#include "Debug.h"
+
+namespace Viry3D
+{
+    MaterialPropertyBlock::MaterialPropertyBlock():
+        m_shared_dirty(false)
+    {
+    
+    }
+
+    MaterialPropertyBlock::~MaterialPropertyBlock()
+    {
+        this->Release();
+    }
+
+    void MaterialPropertyBlock::Release()
+    {
+        for (int i = 0; i < m_sets.Size(); ++i)
+        {
+            for (int j = 0; j < m_sets[i].buffers.Size(); ++j)
+            {
+                auto& buffer = m_sets[i].buffers[j];
+
+                if (buffer.shared)
+                {
+                    buffer.buffer.reset();
+                }
+                else
+                {
+                    Display::Instance()->DestroyUniformBuffer(buffer);
+                }
+            }
+        }
+        m_sets.Clear();
+    }
+
+    MaterialProperty* MaterialPropertyBlock::AddProperty(int id, MaterialProperty::Type type)
+    {
+        if (id >= m_property_indices.Size())
+        {
+            m_property_indices.Resize(id + 1, -1);
+        }
+
+        int index = m_property_indices[id];
+        if (index < 0)
+        {
+            index = m_properties.Size();
+            m_property_indices[id] = index;
+
+            MaterialProperty property;
+            property.id = id;
+            property.size = 0;
+            m_properties.Add(property);
+        }
+
+        MaterialProperty* property_ptr = &m_properties[index];
+        property_ptr->type = type;
+
+        return property_ptr;
+    }
+
+    void MaterialPropertyBlock::SetMatrix(int id, const Matrix4x4& value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Matrix);
+    }
+
+    void MaterialPropertyBlock::SetVector(int id, const Vector4& value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Vector);
+    }
+
+    void MaterialPropertyBlock::SetColor(int id, const Color& value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Color);
+    }
+
+    void MaterialPropertyBlock::SetFloat(int id, float value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Float);
+    }
+
+    void MaterialPropertyBlock::SetInt(int id, int value)
+    {
+        this->SetProperty(id, value, MaterialProperty::Type::Int);
+    }
+
+    void MaterialPropertyBlock::SetVectorArray(int id, const Vector<Vector4>& array)
+    {
+        MaterialProperty* property_ptr = this->AddProperty(id, MaterialProperty::Type::VectorArray);
+        property_ptr->vector_array = array;
+        property_ptr->dirty = true;
+    }
+
+    void MaterialPropertyBlock::SetSharedUniformBuffer(int id, const UniformBuffer& shared)
+    {
+        for (auto& i : m_shared_buffers)
+        {
+            if (i.id == id)
+            {
+                if (i.buffer.buffer != shared.buffer || i.buffer.offset != shared.offset || i.buffer.size != shared.size)
+                {
+                    i.buffer = shared;
+                    m_shared_dirty = true;
+                }
+                return;
+            }
+        }
+
+        SharedBinding binding;
+        binding.id = id;
+        binding.buffer = shared;
+        m_shared_buffers.Add(binding);
+        m_shared_dirty = true;
+    }
+
+    void MaterialPropertyBlock::CopyFrom(const MaterialPropertyBlock& block)
+    {
+        for (const auto& i : block.m_properties)
+        {
+            MaterialProperty* property_ptr = this->AddProperty(i.id, i.type);
+            property_ptr->data = i.data;
+            property_ptr->vector_array = i.vector_array;
+            property_ptr->size = i.size;
+            property_ptr->dirty = true;
+        }
+
+        for (const auto& i : block.m_shared_buffers)
+        {
+            this->SetSharedUniformBuffer(i.id, i.buffer);
+        }
+    }
+
+    MaterialPropertyBlock::BlockSet& MaterialPropertyBlock::UseSet(int set_index)
+    {
+        BlockSet& set = m_sets[set_index];
+
+        if (!set.used)
+        {
+            set.used = true;
+            set.layout_dirty = true;
+
+            // a set is bound as a whole, members not set in the block read zero
+            set.buffers = m_shader->GetUniformSets()[set_index].buffers;
+            for (int i = 0; i < set.buffers.Size(); ++i)
+            {
+                auto& buffer = set.buffers[i];
+                buffer.shared = false;
+
+                if (buffer.storage)
+                {
+                    continue;
+                }
+
+                Display::Instance()->CreateUniformBuffer(VK_NULL_HANDLE, buffer);
+                buffer.data = Vector<byte>(buffer.size, 0);
+                buffer.dirty = true;
+            }
+        }
+
+        return set;
+    }
+
+    void MaterialPropertyBlock::UpdateUniformMember(int id, const void* data, int size)
+    {
+        const ShaderProperty* property = m_shader->GetProperty(id);
+        if (property && property->buffer_index >= 0 && size <= property->size)
+        {
+            auto& buffer = this->UseSet(property->set_index).buffers[property->buffer_index];
+            if (!buffer.shared && !buffer.storage)
+            {
+                Memory::Copy(&buffer.data[property->offset], data, size);
+                buffer.dirty = true;
+            }
+        }
+    }
+
+    void MaterialPropertyBlock::UpdateSharedBuffers()
+    {
+        for (const auto& i : m_shared_buffers)
+        {
+            const ShaderProperty* property = m_shader->GetProperty(i.id);
+            if (property == nullptr || property->buffer_index < 0)
+            {
+                continue;
+            }
+
+            BlockSet& set = this->UseSet(property->set_index);
+            auto& buffer = set.buffers[property->buffer_index];
+            if (buffer.shared && buffer.buffer == i.buffer.buffer && buffer.offset == i.buffer.offset)
+            {
+                continue;
+            }
+
+            // the descriptor range is this block size, the shared block must be at least that big,
+            // a storage block takes the size of the shared one
+            if (buffer.storage)
+            {
+                buffer.size = i.buffer.size;
+            }
+            assert(i.buffer.size >= buffer.size);
+
+            if (!buffer.shared)
+            {
+                Display::Instance()->DestroyUniformBuffer(buffer);
+            }
+
+            buffer.buffer = i.buffer.buffer;
+            buffer.offset = i.buffer.offset;
+            buffer.shared = true;
+            buffer.dirty = false;
+            set.layout_dirty = true;
+        }
+    }
+
+    bool MaterialPropertyBlock::Update(const Ref<Shader>& shader)
+    {
+        bool changed = false;
+
+        if (m_shader != shader)
+        {
+            this->Release();
+
+            m_shader = shader;
+            m_sets.Resize(m_shader->GetUniformSets().Size());
+
+            // the new blocks are written from the property values
+            for (auto& i : m_properties)
+            {
+                i.dirty = true;
+            }
+            m_shared_dirty = true;
+            changed = true;
+        }
+
+        for (auto& i : m_properties)
+        {
+            if (i.dirty)
+            {
+                i.dirty = false;
+
+                if (i.type == MaterialProperty::Type::VectorArray)
+                {
+                    this->UpdateUniformMember(i.id, i.vector_array.Bytes(), i.vector_array.SizeInBytes());
+                }
+                else
+                {
+                    this->UpdateUniformMember(i.id, &i.data, i.size);
+                }
+            }
+        }
+
+        if (m_shared_dirty)
+        {
+            m_shared_dirty = false;
+            this->UpdateSharedBuffers();
+        }
+
+        for (int i = 0; i < m_sets.Size(); ++i)
+        {
+            BlockSet& set = m_sets[i];
+            if (!set.used)
+            {
+                continue;
+            }
+
+            // one write per changed block
+            for (int j = 0; j < set.buffers.Size(); ++j)
+            {
+                auto& buffer = set.buffers[j];
+
+                if (buffer.dirty && !buffer.shared)
+                {
+                    buffer.dirty = false;
+
+                    Display::Instance()->UpdateBuffer(buffer.buffer, buffer.offset, &buffer.data[0], buffer.size);
+                }
+            }
+
+            if (set.layout_dirty)
+            {
+                set.layout_dirty = false;
+
+                // a storage block not bound yet leaves the set to the material
+                bool complete = true;
+                for (int j = 0; j < set.buffers.Size(); ++j)
+                {
+                    if (!set.buffers[j].buffer)
+                    {
+                        complete = false;
+                        break;
+                    }
+                }
+
+                if (complete)
+                {
+                    set.descriptor_set = m_shader->GetInstanceDescriptorSet(i, set.buffers);
+                }
+                else
+                {
+                    set.descriptor_set = VK_NULL_HANDLE;
+                }
+                changed = true;
+            }
+        }
+
+        return changed;
+    }
+
+    VkDescriptorSet MaterialPropertyBlock::GetDescriptorSet(int set_index) const
+    {
+        if (set_index < m_sets.Size())
+        {
+            return m_sets[set_index].descriptor_set;
+        }
+
+        return VK_NULL_HANDLE;
+    }
+
+    void MaterialPropertyBlock::GetDynamicOffsets(int set_index, Vector<uint32_t>& offsets) const
+    {
+        const auto& buffers = m_sets[set_index].buffers;
+        for (int i = 0; i < buffers.Size(); ++i)
+        {
+            offsets.Add((uint32_t) buffers[i].offset);
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "Material.h"
+
+namespace Viry3D
+{
+    // per renderer values overriding a material without cloning it.
+    // only the uniform blocks holding the values are allocated, from the shared uniform pages,
+    // descriptor sets come from the shader and are shared by all blocks on the same pages.
+    // textures are not supported, they need a descriptor set of their own.
+    class MaterialPropertyBlock
+    {
+    public:
+        MaterialPropertyBlock();
+        ~MaterialPropertyBlock();
+        void SetMatrix(int id, const Matrix4x4& value);
+        void SetVector(int id, const Vector4& value);
+        void SetColor(int id, const Color& value);
+        void SetFloat(int id, float value);
+        void SetInt(int id, int value);
+        void SetVectorArray(int id, const Vector<Vector4>& array);
+        // binds the block holding the member to a block owned elsewhere, like a skin palette
+        void SetSharedUniformBuffer(int id, const UniformBuffer& shared);
+        // sets every value of the other block in this one, values not in the other block are kept
+        void CopyFrom(const MaterialPropertyBlock& block);
+        // writes dirty values into the blocks of the shader,
+        // returns true if descriptor sets or dynamic offsets changed and draw cmds need rebuild
+        bool Update(const Ref<Shader>& shader);
+        const Ref<Shader>& GetShader() const { return m_shader; }
+        // null if the set is not overridden
+        VkDescriptorSet GetDescriptorSet(int set_index) const;
+        void GetDynamicOffsets(int set_index, Vector<uint32_t>& offsets) const;
+
+    private:
+        struct BlockSet
+        {
+            Vector<UniformBuffer> buffers;
+            VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+            bool used = false;
+            bool layout_dirty = false;
+        };
+
+        struct SharedBinding
+        {
+            int id;
+            UniformBuffer buffer;
+        };
+
+    private:
+        MaterialProperty* AddProperty(int id, MaterialProperty::Type type);
+        template <class T>
+        void SetProperty(int id, const T& v, MaterialProperty::Type type)
+        {
+            MaterialProperty* property_ptr = this->AddProperty(id, type);
+            Memory::Copy(&property_ptr->data, &v, sizeof(v));
+            property_ptr->size = sizeof(v);
+            property_ptr->dirty = true;
+        }
+        BlockSet& UseSet(int set_index);
+        void UpdateUniformMember(int id, const void* data, int size);
+        void UpdateSharedBuffers();
+        void Release();
+
+    private:
+        Ref<Shader> m_shader;
+        Vector<BlockSet> m_sets;
+        Vector<MaterialProperty> m_properties;
+        // property id to index in m_properties, -1 if not set
+        Vector<int> m_property_indices;
+        Vector<SharedBinding> m_shared_buffers;
+        bool m_shared_dirty;
+    };
+}
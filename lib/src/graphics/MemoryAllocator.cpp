@@ -0,0 +1,521 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "MemoryAllocator.h"
+#include "memory/Memory.h"
+#include <assert.h>
+
+#define MEMORY_BLOCK_SIZE (32 * 1024 * 1024)
+#define MEMORY_BUDDY_MIN_SIZE (64 * 1024)
+#define MEMORY_BUDDY_ORDER_MAX 9
+#define MEMORY_SLAB_ORDER 2
+#define MEMORY_SIZE_CLASS_MIN 64
+#define MEMORY_SIZE_CLASS_COUNT 10
+
+namespace Viry3D
+{
+    struct MemoryBlock
+    {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        VkDeviceSize free_bytes;
+        void* mapped;
+        bool dedicated;
+        // buddy tree, each node stores the largest free order in its subtree + 1, 0 means full
+        Vector<byte> tree;
+    };
+
+    struct MemorySlab
+    {
+        MemoryBlock* block;
+        VkDeviceSize offset;
+        int size_class;
+        int slot_count;
+        Vector<int> free_slots;
+    };
+
+    struct MemoryPool
+    {
+        uint32_t type_index;
+        bool linear;
+        bool host_visible;
+        List<MemoryBlock*> blocks;
+        List<MemoryBlock*> dedicated;
+        Vector<List<MemorySlab*>> slabs;
+        Vector<List<MemorySlab*>> partial_slabs;
+        int allocation_count;
+        VkDeviceSize used_bytes;
+    };
+
+    static VkDeviceSize BuddyOrderSize(int order)
+    {
+        return ((VkDeviceSize) MEMORY_BUDDY_MIN_SIZE) << order;
+    }
+
+    static VkDeviceSize SizeClassSize(int size_class)
+    {
+        return ((VkDeviceSize) MEMORY_SIZE_CLASS_MIN) << size_class;
+    }
+
+    static void UpdateBuddyParents(MemoryBlock* block, int node, int node_order)
+    {
+        while (node > 0)
+        {
+            node = (node - 1) / 2;
+            node_order += 1;
+
+            byte left = block->tree[node * 2 + 1];
+            byte right = block->tree[node * 2 + 2];
+
+            // merge when both children are entirely free
+            if (left == node_order && right == node_order)
+            {
+                block->tree[node] = (byte) (node_order + 1);
+            }
+            else
+            {
+                block->tree[node] = left > right ? left : right;
+            }
+        }
+    }
+
+    MemoryAllocator::MemoryAllocator(VkDevice device, const VkPhysicalDeviceMemoryProperties& memory_properties):
+        m_device(device),
+        m_memory_properties(memory_properties)
+    {
+    }
+
+    MemoryAllocator::~MemoryAllocator()
+    {
+        for (int i = 0; i < m_pools.Size(); ++i)
+        {
+            MemoryPool* pool = m_pools[i];
+
+            for (int j = 0; j < pool->slabs.Size(); ++j)
+            {
+                for (auto slab : pool->slabs[j])
+                {
+                    delete slab;
+                }
+            }
+            for (auto block : pool->blocks)
+            {
+                this->DestroyBlock(block);
+            }
+            for (auto block : pool->dedicated)
+            {
+                this->DestroyBlock(block);
+            }
+
+            delete pool;
+        }
+        m_pools.Clear();
+    }
+
+    bool MemoryAllocator::FindMemoryType(uint32_t type_bits, VkMemoryPropertyFlags properties, uint32_t* type_index) const
+    {
+        for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; ++i)
+        {
+            if ((type_bits & (1 << i)) != 0)
+            {
+                if ((m_memory_properties.memoryTypes[i].propertyFlags & properties) == properties)
+                {
+                    *type_index = i;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    MemoryPool* MemoryAllocator::GetPool(uint32_t type_index, bool linear)
+    {
+        for (int i = 0; i < m_pools.Size(); ++i)
+        {
+            if (m_pools[i]->type_index == type_index && m_pools[i]->linear == linear)
+            {
+                return m_pools[i];
+            }
+        }
+
+        MemoryPool* pool = new MemoryPool();
+        pool->type_index = type_index;
+        pool->linear = linear;
+        pool->host_visible = (m_memory_properties.memoryTypes[type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+        pool->slabs.Resize(MEMORY_SIZE_CLASS_COUNT);
+        pool->partial_slabs.Resize(MEMORY_SIZE_CLASS_COUNT);
+        pool->allocation_count = 0;
+        pool->used_bytes = 0;
+        m_pools.Add(pool);
+
+        return pool;
+    }
+
+    MemoryBlock* MemoryAllocator::CreateBlock(MemoryPool* pool, VkDeviceSize size, bool dedicated)
+    {
+        VkMemoryAllocateInfo memory_info;
+        Memory::Zero(&memory_info, sizeof(memory_info));
+        memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memory_info.pNext = nullptr;
+        memory_info.allocationSize = size;
+        memory_info.memoryTypeIndex = pool->type_index;
+
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkResult err = vkAllocateMemory(m_device, &memory_info, nullptr, &memory);
+        if (err)
+        {
+            return nullptr;
+        }
+
+        MemoryBlock* block = new MemoryBlock();
+        block->memory = memory;
+        block->size = size;
+        block->free_bytes = size;
+        block->mapped = nullptr;
+        block->dedicated = dedicated;
+
+        // host visible blocks stay mapped for their whole life
+        if (pool->host_visible)
+        {
+            err = vkMapMemory(m_device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+            assert(!err);
+        }
+
+        if (!block->dedicated)
+        {
+            int node_count = (1 << (MEMORY_BUDDY_ORDER_MAX + 1)) - 1;
+            block->tree.Resize(node_count);
+
+            int node = 0;
+            for (int depth = 0; depth <= MEMORY_BUDDY_ORDER_MAX; ++depth)
+            {
+                int level_count = 1 << depth;
+                for (int i = 0; i < level_count; ++i)
+                {
+                    block->tree[node++] = (byte) (MEMORY_BUDDY_ORDER_MAX - depth + 1);
+                }
+            }
+        }
+
+        return block;
+    }
+
+    void MemoryAllocator::DestroyBlock(MemoryBlock* block)
+    {
+        if (block->mapped)
+        {
+            vkUnmapMemory(m_device, block->memory);
+        }
+        vkFreeMemory(m_device, block->memory, nullptr);
+        delete block;
+    }
+
+    bool MemoryAllocator::AllocBuddy(MemoryPool* pool, int order, MemoryAllocation* allocation)
+    {
+        MemoryBlock* block = nullptr;
+        for (auto i : pool->blocks)
+        {
+            if (i->tree[0] >= order + 1)
+            {
+                block = i;
+                break;
+            }
+        }
+
+        if (block == nullptr)
+        {
+            block = this->CreateBlock(pool, MEMORY_BLOCK_SIZE, false);
+            if (block == nullptr)
+            {
+                return false;
+            }
+            pool->blocks.AddLast(block);
+        }
+
+        int node = 0;
+        int node_order = MEMORY_BUDDY_ORDER_MAX;
+        while (node_order > order)
+        {
+            int left = node * 2 + 1;
+            if (block->tree[left] >= order + 1)
+            {
+                node = left;
+            }
+            else
+            {
+                node = left + 1;
+            }
+            node_order -= 1;
+        }
+
+        block->tree[node] = 0;
+        UpdateBuddyParents(block, node, node_order);
+
+        int level_first = (1 << (MEMORY_BUDDY_ORDER_MAX - order)) - 1;
+        VkDeviceSize offset = (node - level_first) * BuddyOrderSize(order);
+
+        block->free_bytes -= BuddyOrderSize(order);
+
+        allocation->memory = block->memory;
+        allocation->offset = offset;
+        allocation->block = block;
+        allocation->order = order;
+
+        return true;
+    }
+
+    void MemoryAllocator::FreeBuddy(MemoryBlock* block, VkDeviceSize offset, int order)
+    {
+        int level_first = (1 << (MEMORY_BUDDY_ORDER_MAX - order)) - 1;
+        int node = level_first + (int) (offset / BuddyOrderSize(order));
+
+        block->tree[node] = (byte) (order + 1);
+        UpdateBuddyParents(block, node, order);
+
+        block->free_bytes += BuddyOrderSize(order);
+    }
+
+    bool MemoryAllocator::AllocSlab(MemoryPool* pool, int size_class, MemoryAllocation* allocation)
+    {
+        List<MemorySlab*>& partial = pool->partial_slabs[size_class];
+
+        if (partial.Empty())
+        {
+            MemoryAllocation slab_allocation;
+            if (!this->AllocBuddy(pool, MEMORY_SLAB_ORDER, &slab_allocation))
+            {
+                return false;
+            }
+
+            MemorySlab* slab = new MemorySlab();
+            slab->block = slab_allocation.block;
+            slab->offset = slab_allocation.offset;
+            slab->size_class = size_class;
+            slab->slot_count = (int) (BuddyOrderSize(MEMORY_SLAB_ORDER) / SizeClassSize(size_class));
+            slab->free_slots.Resize(slab->slot_count);
+            for (int i = 0; i < slab->slot_count; ++i)
+            {
+                slab->free_slots[i] = slab->slot_count - 1 - i;
+            }
+
+            pool->slabs[size_class].AddLast(slab);
+            partial.AddLast(slab);
+        }
+
+        MemorySlab* slab = partial.First();
+        int slot = slab->free_slots[slab->free_slots.Size() - 1];
+        slab->free_slots.Resize(slab->free_slots.Size() - 1);
+
+        if (slab->free_slots.Empty())
+        {
+            partial.RemoveFirst();
+        }
+
+        allocation->memory = slab->block->memory;
+        allocation->offset = slab->offset + slot * SizeClassSize(size_class);
+        allocation->block = slab->block;
+        allocation->slab = slab;
+        allocation->slot = slot;
+
+        return true;
+    }
+
+    void MemoryAllocator::FreeSlab(MemoryAllocation& allocation)
+    {
+        MemoryPool* pool = allocation.pool;
+        MemorySlab* slab = allocation.slab;
+        List<MemorySlab*>& partial = pool->partial_slabs[slab->size_class];
+
+        if (slab->free_slots.Empty())
+        {
+            partial.AddLast(slab);
+        }
+        slab->free_slots.Add(allocation.slot);
+
+        // return empty slab to its block, but keep the last one around
+        if (slab->free_slots.Size() == slab->slot_count && partial.Size() > 1)
+        {
+            partial.Remove(slab);
+            pool->slabs[slab->size_class].Remove(slab);
+
+            this->FreeBuddy(slab->block, slab->offset, MEMORY_SLAB_ORDER);
+            delete slab;
+        }
+    }
+
+    bool MemoryAllocator::Alloc(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, MemoryAllocation* allocation)
+    {
+        uint32_t type_index = 0;
+        if (!this->FindMemoryType(requirements.memoryTypeBits, properties, &type_index))
+        {
+            return false;
+        }
+
+        m_mutex.lock();
+
+        MemoryPool* pool = this->GetPool(type_index, linear);
+        VkDeviceSize size = requirements.size > requirements.alignment ? requirements.size : requirements.alignment;
+        bool success = false;
+
+        *allocation = MemoryAllocation();
+
+        if (size <= SizeClassSize(MEMORY_SIZE_CLASS_COUNT - 1))
+        {
+            int size_class = 0;
+            while (SizeClassSize(size_class) < size)
+            {
+                size_class += 1;
+            }
+
+            success = this->AllocSlab(pool, size_class, allocation);
+        }
+        else if (size <= MEMORY_BLOCK_SIZE / 2)
+        {
+            int order = 0;
+            while (BuddyOrderSize(order) < size || BuddyOrderSize(order) % requirements.alignment != 0)
+            {
+                order += 1;
+            }
+
+            success = this->AllocBuddy(pool, order, allocation);
+        }
+        else
+        {
+            MemoryBlock* block = this->CreateBlock(pool, requirements.size, true);
+            if (block)
+            {
+                pool->dedicated.AddLast(block);
+
+                allocation->memory = block->memory;
+                allocation->offset = 0;
+                allocation->block = block;
+                success = true;
+            }
+        }
+
+        if (success)
+        {
+            allocation->size = requirements.size;
+            allocation->pool = pool;
+            if (allocation->block->mapped)
+            {
+                allocation->mapped = ((byte*) allocation->block->mapped) + allocation->offset;
+            }
+
+            pool->allocation_count += 1;
+            pool->used_bytes += requirements.size;
+        }
+
+        m_mutex.unlock();
+
+        return success;
+    }
+
+    void MemoryAllocator::Free(MemoryAllocation& allocation)
+    {
+        if (allocation.pool == nullptr)
+        {
+            return;
+        }
+
+        m_mutex.lock();
+
+        MemoryPool* pool = allocation.pool;
+        MemoryBlock* block = allocation.block;
+
+        if (allocation.slab)
+        {
+            this->FreeSlab(allocation);
+        }
+        else if (block->dedicated)
+        {
+            pool->dedicated.Remove(block);
+            this->DestroyBlock(block);
+            block = nullptr;
+        }
+        else
+        {
+            this->FreeBuddy(block, allocation.offset, allocation.order);
+        }
+
+        // release empty block, but keep the last one around
+        if (block && block->free_bytes == block->size && pool->blocks.Size() > 1)
+        {
+            pool->blocks.Remove(block);
+            this->DestroyBlock(block);
+        }
+
+        pool->allocation_count -= 1;
+        pool->used_bytes -= allocation.size;
+
+        m_mutex.unlock();
+
+        allocation = MemoryAllocation();
+    }
+
+    MemoryStats MemoryAllocator::GetStats()
+    {
+        MemoryStats stats;
+
+        m_mutex.lock();
+
+        for (int i = 0; i < m_pools.Size(); ++i)
+        {
+            const MemoryPool* pool = m_pools[i];
+
+            stats.allocation_count += pool->allocation_count;
+            stats.used_bytes += pool->used_bytes;
+            stats.dedicated_count += pool->dedicated.Size();
+
+            for (int j = 0; j < pool->slabs.Size(); ++j)
+            {
+                stats.slab_count += pool->slabs[j].Size();
+            }
+
+            for (auto block : pool->blocks)
+            {
+                stats.block_count += 1;
+                stats.reserved_bytes += block->size;
+                stats.free_bytes += block->free_bytes;
+
+                if (block->tree[0] > 0)
+                {
+                    VkDeviceSize largest = BuddyOrderSize(block->tree[0] - 1);
+                    if (largest > stats.largest_free_bytes)
+                    {
+                        stats.largest_free_bytes = largest;
+                    }
+                }
+            }
+
+            for (auto block : pool->dedicated)
+            {
+                stats.reserved_bytes += block->size;
+            }
+        }
+
+        m_mutex.unlock();
+
+        if (stats.free_bytes > 0)
+        {
+            stats.fragmentation = 1.0f - stats.largest_free_bytes / (float) stats.free_bytes;
+        }
+
+        return stats;
+    }
+}
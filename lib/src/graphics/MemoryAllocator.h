@@ -0,0 +1,87 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "vulkan/vulkan_include.h"
+#include "container/Vector.h"
+#include "container/List.h"
+#include "thread/ThreadPool.h"
+
+namespace Viry3D
+{
+    struct MemoryBlock;
+    struct MemorySlab;
+    struct MemoryPool;
+
+    struct MemoryAllocation
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+        MemoryPool* pool = nullptr;
+        MemoryBlock* block = nullptr;
+        MemorySlab* slab = nullptr;
+        int order = -1;
+        int slot = -1;
+    };
+
+    struct MemoryStats
+    {
+        int block_count = 0;
+        int dedicated_count = 0;
+        int slab_count = 0;
+        int allocation_count = 0;
+        VkDeviceSize reserved_bytes = 0;
+        VkDeviceSize used_bytes = 0;
+        VkDeviceSize free_bytes = 0;
+        VkDeviceSize largest_free_bytes = 0;
+        // 1 - largest free range / total free, 0 means no fragmentation
+        float fragmentation = 0;
+    };
+
+    // sub allocates VkDeviceMemory blocks per memory type,
+    // small requests come from fixed size class slabs, large ones from a buddy tree in each block,
+    // requests bigger than half a block get a dedicated allocation.
+    // linear (buffer) and optimal (image) resources never share a block, so buffer image granularity is not a concern.
+    class MemoryAllocator
+    {
+    public:
+        MemoryAllocator(VkDevice device, const VkPhysicalDeviceMemoryProperties& memory_properties);
+        ~MemoryAllocator();
+        bool Alloc(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, MemoryAllocation* allocation);
+        void Free(MemoryAllocation& allocation);
+        MemoryStats GetStats();
+
+    private:
+        bool FindMemoryType(uint32_t type_bits, VkMemoryPropertyFlags properties, uint32_t* type_index) const;
+        MemoryPool* GetPool(uint32_t type_index, bool linear);
+        MemoryBlock* CreateBlock(MemoryPool* pool, VkDeviceSize size, bool dedicated);
+        void DestroyBlock(MemoryBlock* block);
+        bool AllocBuddy(MemoryPool* pool, int order, MemoryAllocation* allocation);
+        void FreeBuddy(MemoryBlock* block, VkDeviceSize offset, int order);
+        bool AllocSlab(MemoryPool* pool, int size_class, MemoryAllocation* allocation);
+        void FreeSlab(MemoryAllocation& allocation);
+
+    private:
+        VkDevice m_device;
+        VkPhysicalDeviceMemoryProperties m_memory_properties;
+        Vector<MemoryPool*> m_pools;
+        Mutex m_mutex;
+    };
+}
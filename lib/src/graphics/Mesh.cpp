@@ -121,14 +121,16 @@ namespace Viry3D
         return mesh;
     }
 
-    Mesh::Mesh(const Vector<Vertex>& vertices, const Vector<unsigned short>& indices, const Vector<Submesh>& submeshes):
+    Mesh::Mesh(const Vector<Vertex>& vertices, const Vector<unsigned short>& indices, const Vector<Submesh>& submeshes, bool dynamic):
         m_vertex_count(0),
         m_index_count(0),
         m_buffer_vertex_count(0),
-        m_buffer_index_count(0)
+        m_buffer_index_count(0),
+        m_dynamic(dynamic)
     {
-        m_vertex_buffer = Display::Instance()->CreateBuffer(&vertices[0], vertices.SizeInBytes(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-        m_index_buffer = Display::Instance()->CreateBuffer(&indices[0], indices.SizeInBytes(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+        // static mesh lives in device local memory, dynamic mesh stays host visible for Update
+        m_vertex_buffer = Display::Instance()->CreateBuffer(&vertices[0], vertices.SizeInBytes(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, !m_dynamic);
+        m_index_buffer = Display::Instance()->CreateBuffer(&indices[0], indices.SizeInBytes(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, !m_dynamic);
     
         m_vertex_count = vertices.Size();
         m_index_count = indices.Size();
@@ -139,20 +141,21 @@ namespace Viry3D
         {
             m_submeshes.Add(Submesh({ 0, indices.Size() }));
         }
+
+        this->UpdateBounds(vertices);
     }
     
     Mesh::~Mesh()
     {
-        VkDevice device = Display::Instance()->GetDevice();
-
-        m_vertex_buffer->Destroy(device);
+        Display::Instance()->RetireBuffer(m_vertex_buffer);
         m_vertex_buffer.reset();
-        m_index_buffer->Destroy(device);
+        Display::Instance()->RetireBuffer(m_index_buffer);
         m_index_buffer.reset();
     }
 
     void Mesh::Update(const Vector<Vertex>& vertices, const Vector<unsigned short>& indices, const Vector<Submesh>& submeshes)
     {
+        assert(m_dynamic);
         assert(vertices.Size() <= m_buffer_vertex_count);
         assert(indices.Size() <= m_buffer_index_count);
 
@@ -166,5 +169,25 @@ namespace Viry3D
         {
             m_submeshes.Add(Submesh({ 0, indices.Size() }));
         }
+
+        this->UpdateBounds(vertices);
+    }
+
+    void Mesh::UpdateBounds(const Vector<Vertex>& vertices)
+    {
+        if (vertices.Empty())
+        {
+            m_bounds = Bounds();
+            return;
+        }
+
+        Vector3 min = vertices[0].vertex;
+        Vector3 max = vertices[0].vertex;
+        for (int i = 1; i < vertices.Size(); ++i)
+        {
+            min = Vector3::Min(min, vertices[i].vertex);
+            max = Vector3::Max(max, vertices[i].vertex);
+        }
+        m_bounds = Bounds(min, max);
     }
 }
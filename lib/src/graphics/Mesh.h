@@ -21,6 +21,7 @@
 #include "VertexAttribute.h"
 #include "container/Vector.h"
 #include "math/Matrix4x4.h"
+#include "math/Bounds.h"
 
 namespace Viry3D
 {
@@ -37,16 +38,21 @@ namespace Viry3D
 
     public:
         static Ref<Mesh> LoadFromFile(const String& path);
-        Mesh(const Vector<Vertex>& vertices, const Vector<unsigned short>& indices, const Vector<Submesh>& submeshes = Vector<Submesh>());
+        Mesh(const Vector<Vertex>& vertices, const Vector<unsigned short>& indices, const Vector<Submesh>& submeshes = Vector<Submesh>(), bool dynamic = false);
         virtual ~Mesh();
         void Update(const Vector<Vertex>& vertices, const Vector<unsigned short>& indices, const Vector<Submesh>& submeshes = Vector<Submesh>());
         const Ref<BufferObject>& GetVertexBuffer() const { return m_vertex_buffer; }
         const Ref<BufferObject>& GetIndexBuffer() const { return m_index_buffer; }
+        bool IsDynamic() const { return m_dynamic; }
         int GetVertexCount() const { return m_vertex_count; }
         int GetIndexCount() const { return m_index_count; }
         const Submesh& GetSubmesh(int submesh) const { return m_submeshes[submesh]; }
         void SetBindposes(const Vector<Matrix4x4>& bindposes) { m_bindposes = bindposes; }
         const Vector<Matrix4x4>& GetBindposes() const { return m_bindposes; }
+        const Bounds& GetBounds() const { return m_bounds; }
+
+    private:
+        void UpdateBounds(const Vector<Vertex>& vertices);
 
     private:
         Ref<BufferObject> m_vertex_buffer;
@@ -55,7 +61,9 @@ namespace Viry3D
         int m_index_count;
         int m_buffer_vertex_count;
         int m_buffer_index_count;
+        bool m_dynamic;
         Vector<Submesh> m_submeshes;
         Vector<Matrix4x4> m_bindposes;
+        Bounds m_bounds;
     };
 }
@@ -31,7 +31,7 @@ namespace Viry3D
     {
         if (m_draw_buffer)
         {
-            m_draw_buffer->Destroy(Display::Instance()->GetDevice());
+            Display::Instance()->RetireBuffer(m_draw_buffer);
             m_draw_buffer.reset();
         }
     }
@@ -82,5 +82,18 @@ namespace Viry3D
         }
 
         this->MarkInstanceCmdDirty();
+        this->MarkBoundsDirty();
+    }
+
+    bool MeshRenderer::GetLocalBounds(Bounds* bounds) const
+    {
+        // dynamic mesh vertices change without notifying the renderer
+        if (m_mesh && !m_mesh->IsDynamic())
+        {
+            *bounds = m_mesh->GetBounds();
+            return true;
+        }
+
+        return false;
     }
 }
@@ -34,6 +34,7 @@ namespace Viry3D
         const Ref<Mesh>& GetMesh() const { return m_mesh; }
         int GetSubmesh() const { return m_submesh; }
         void SetMesh(const Ref<Mesh>& mesh, int submesh = 0);
+        virtual bool GetLocalBounds(Bounds* bounds) const;
 
     private:
         Ref<Mesh> m_mesh;
@@ -95,5 +95,41 @@ namespace Viry3D
             queue((int) Queue::Geometry)
         {
         }
+
+        bool operator ==(const RenderState& state) const
+        {
+            return !(*this < state) && !(state < *this);
+        }
+
+        // ordered map key
+        bool operator <(const RenderState& state) const
+        {
+            int values[7] = {
+                (int) cull,
+                (int) zTest,
+                (int) zWrite,
+                (int) blend,
+                (int) srcBlendMode,
+                (int) dstBlendMode,
+                queue,
+            };
+            int state_values[7] = {
+                (int) state.cull,
+                (int) state.zTest,
+                (int) state.zWrite,
+                (int) state.blend,
+                (int) state.srcBlendMode,
+                (int) state.dstBlendMode,
+                state.queue,
+            };
+            for (int i = 0; i < 7; ++i)
+            {
+                if (values[i] != state_values[i])
+                {
+                    return values[i] < state_values[i];
+                }
+            }
+            return false;
+        }
     };
 }
@@ -18,13 +18,18 @@
 #include "Renderer.h"
 #include "Camera.h"
 #include "Material.h"
+#include "MaterialPropertyBlock.h"
+#include "Shader.h"
 #include "Debug.h"
 
 namespace Viry3D
 {
     Renderer::Renderer():
 		m_camera(nullptr),
-        m_model_matrix_dirty(true)
+        m_model_matrix_dirty(true),
+        m_matrix_version(0),
+        m_bounds_dirty(true),
+        m_has_bounds(false)
     {
     
     }
@@ -51,44 +56,6 @@ namespace Viry3D
 
         this->MarkInstanceCmdDirty();
 
-        if (m_instance_material)
-        {
-            if (m_material)
-            {
-                Map<String, MaterialProperty> properties = m_instance_material->GetProperties();
-
-                m_instance_material = RefMake<Material>(m_material->GetShader());
-                for (const auto& i : properties)
-                {
-                    switch (i.second.type)
-                    {
-                        case MaterialProperty::Type::Matrix:
-                            m_instance_material->SetMatrix(i.second.name, *(Matrix4x4*) &i.second.data);
-                            break;
-                        case MaterialProperty::Type::Vector:
-                            m_instance_material->SetVector(i.second.name, *(Vector4*) &i.second.data);
-                            break;
-                        case MaterialProperty::Type::Color:
-                            m_instance_material->SetColor(i.second.name, *(Color*) &i.second.data);
-                            break;
-                        case MaterialProperty::Type::Float:
-                            m_instance_material->SetFloat(i.second.name, *(float*) &i.second.data);
-                            break;
-                        case MaterialProperty::Type::Int:
-                            m_instance_material->SetInt(i.second.name, *(int*) &i.second.data);
-                            break;
-                        case MaterialProperty::Type::Texture:
-                            m_instance_material->SetTexture(i.second.name, i.second.texture);
-                            break;
-                    }
-                }
-            }
-            else
-            {
-                m_instance_material.reset();
-            }
-        }
-
         if (m_material)
         {
             if (m_camera)
@@ -101,16 +68,18 @@ namespace Viry3D
         m_model_matrix_dirty = true;
     }
 
-    void Renderer::OnAddToCamera(Camera* camera)
+    void Renderer::OnAddToCamera(Camera* camera, const RendererHandle& handle)
     {
 		assert(m_camera == nullptr);
 		m_camera = camera;
+		m_camera_handle = handle;
     }
 
     void Renderer::OnRemoveFromCamera(Camera* camera)
     {
 		assert(m_camera == camera);
 		m_camera = nullptr;
+		m_camera_handle = RendererHandle();
     }
 
     void Renderer::MarkRendererOrderDirty()
@@ -132,6 +101,40 @@ namespace Viry3D
     void Renderer::OnMatrixDirty()
     {
         m_model_matrix_dirty = true;
+        m_matrix_version++;
+        m_bounds_dirty = true;
+    }
+
+    bool Renderer::GetBounds(Bounds* bounds)
+    {
+        if (m_bounds_dirty)
+        {
+            m_bounds_dirty = false;
+
+            Bounds local_bounds;
+            m_has_bounds = this->GetLocalBounds(&local_bounds);
+
+            if (m_has_bounds)
+            {
+                // transform center and extents, extents by the absolute matrix
+                const Matrix4x4& mat = this->GetLocalToWorldMatrix();
+                Vector3 center = (local_bounds.Min() + local_bounds.Max()) * 0.5f;
+                Vector3 extents = (local_bounds.Max() - local_bounds.Min()) * 0.5f;
+                Vector3 world_center = mat.MultiplyPoint3x4(center);
+                Vector3 world_extents(
+                    fabs(mat.m00) * extents.x + fabs(mat.m01) * extents.y + fabs(mat.m02) * extents.z,
+                    fabs(mat.m10) * extents.x + fabs(mat.m11) * extents.y + fabs(mat.m12) * extents.z,
+                    fabs(mat.m20) * extents.x + fabs(mat.m21) * extents.y + fabs(mat.m22) * extents.z);
+                m_bounds = Bounds(world_center - world_extents, world_center + world_extents);
+            }
+        }
+
+        if (m_has_bounds)
+        {
+            *bounds = m_bounds;
+        }
+
+        return m_has_bounds;
     }
 
     void Renderer::Update()
@@ -139,7 +142,17 @@ namespace Viry3D
         if (m_model_matrix_dirty)
         {
             m_model_matrix_dirty = false;
-            this->SetInstanceMatrix(MODEL_MATRIX, this->GetLocalToWorldMatrix());
+
+            // instancing shaders get the matrix from the camera instance stream, no instance material needed
+            if (m_material && m_material->GetShader()->IsInstancing())
+            {
+                this->GetLocalToWorldMatrix();
+            }
+            else
+            {
+                static const int model_matrix_id = Shader::PropertyToID(MODEL_MATRIX);
+                this->SetInstanceMatrix(model_matrix_id, this->GetLocalToWorldMatrix());
+            }
         }
 
         if (m_material)
@@ -147,35 +160,54 @@ namespace Viry3D
             m_material->UpdateUniformSets();
         }
 
-        if (m_instance_material)
+        // offsets of the block ranges are baked in the instance cmd
+        if (m_property_block && m_material)
         {
-            m_instance_material->UpdateUniformSets();
+            if (m_property_block->Update(m_material->GetShader()))
+            {
+                this->MarkInstanceCmdDirty();
+            }
         }
     }
 
-    void Renderer::SetInstanceMatrix(const String& name, const Matrix4x4& mat)
+    void Renderer::SetPropertyBlock(const Ref<MaterialPropertyBlock>& block)
     {
-        if (m_material)
+        // the block may be shared by renderers, per renderer values are never written into it
+        if (block)
         {
-            if (!m_instance_material)
-            {
-                m_instance_material = RefMake<Material>(m_material->GetShader());
-            }
-            
-            m_instance_material->SetMatrix(name, mat);
+            this->GetOrCreatePropertyBlock()->CopyFrom(*block);
+        }
+        else
+        {
+            // per renderer values are set again by the next update
+            m_property_block.reset();
+            m_model_matrix_dirty = true;
         }
+        this->MarkInstanceCmdDirty();
     }
 
-    void Renderer::SetInstanceVectorArray(const String& name, const Vector<Vector4>& array)
+    MaterialPropertyBlock* Renderer::GetOrCreatePropertyBlock()
     {
-        if (m_material)
+        if (!m_property_block)
         {
-            if (!m_instance_material)
-            {
-                m_instance_material = RefMake<Material>(m_material->GetShader());
-            }
-
-            m_instance_material->SetVectorArray(name, array);
+            m_property_block = RefMake<MaterialPropertyBlock>();
         }
+
+        return m_property_block.get();
+    }
+
+    void Renderer::SetInstanceMatrix(int id, const Matrix4x4& mat)
+    {
+        this->GetOrCreatePropertyBlock()->SetMatrix(id, mat);
+    }
+
+    void Renderer::SetInstanceVectorArray(int id, const Vector<Vector4>& array)
+    {
+        this->GetOrCreatePropertyBlock()->SetVectorArray(id, array);
+    }
+
+    void Renderer::SetInstanceUniformBuffer(int id, const UniformBuffer& buffer)
+    {
+        this->GetOrCreatePropertyBlock()->SetSharedUniformBuffer(id, buffer);
     }
 }
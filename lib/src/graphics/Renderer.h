@@ -22,14 +22,23 @@
 #include "memory/Ref.h"
 #include "container/List.h"
 #include "math/Matrix4x4.h"
+#include "math/Bounds.h"
 #include "string/String.h"
 
 namespace Viry3D
 {
     class Material;
+    class MaterialPropertyBlock;
     class Camera;
     class BufferObject;
 
+    // slot of a renderer in its camera, the generation rejects handles of removed renderers
+    struct RendererHandle
+    {
+        int slot = -1;
+        uint32_t generation = 0;
+    };
+
     class Renderer : public Node
     {
     public:
@@ -42,23 +51,45 @@ namespace Viry3D
         virtual void OnFrameEnd() { }
         virtual void OnResize(int width, int height) { }
         const Ref<Material>& GetMaterial() const { return m_material; }
-        const Ref<Material>& GetInstanceMaterial() const { return m_instance_material; }
         void SetMaterial(const Ref<Material>& material);
-        void OnAddToCamera(Camera* camera);
+        // block owned by the renderer with its per renderer values and the values set by SetPropertyBlock, null if none
+        const Ref<MaterialPropertyBlock>& GetPropertyBlock() const { return m_property_block; }
+        // values of the block are copied and override the material for this renderer only,
+        // later changes to the block need another call, a null block drops the copied values
+        void SetPropertyBlock(const Ref<MaterialPropertyBlock>& block);
+        void OnAddToCamera(Camera* camera, const RendererHandle& handle);
         void OnRemoveFromCamera(Camera* camera);
         Camera* GetCamera() const { return m_camera; }
+        const RendererHandle& GetCameraHandle() const { return m_camera_handle; }
         void MarkRendererOrderDirty();
         void MarkInstanceCmdDirty();
+        // renderers without local bounds are never culled
+        virtual bool GetLocalBounds(Bounds* bounds) const { return false; }
+        // world space aabb, updated lazily after the matrix or local bounds change
+        bool GetBounds(Bounds* bounds);
+        // increases every time the world matrix is marked dirty
+        uint32_t GetMatrixVersion() const { return m_matrix_version; }
 
     protected:
         virtual void OnMatrixDirty();
-        void SetInstanceMatrix(const String& name, const Matrix4x4& mat);
-        void SetInstanceVectorArray(const String& name, const Vector<Vector4>& array);
+        void MarkBoundsDirty() { m_bounds_dirty = true; }
+        // ids from Shader::PropertyToID
+        void SetInstanceMatrix(int id, const Matrix4x4& mat);
+        void SetInstanceVectorArray(int id, const Vector<Vector4>& array);
+        void SetInstanceUniformBuffer(int id, const UniformBuffer& buffer);
+
+    private:
+        MaterialPropertyBlock* GetOrCreatePropertyBlock();
 
     private:
         Ref<Material> m_material;
-        Ref<Material> m_instance_material;
+        Ref<MaterialPropertyBlock> m_property_block;
         Camera* m_camera;
+        RendererHandle m_camera_handle;
         bool m_model_matrix_dirty;
+        uint32_t m_matrix_version;
+        Bounds m_bounds;
+        bool m_bounds_dirty;
+        bool m_has_bounds;
     };
 }
@@ -21,7 +21,26 @@
 namespace Viry3D
 {
     List<Shader*> Shader::m_shaders;
+    Mutex Shader::m_shader_list_mutex;
 	Map<String, Ref<Shader>> Shader::m_shader_cache;
+    Map<String, int> Shader::m_property_ids;
+    Mutex Shader::m_property_id_mutex;
+
+    int Shader::PropertyToID(const String& name)
+    {
+        std::lock_guard<Mutex> lock(m_property_id_mutex);
+
+        int* id;
+        if (m_property_ids.TryGet(name, &id))
+        {
+            return *id;
+        }
+
+        int new_id = m_property_ids.Size();
+        m_property_ids.Add(name, new_id);
+
+        return new_id;
+    }
 
 	Ref<Shader> Shader::Find(const String& name)
 	{
@@ -46,20 +65,33 @@ namespace Viry3D
 		m_shader_cache.Clear();
 	}
 
-	void Shader::OnRenderPassDestroy(VkRenderPass render_pass)
-	{
-		VkDevice device = Display::Instance()->GetDevice();
+    void Shader::PrewarmPipelines(
+        const Vector<Ref<Shader>>& shaders,
+        const Vector<RenderPassKey>& pass_keys,
+        Thread* thread,
+        const std::function<void()>& complete)
+    {
+        Thread::Task task;
+        task.job = [=]() {
+            for (int i = 0; i < shaders.Size(); ++i)
+            {
+                for (int j = 0; j < pass_keys.Size(); ++j)
+                {
+                    shaders[i]->GetPipeline(pass_keys[j]);
+                }
+            }
+            Display::Instance()->SavePipelineCache();
 
-		for (auto i : m_shaders)
-		{
-			VkPipeline* pipeline = nullptr;
-			if (i->m_pipelines.TryGet(render_pass, &pipeline))
-			{
-				vkDestroyPipeline(device, *pipeline, nullptr);
-				i->m_pipelines.Remove(render_pass);
-			}
-		}
-	}
+            return Ref<Object>();
+        };
+        if (complete)
+        {
+            task.complete = [=](const Ref<Object>&) {
+                complete();
+            };
+        }
+        thread->AddTask(task);
+    }
 
     Shader::Shader(
         const String& vs_predefine,
@@ -72,12 +104,10 @@ namespace Viry3D
         m_render_state(render_state),
         m_vs_module(VK_NULL_HANDLE),
         m_fs_module(VK_NULL_HANDLE),
-        m_pipeline_cache(VK_NULL_HANDLE),
         m_pipeline_layout(VK_NULL_HANDLE),
-        m_descriptor_pool(VK_NULL_HANDLE)
+        m_descriptor_allocator(nullptr),
+        m_instancing(false)
     {
-        m_shaders.AddLast(this);
-
         Display::Instance()->CreateShaderModule(
             vs_predefine,
             vs_includes,
@@ -87,68 +117,302 @@ namespace Viry3D
             fs_source,
             &m_vs_module,
             &m_fs_module,
-            m_uniform_sets);
-        Display::Instance()->CreatePipelineCache(&m_pipeline_cache);
+            m_uniform_sets,
+            &m_instancing);
         Display::Instance()->CreatePipelineLayout(m_uniform_sets, m_descriptor_layouts, &m_pipeline_layout);
-        Display::Instance()->CreateDescriptorSetPool(m_uniform_sets, &m_descriptor_pool);
+        m_descriptor_allocator = new DescriptorAllocator(m_uniform_sets, m_descriptor_layouts);
+
+        this->BuildPropertyTable();
+
+        // variants may be compiled on worker threads
+        std::lock_guard<Mutex> lock(m_shader_list_mutex);
+        m_shaders.AddLast(this);
     }
 
-    Shader::~Shader()
+    void Shader::BuildPropertyTable()
     {
-        VkDevice device = Display::Instance()->GetDevice();
+        for (int i = 0; i < m_uniform_sets.Size(); ++i)
+        {
+            const auto& buffers = m_uniform_sets[i].buffers;
+            for (int j = 0; j < buffers.Size(); ++j)
+            {
+                for (int k = 0; k < buffers[j].members.Size(); ++k)
+                {
+                    const auto& member = buffers[j].members[k];
+
+                    int id = PropertyToID(member.name);
+                    if (m_properties.Size() <= id)
+                    {
+                        m_properties.Resize(id + 1);
+                    }
+
+                    ShaderProperty& property = m_properties[id];
+                    property.set_index = i;
+                    property.buffer_index = j;
+                    property.offset = member.offset;
+                    property.size = member.size;
+                }
+            }
 
+            const auto& textures = m_uniform_sets[i].textures;
+            for (int j = 0; j < textures.Size(); ++j)
+            {
+                int id = PropertyToID(textures[j].name);
+                if (m_properties.Size() <= id)
+                {
+                    m_properties.Resize(id + 1);
+                }
+
+                ShaderProperty& property = m_properties[id];
+                property.set_index = i;
+                property.texture_index = j;
+            }
+        }
+    }
+
+    Shader::~Shader()
+    {
+        Vector<VkPipeline> pipelines;
         for (auto i : m_pipelines)
         {
-            vkDestroyPipeline(device, i.second, nullptr);
+            pipelines.Add(i.second);
         }
         m_pipelines.Clear();
-        vkDestroyDescriptorPool(device, m_descriptor_pool, nullptr);
-        vkDestroyPipelineLayout(device, m_pipeline_layout, nullptr);
-        for (int i = 0; i < m_descriptor_layouts.Size(); ++i)
-        {
-            vkDestroyDescriptorSetLayout(device, m_descriptor_layouts[i], nullptr);
-        }
+
+        DescriptorAllocator* descriptor_allocator = m_descriptor_allocator;
+        m_descriptor_allocator = nullptr;
+        m_instance_descriptor_sets.Clear();
+        VkPipelineLayout pipeline_layout = m_pipeline_layout;
+        Vector<VkDescriptorSetLayout> descriptor_layouts = m_descriptor_layouts;
         m_descriptor_layouts.Clear();
-        vkDestroyPipelineCache(device, m_pipeline_cache, nullptr);
-        vkDestroyShaderModule(device, m_vs_module, nullptr);
-        vkDestroyShaderModule(device, m_fs_module, nullptr);
+        VkShaderModule vs_module = m_vs_module;
+        VkShaderModule fs_module = m_fs_module;
+
+        // pipelines and descriptor sets may be bound by frames in flight
+        Display::Instance()->RetireResource([=]() {
+            VkDevice device = Display::Instance()->GetDevice();
 
+            for (int i = 0; i < pipelines.Size(); ++i)
+            {
+                vkDestroyPipeline(device, pipelines[i], nullptr);
+            }
+            delete descriptor_allocator;
+            vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+            for (int i = 0; i < descriptor_layouts.Size(); ++i)
+            {
+                vkDestroyDescriptorSetLayout(device, descriptor_layouts[i], nullptr);
+            }
+            vkDestroyShaderModule(device, vs_module, nullptr);
+            vkDestroyShaderModule(device, fs_module, nullptr);
+        });
+
+        std::lock_guard<Mutex> lock(m_shader_list_mutex);
         m_shaders.Remove(this);
     }
 
-    VkPipeline Shader::GetPipeline(VkRenderPass render_pass, bool color_attachment, bool depth_attachment)
+    VkPipeline Shader::GetPipeline(const RenderPassKey& pass_key)
     {
+        {
+            std::lock_guard<Mutex> lock(m_pipeline_mutex);
+
+            VkPipeline* pipeline_ptr;
+            if (m_pipelines.TryGet(pass_key, &pipeline_ptr))
+            {
+                return *pipeline_ptr;
+            }
+        }
+
+        // build outside the lock so a prewarm thread does not block draws of other passes
+        VkPipeline pipeline;
+        Display::Instance()->CreatePipeline(
+            Display::Instance()->GetCompatibleRenderPass(pass_key),
+            m_vs_module,
+            m_fs_module,
+            m_render_state,
+            m_pipeline_layout,
+            Display::Instance()->GetPipelineCache(),
+            &pipeline,
+            pass_key.color_format != VK_FORMAT_UNDEFINED,
+            pass_key.depth_format != VK_FORMAT_UNDEFINED,
+            m_instancing);
+
+        std::lock_guard<Mutex> lock(m_pipeline_mutex);
+
         VkPipeline* pipeline_ptr;
-        if (m_pipelines.TryGet(render_pass, &pipeline_ptr))
+        if (m_pipelines.TryGet(pass_key, &pipeline_ptr))
         {
+            vkDestroyPipeline(Display::Instance()->GetDevice(), pipeline, nullptr);
             return *pipeline_ptr;
         }
+        m_pipelines.Add(pass_key, pipeline);
+
+        return pipeline;
+    }
+
+    void Shader::CreateDescriptorSets(Vector<VkDescriptorSet>& descriptor_sets, Vector<UniformSet>& uniform_sets)
+    {
+        descriptor_sets.Resize(m_descriptor_layouts.Size());
+        for (int i = 0; i < descriptor_sets.Size(); ++i)
+        {
+            descriptor_sets[i] = m_descriptor_allocator->Alloc(i);
+        }
+        uniform_sets = m_uniform_sets;
+    }
+
+    void Shader::FreeDescriptorSets(const Vector<VkDescriptorSet>& descriptor_sets)
+    {
+        for (int i = 0; i < descriptor_sets.Size(); ++i)
+        {
+            m_descriptor_allocator->Free(i, descriptor_sets[i]);
+        }
+    }
+
+    VkDescriptorSet Shader::AllocDescriptorSet(int set_index)
+    {
+        return m_descriptor_allocator->Alloc(set_index);
+    }
+
+    void Shader::FreeDescriptorSet(int set_index, VkDescriptorSet descriptor_set)
+    {
+        m_descriptor_allocator->Free(set_index, descriptor_set);
+    }
+
+    // storage blocks without a shared buffer are left unbound, they have no buffer to expire
+    static int GetBoundSize(const UniformBuffer& buffer)
+    {
+        return buffer.buffer ? buffer.size : 0;
+    }
+
+    VkDescriptorSet Shader::GetInstanceDescriptorSet(int set_index, const Vector<UniformBuffer>& buffers)
+    {
+        // offsets are dynamic, only buffers and ranges are written in the set
+        uint64_t key = 14695981039346656037ULL;
+        key = (key ^ (uint64_t) set_index) * 1099511628211ULL;
+        for (int i = 0; i < buffers.Size(); ++i)
+        {
+            key = (key ^ (uint64_t) (size_t) buffers[i].buffer.get()) * 1099511628211ULL;
+            key = (key ^ (uint64_t) buffers[i].size) * 1099511628211ULL;
+        }
+
+        Vector<InstanceDescriptorSet>* chain;
+        if (m_instance_descriptor_sets.TryGet(key, &chain))
+        {
+            for (const auto& cached : *chain)
+            {
+                bool same = cached.set_index == set_index;
+                for (int i = 0; same && i < buffers.Size(); ++i)
+                {
+                    if (cached.buffers[i].lock() != buffers[i].buffer || cached.sizes[i] != GetBoundSize(buffers[i]))
+                    {
+                        same = false;
+                    }
+                }
+
+                if (same)
+                {
+                    return cached.descriptor_set;
+                }
+            }
+        }
+
+        InstanceDescriptorSet instance_set;
+        instance_set.set_index = set_index;
+        instance_set.descriptor_set = m_descriptor_allocator->Alloc(set_index);
+        this->BindInstanceDescriptorSet(instance_set, buffers);
+
+        if (m_instance_descriptor_sets.TryGet(key, &chain))
+        {
+            chain->Add(instance_set);
+        }
         else
         {
-            VkPipeline pipeline;
-            Display::Instance()->CreatePipeline(
-                render_pass,
-                m_vs_module,
-                m_fs_module,
-                m_render_state,
-                m_pipeline_layout,
-                m_pipeline_cache,
-                &pipeline,
-                color_attachment,
-                depth_attachment);
-            m_pipelines.Add(render_pass, pipeline);
+            m_instance_descriptor_sets.Add(key, Vector<InstanceDescriptorSet>({ instance_set }));
+        }
+
+        return instance_set.descriptor_set;
+    }
 
-            return pipeline;
+    void Shader::SweepInstanceDescriptorSets()
+    {
+        std::lock_guard<Mutex> lock(m_shader_list_mutex);
+
+        for (auto i : m_shaders)
+        {
+            i->FreeExpiredInstanceDescriptorSets();
         }
     }
 
-    void Shader::CreateDescriptorSets(Vector<VkDescriptorSet>& descriptor_sets, Vector<UniformSet>& uniform_sets)
+    void Shader::FreeExpiredInstanceDescriptorSets()
     {
-        Display::Instance()->CreateDescriptorSets(
-            m_uniform_sets,
-            m_descriptor_pool,
-            m_descriptor_layouts,
-            descriptor_sets);
-        uniform_sets = m_uniform_sets;
+        // sets of destroyed buffers go back to the allocator, which reuses them once frames in flight are done,
+        // so a new buffer at the address of a destroyed one gets a new set and bound sets are never rewritten
+        for (auto i = m_instance_descriptor_sets.begin(); i != m_instance_descriptor_sets.end(); )
+        {
+            Vector<InstanceDescriptorSet>& sets = i->second;
+            for (int j = 0; j < sets.Size(); )
+            {
+                bool expired = false;
+                for (int k = 0; k < sets[j].buffers.Size(); ++k)
+                {
+                    if (sets[j].sizes[k] > 0 && sets[j].buffers[k].expired())
+                    {
+                        expired = true;
+                        break;
+                    }
+                }
+
+                if (expired)
+                {
+                    m_descriptor_allocator->Free(sets[j].set_index, sets[j].descriptor_set);
+                    sets.Remove(j);
+                }
+                else
+                {
+                    ++j;
+                }
+            }
+
+            if (sets.Empty())
+            {
+                i = m_instance_descriptor_sets.Remove(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    void Shader::BindInstanceDescriptorSet(InstanceDescriptorSet& instance_set, const Vector<UniformBuffer>& buffers)
+    {
+        instance_set.buffers.Resize(buffers.Size());
+        instance_set.sizes.Resize(buffers.Size());
+        for (int i = 0; i < buffers.Size(); ++i)
+        {
+            instance_set.buffers[i] = buffers[i].buffer;
+            instance_set.sizes[i] = GetBoundSize(buffers[i]);
+
+            if (buffers[i].buffer)
+            {
+                Display::Instance()->BindUniformBuffer(instance_set.descriptor_set, buffers[i]);
+            }
+        }
+    }
+
+    DescriptorStats Shader::GetDescriptorStats()
+    {
+        std::lock_guard<Mutex> lock(m_shader_list_mutex);
+
+        DescriptorStats stats;
+        for (auto i : m_shaders)
+        {
+            i->m_descriptor_allocator->GetStats(stats);
+            for (const auto& j : i->m_instance_descriptor_sets)
+            {
+                stats.cached_set_count += j.second.Size();
+            }
+        }
+
+        return stats;
     }
 }
@@ -19,19 +19,45 @@
 
 #include "Display.h"
 #include "RenderState.h"
+#include "DescriptorAllocator.h"
 #include "string/String.h"
 #include "container/List.h"
 #include "container/Map.h"
+#include "thread/ThreadPool.h"
 
 namespace Viry3D
 {
+    // location of a property in the uniform sets of a shader, buffer_index or texture_index is -1
+    struct ShaderProperty
+    {
+        int set_index = -1;
+        int buffer_index = -1;
+        int texture_index = -1;
+        int offset = 0;
+        int size = 0;
+    };
+
+    class BufferObject;
+
     class Shader
     {
     public:
+        // ids are shared by all shaders and stay valid for the whole run
+        static int PropertyToID(const String& name);
 		static Ref<Shader> Find(const String& name);
 		static void AddCache(const String& name, const Ref<Shader>& shader);
 		static void Done();
-        static void OnRenderPassDestroy(VkRenderPass render_pass);
+        // descriptor pools and sets of all shaders
+        static DescriptorStats GetDescriptorStats();
+        // frees cached instance sets of destroyed buffers, called once per frame
+        static void SweepInstanceDescriptorSets();
+        // builds pipelines of every shader for every pass key on the thread, call while loading.
+        // complete is posted to the main thread when all pipelines are ready.
+        static void PrewarmPipelines(
+            const Vector<Ref<Shader>>& shaders,
+            const Vector<RenderPassKey>& pass_keys,
+            Thread* thread,
+            const std::function<void()>& complete = std::function<void()>());
         Shader(
             const String& vs_predefine,
             const Vector<String>& vs_includes,
@@ -42,21 +68,63 @@ namespace Viry3D
             const RenderState& render_state);
         ~Shader();
         const RenderState& GetRenderState() const { return m_render_state; }
-        VkPipeline GetPipeline(VkRenderPass render_pass, bool color_attachment, bool depth_attachment);
+        VkPipeline GetPipeline(const RenderPassKey& pass_key);
         void CreateDescriptorSets(Vector<VkDescriptorSet>& descriptor_sets, Vector<UniformSet>& uniform_sets);
+        // sets are reused by other materials once frames in flight are done with them
+        void FreeDescriptorSets(const Vector<VkDescriptorSet>& descriptor_sets);
+        VkDescriptorSet AllocDescriptorSet(int set_index);
+        void FreeDescriptorSet(int set_index, VkDescriptorSet descriptor_set);
+        const Vector<UniformSet>& GetUniformSets() const { return m_uniform_sets; }
+        // descriptor set of the set index bound to the buffers of the blocks, cached by buffer hash,
+        // blocks on the same buffers differ only by dynamic offset, so property blocks share it
+        VkDescriptorSet GetInstanceDescriptorSet(int set_index, const Vector<UniformBuffer>& buffers);
         VkPipelineLayout GetPipelineLayout() const { return m_pipeline_layout; }
+        // vertex shader reads the model matrix from the per instance stream
+        bool IsInstancing() const { return m_instancing; }
+        // null if the shader has no such property
+        const ShaderProperty* GetProperty(int id) const
+        {
+            if (id >= 0 && id < m_properties.Size() && m_properties[id].set_index >= 0)
+            {
+                return &m_properties[id];
+            }
+            return nullptr;
+        }
+
+    private:
+        struct InstanceDescriptorSet
+        {
+            int set_index;
+            Vector<WeakRef<BufferObject>> buffers;
+            Vector<int> sizes;
+            VkDescriptorSet descriptor_set;
+        };
+
+    private:
+        void BuildPropertyTable();
+        void BindInstanceDescriptorSet(InstanceDescriptorSet& instance_set, const Vector<UniformBuffer>& buffers);
+        void FreeExpiredInstanceDescriptorSets();
 
     private:
         static List<Shader*> m_shaders;
+        static Mutex m_shader_list_mutex;
+        static Map<String, int> m_property_ids;
+        static Mutex m_property_id_mutex;
 		static Map<String, Ref<Shader>> m_shader_cache;
         RenderState m_render_state;
         VkShaderModule m_vs_module;
         VkShaderModule m_fs_module;
         Vector<UniformSet> m_uniform_sets;
-        VkPipelineCache m_pipeline_cache;
         Vector<VkDescriptorSetLayout> m_descriptor_layouts;
         VkPipelineLayout m_pipeline_layout;
-        VkDescriptorPool m_descriptor_pool;
-        Map<VkRenderPass, VkPipeline> m_pipelines;
+        DescriptorAllocator* m_descriptor_allocator;
+        bool m_instancing;
+        // indexed by property id
+        Vector<ShaderProperty> m_properties;
+        // the render state is fixed per shader, so the pass key alone tells pipelines apart
+        Map<RenderPassKey, VkPipeline> m_pipelines;
+        // sets of different buffers with the same hash are chained under it
+        Map<uint64_t, Vector<InstanceDescriptorSet>> m_instance_descriptor_sets;
+        Mutex m_pipeline_mutex;
     };
 }
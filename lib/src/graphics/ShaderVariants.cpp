@@ -0,0 +1,216 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "ShaderVariants.h"
+#include "Debug.h"
+
+namespace Viry3D
+{
+    ShaderVariants::ShaderVariants(
+        const Vector<ShaderKeyword>& keywords,
+        const Vector<String>& vs_includes,
+        const String& vs_source,
+        const Vector<String>& fs_includes,
+        const String& fs_source):
+        m_keywords(keywords),
+        m_vs_includes(vs_includes),
+        m_vs_source(vs_source),
+        m_fs_includes(fs_includes),
+        m_fs_source(fs_source)
+    {
+        assert(m_keywords.Size() <= 32);
+    }
+
+    uint32_t ShaderVariants::GetKeywordBit(const String& name) const
+    {
+        for (int i = 0; i < m_keywords.Size(); ++i)
+        {
+            if (m_keywords[i].name == name)
+            {
+                return 1u << i;
+            }
+        }
+
+        return 0;
+    }
+
+    uint32_t ShaderVariants::GetKeywordMask(const Vector<String>& names) const
+    {
+        uint32_t mask = 0;
+        for (int i = 0; i < names.Size(); ++i)
+        {
+            mask |= this->GetKeywordBit(names[i]);
+        }
+
+        return mask;
+    }
+
+    ShaderVariants::VariantKey ShaderVariants::GetVariantKey(uint32_t keyword_mask, const RenderState& render_state)
+    {
+        VariantKey key;
+        key.keyword_mask = keyword_mask;
+        key.render_state = render_state;
+        return key;
+    }
+
+    Ref<Shader> ShaderVariants::CreateVariant(uint32_t keyword_mask, const RenderState& render_state) const
+    {
+        String predefine;
+        Vector<String> vs_includes;
+        Vector<String> fs_includes;
+
+        for (int i = 0; i < m_keywords.Size(); ++i)
+        {
+            if (keyword_mask & (1u << i))
+            {
+                const ShaderKeyword& keyword = m_keywords[i];
+
+                predefine += "#define " + keyword.name + " 1\n";
+                for (int j = 0; j < keyword.vs_includes.Size(); ++j)
+                {
+                    vs_includes.Add(keyword.vs_includes[j]);
+                }
+                for (int j = 0; j < keyword.fs_includes.Size(); ++j)
+                {
+                    fs_includes.Add(keyword.fs_includes[j]);
+                }
+            }
+        }
+
+        for (int i = 0; i < m_vs_includes.Size(); ++i)
+        {
+            vs_includes.Add(m_vs_includes[i]);
+        }
+        for (int i = 0; i < m_fs_includes.Size(); ++i)
+        {
+            fs_includes.Add(m_fs_includes[i]);
+        }
+
+        return RefMake<Shader>(
+            predefine,
+            vs_includes,
+            m_vs_source,
+            predefine,
+            fs_includes,
+            m_fs_source,
+            render_state);
+    }
+
+    Ref<Shader> ShaderVariants::AddVariant(const VariantKey& key, const Ref<Shader>& shader)
+    {
+        std::lock_guard<Mutex> lock(m_mutex);
+
+        // another thread may have built the same variant meanwhile, keep the first
+        m_variants.Add(key, shader);
+
+        Ref<Shader>* shader_ptr;
+        m_variants.TryGet(key, &shader_ptr);
+        return *shader_ptr;
+    }
+
+    Ref<Shader> ShaderVariants::GetVariant(uint32_t keyword_mask, const RenderState& render_state)
+    {
+        VariantKey key = GetVariantKey(keyword_mask, render_state);
+
+        {
+            std::lock_guard<Mutex> lock(m_mutex);
+
+            Ref<Shader>* shader_ptr;
+            if (m_variants.TryGet(key, &shader_ptr))
+            {
+                return *shader_ptr;
+            }
+        }
+
+        // compile outside the lock so precompile threads do not block other variants
+        return this->AddVariant(key, this->CreateVariant(keyword_mask, render_state));
+    }
+
+    void ShaderVariants::Precompile(
+        const Vector<uint32_t>& keyword_masks,
+        const RenderState& render_state,
+        ThreadPool* pool,
+        const std::function<void()>& complete)
+    {
+        Vector<uint32_t> masks;
+        {
+            std::lock_guard<Mutex> lock(m_mutex);
+
+            for (int i = 0; i < keyword_masks.Size(); ++i)
+            {
+                VariantKey key = GetVariantKey(keyword_masks[i], render_state);
+                if (m_variants.Contains(key))
+                {
+                    continue;
+                }
+
+                bool added = false;
+                for (int j = 0; j < masks.Size(); ++j)
+                {
+                    if (masks[j] == keyword_masks[i])
+                    {
+                        added = true;
+                        break;
+                    }
+                }
+                if (!added)
+                {
+                    masks.Add(keyword_masks[i]);
+                }
+            }
+        }
+
+        if (masks.Size() == 0)
+        {
+            if (complete)
+            {
+                complete();
+            }
+            return;
+        }
+
+        // completes run on the main thread, the last one reports
+        Ref<int> remain_count = RefMake<int>(masks.Size());
+
+        for (int i = 0; i < masks.Size(); ++i)
+        {
+            uint32_t mask = masks[i];
+
+            Thread::Task task;
+            task.job = [=]() {
+                VariantKey key = GetVariantKey(mask, render_state);
+                this->AddVariant(key, this->CreateVariant(mask, render_state));
+
+                return Ref<Object>();
+            };
+            task.complete = [=](const Ref<Object>&) {
+                (*remain_count)--;
+                if (*remain_count == 0 && complete)
+                {
+                    complete();
+                }
+            };
+            pool->AddTask(task);
+        }
+    }
+
+    int ShaderVariants::GetVariantCount()
+    {
+        std::lock_guard<Mutex> lock(m_mutex);
+        return m_variants.Size();
+    }
+}
@@ -0,0 +1,88 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "Shader.h"
+
+namespace Viry3D
+{
+    struct ShaderKeyword
+    {
+        String name;
+        // included before the source includes when the keyword is on
+        Vector<String> vs_includes;
+        Vector<String> fs_includes;
+    };
+
+    // one shader source compiled per keyword combination.
+    // keywords are declared once, a variant is asked by keyword bitmask and built once per mask and render state,
+    // an enabled keyword is defined as 1 in both stages.
+    class ShaderVariants
+    {
+    public:
+        ShaderVariants(
+            const Vector<ShaderKeyword>& keywords,
+            const Vector<String>& vs_includes,
+            const String& vs_source,
+            const Vector<String>& fs_includes,
+            const String& fs_source);
+        // 0 if the keyword is not declared
+        uint32_t GetKeywordBit(const String& name) const;
+        uint32_t GetKeywordMask(const Vector<String>& names) const;
+        Ref<Shader> GetVariant(uint32_t keyword_mask, const RenderState& render_state = RenderState());
+        // builds the variants not built yet on the pool threads, complete is posted to the main thread when all are ready.
+        // spirv is cached on disk by source, so a precompile pass run offline saves the glsl compile of later runs.
+        // keep the variants alive until complete.
+        void Precompile(
+            const Vector<uint32_t>& keyword_masks,
+            const RenderState& render_state,
+            ThreadPool* pool,
+            const std::function<void()>& complete = std::function<void()>());
+        int GetVariantCount();
+
+    private:
+        struct VariantKey
+        {
+            uint32_t keyword_mask;
+            RenderState render_state;
+
+            bool operator <(const VariantKey& key) const
+            {
+                if (keyword_mask != key.keyword_mask)
+                {
+                    return keyword_mask < key.keyword_mask;
+                }
+                return render_state < key.render_state;
+            }
+        };
+
+    private:
+        static VariantKey GetVariantKey(uint32_t keyword_mask, const RenderState& render_state);
+        Ref<Shader> CreateVariant(uint32_t keyword_mask, const RenderState& render_state) const;
+        Ref<Shader> AddVariant(const VariantKey& key, const Ref<Shader>& shader);
+
+    private:
+        Vector<ShaderKeyword> m_keywords;
+        Vector<String> m_vs_includes;
+        String m_vs_source;
+        Vector<String> m_fs_includes;
+        String m_fs_source;
+        Map<VariantKey, Ref<Shader>> m_variants;
+        Mutex m_mutex;
+    };
+}
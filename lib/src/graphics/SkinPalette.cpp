@@ -0,0 +1,139 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "SkinPalette.h"
+#include "Display.h"
+#include "BufferObject.h"
+#include "Mesh.h"
+#include "Node.h"
+#include "Debug.h"
+
+namespace Viry3D
+{
+    List<WeakRef<SkinPalette>> SkinPalette::m_palettes;
+
+    Ref<SkinPalette> SkinPalette::Get(const Ref<Node>& bones_root, const Ref<Mesh>& mesh, const Vector<String>& bone_paths)
+    {
+        // bone paths come with the mesh, so root and mesh identify a palette
+        for (auto i = m_palettes.begin(); i != m_palettes.end(); )
+        {
+            Ref<SkinPalette> palette = i->lock();
+            if (!palette)
+            {
+                i = m_palettes.Remove(i);
+                continue;
+            }
+
+            if (palette->m_mesh == mesh && palette->m_bones_root.lock() == bones_root)
+            {
+                return palette;
+            }
+
+            ++i;
+        }
+
+        Ref<SkinPalette> palette = RefMake<SkinPalette>(bones_root, mesh, bone_paths);
+        m_palettes.AddLast(palette);
+
+        return palette;
+    }
+
+    SkinPalette::SkinPalette(const Ref<Node>& bones_root, const Ref<Mesh>& mesh, const Vector<String>& bone_paths):
+        m_bones_root(bones_root),
+        m_mesh(mesh),
+        m_bone_paths(bone_paths),
+        m_bones_version(0),
+        m_update_frame(-1)
+    {
+        // 3 rows of each bone matrix
+        m_buffer.binding = 0;
+        m_buffer.stage = 0;
+        m_buffer.size = mesh->GetBindposes().Size() * 3 * sizeof(Vector4);
+        m_buffer.buffer = Display::Instance()->CreateBuffer(nullptr, m_buffer.size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true);
+        m_buffer.offset = 0;
+        m_buffer.dirty = false;
+        m_buffer.shared = false;
+        m_buffer.storage = true;
+    }
+
+    SkinPalette::~SkinPalette()
+    {
+        Display::Instance()->RetireBuffer(m_buffer.buffer);
+    }
+
+    void SkinPalette::FindBones()
+    {
+        auto root = m_bones_root.lock();
+        const auto& root_name = root->GetName();
+
+        // bone paths start with the root name
+        auto bones = root->FindAll(m_bone_paths, root_name + "/");
+        m_bones_version = root->GetSubtreeVersion();
+
+        m_bones.Resize(m_bone_paths.Size());
+        for (int i = 0; i < m_bones.Size(); ++i)
+        {
+            m_bones[i] = bones[i].get();
+
+            if (m_bones[i] == nullptr)
+            {
+                Log("can not find bone: %s", m_bone_paths[i].CString());
+            }
+        }
+    }
+
+    void SkinPalette::Update()
+    {
+        // renderers of every camera share the result of the frame
+        int frame = Display::Instance()->GetFrameCount();
+        Ref<Node> root = m_bones_root.lock();
+        if (m_update_frame == frame || !root)
+        {
+            return;
+        }
+        m_update_frame = frame;
+
+        // a bone may have been moved out of the skeleton and destroyed
+        if (m_bones.Empty() || root->GetSubtreeVersion() != m_bones_version)
+        {
+            this->FindBones();
+        }
+
+        const auto& bindposes = m_mesh->GetBindposes();
+        int bone_count = bindposes.Size();
+
+        Vector4* rows = (Vector4*) Display::Instance()->MapBufferUpdate(m_buffer.buffer, 0, m_buffer.size);
+
+        for (int i = 0; i < bone_count; ++i)
+        {
+            if (m_bones[i])
+            {
+                Matrix4x4 mat = m_bones[i]->GetLocalToWorldMatrix() * bindposes[i];
+
+                rows[i * 3 + 0] = mat.GetRow(0);
+                rows[i * 3 + 1] = mat.GetRow(1);
+                rows[i * 3 + 2] = mat.GetRow(2);
+            }
+            else
+            {
+                rows[i * 3 + 0] = Vector4(1, 0, 0, 0);
+                rows[i * 3 + 1] = Vector4(0, 1, 0, 0);
+                rows[i * 3 + 2] = Vector4(0, 0, 1, 0);
+            }
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "UniformSet.h"
+#include "container/List.h"
+
+namespace Viry3D
+{
+    class Node;
+    class Mesh;
+
+    // bone palette of one skeleton skinning one mesh.
+    // every renderer and camera pass drawing that skin shares it,
+    // it is computed once per frame straight into the staging memory of one storage buffer,
+    // so the bone count is only limited by the storage buffer range.
+    class SkinPalette
+    {
+    public:
+        static Ref<SkinPalette> Get(const Ref<Node>& bones_root, const Ref<Mesh>& mesh, const Vector<String>& bone_paths);
+        SkinPalette(const Ref<Node>& bones_root, const Ref<Mesh>& mesh, const Vector<String>& bone_paths);
+        ~SkinPalette();
+        Ref<Node> GetBonesRoot() const { return m_bones_root.lock(); }
+        const Ref<Mesh>& GetMesh() const { return m_mesh; }
+        void Update();
+        const UniformBuffer& GetUniformBuffer() const { return m_buffer; }
+
+    private:
+        void FindBones();
+
+    private:
+        static List<WeakRef<SkinPalette>> m_palettes;
+        WeakRef<Node> m_bones_root;
+        Ref<Mesh> m_mesh;
+        Vector<String> m_bone_paths;
+        // a bone is held by its parent, so it lives while it is below the root,
+        // bones are found again when the subtree of the root changes
+        Vector<Node*> m_bones;
+        uint32_t m_bones_version;
+        UniformBuffer m_buffer;
+        int m_update_frame;
+    };
+}
@@ -16,11 +16,11 @@
 */
 
 #include "SkinnedMeshRenderer.h"
+#include "SkinPalette.h"
+#include "Shader.h"
 #include "Mesh.h"
 #include "Debug.h"
 
-#define BONE_MAX 70
-
 namespace Viry3D
 {
     SkinnedMeshRenderer::SkinnedMeshRenderer()
@@ -33,26 +33,6 @@ namespace Viry3D
 
     }
 
-    void SkinnedMeshRenderer::FindBones()
-    {
-        auto root = m_bones_root.lock();
-        const auto& root_name = root->GetName();
-
-        m_bones.Resize(m_bone_paths.Size());
-        for (int i = 0; i < m_bones.Size(); ++i)
-        {
-            if (m_bone_paths[i].StartsWith(root_name))
-            {
-                m_bones[i] = root->Find(m_bone_paths[i].Substring(root_name.Size() + 1));
-            }
-            
-            if (m_bones[i].expired())
-            {
-                Log("can not find bone: %s", m_bone_paths[i].CString());
-            }
-        }
-    }
-
     void SkinnedMeshRenderer::Update()
     {
         const auto& material = this->GetMaterial();
@@ -60,29 +40,17 @@ namespace Viry3D
 
         if (material && mesh && m_bone_paths.Size() > 0)
         {
-            const auto& bindposes = mesh->GetBindposes();
-            int bone_count = bindposes.Size();
-
-            assert(m_bone_paths.Size() == bone_count);
-            assert(m_bone_paths.Size() <= BONE_MAX);
-
-            if (m_bones.Empty())
-            {
-                this->FindBones();
-            }
+            assert(m_bone_paths.Size() == mesh->GetBindposes().Size());
 
-            Vector<Vector4> bone_vectors(bone_count * 3);
-
-            for (int i = 0; i < bone_count; ++i)
+            auto bones_root = m_bones_root.lock();
+            if (!m_palette || m_palette->GetMesh() != mesh || m_palette->GetBonesRoot() != bones_root)
             {
-                Matrix4x4 mat = m_bones[i].lock()->GetLocalToWorldMatrix() * bindposes[i];
-
-                bone_vectors[i * 3 + 0] = mat.GetRow(0);
-                bone_vectors[i * 3 + 1] = mat.GetRow(1);
-                bone_vectors[i * 3 + 2] = mat.GetRow(2);
+                m_palette = SkinPalette::Get(bones_root, mesh, m_bone_paths);
             }
 
-            this->SetInstanceVectorArray("u_bones", bone_vectors);
+            m_palette->Update();
+            static const int bones_id = Shader::PropertyToID("u_bones");
+            this->SetInstanceUniformBuffer(bones_id, m_palette->GetUniformBuffer());
         }
 
         MeshRenderer::Update();
@@ -21,23 +21,25 @@
 
 namespace Viry3D
 {
+    class SkinPalette;
+
     class SkinnedMeshRenderer : public MeshRenderer
     {
     public:
         SkinnedMeshRenderer();
         virtual ~SkinnedMeshRenderer();
         virtual void Update();
+        // skinned vertices follow the bones, not this node
+        virtual bool GetLocalBounds(Bounds* bounds) const { return false; }
         const Vector<String>& GetBonePaths() const { return m_bone_paths; }
         void SetBonePaths(const Vector<String>& bones) { m_bone_paths = bones; }
         Ref<Node> GetBonesRoot() const { return m_bones_root.lock(); }
         void SetBonesRoot(const Ref<Node>& node) { m_bones_root = node; }
-
-    private:
-        void FindBones();
+        const Ref<SkinPalette>& GetSkinPalette() const { return m_palette; }
 
     private:
         Vector<String> m_bone_paths;
         WeakRef<Node> m_bones_root;
-        Vector<WeakRef<Node>> m_bones;
+        Ref<SkinPalette> m_palette;
     };
 }
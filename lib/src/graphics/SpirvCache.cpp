@@ -0,0 +1,346 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "SpirvCache.h"
+#include "io/File.h"
+#include "memory/Memory.h"
+#include "Debug.h"
+
+#define SPIRV_CACHE_MAGIC 0x43505356
+// bump when the file layout, the reflection data or the glsl compiler changes
+#define SPIRV_CACHE_VERSION 1
+
+namespace Viry3D
+{
+    struct SpirvCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t entry_count;
+        uint32_t file_size;
+    };
+
+    struct SpirvCacheEntry
+    {
+        uint64_t key_low;
+        uint64_t key_high;
+        uint32_t spirv_offset;
+        uint32_t spirv_size;
+        uint32_t reflection_offset;
+        uint32_t reflection_size;
+    };
+
+    static inline uint64_t Rotl64(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static inline uint64_t Fmix64(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    SpirvCacheKey SpirvCache::Hash(const void* data, int size, uint32_t seed)
+    {
+        const byte* bytes = (const byte*) data;
+        const int block_count = size / 16;
+        const uint64_t c1 = 0x87c37b91114253d5ULL;
+        const uint64_t c2 = 0x4cf5ad432745937fULL;
+        uint64_t h1 = seed;
+        uint64_t h2 = seed;
+
+        for (int i = 0; i < block_count; ++i)
+        {
+            uint64_t k1;
+            uint64_t k2;
+            Memory::Copy(&k1, &bytes[i * 16], 8);
+            Memory::Copy(&k2, &bytes[i * 16 + 8], 8);
+
+            k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+            h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+            k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+            h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+        }
+
+        const byte* tail = &bytes[block_count * 16];
+        int tail_size = size & 15;
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+
+        for (int i = tail_size - 1; i >= 8; --i)
+        {
+            k2 ^= ((uint64_t) tail[i]) << ((i - 8) * 8);
+        }
+        if (tail_size > 8)
+        {
+            k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        }
+
+        for (int i = (tail_size < 8 ? tail_size : 8) - 1; i >= 0; --i)
+        {
+            k1 ^= ((uint64_t) tail[i]) << (i * 8);
+        }
+        if (tail_size > 0)
+        {
+            k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        }
+
+        h1 ^= (uint64_t) size;
+        h2 ^= (uint64_t) size;
+        h1 += h2;
+        h2 += h1;
+        h1 = Fmix64(h1);
+        h2 = Fmix64(h2);
+        h1 += h2;
+        h2 += h1;
+
+        SpirvCacheKey key;
+        key.low = h1;
+        key.high = h2;
+        return key;
+    }
+
+    SpirvCache::SpirvCache(const String& path):
+        m_path(path),
+        m_file_entry_count(0)
+    {
+        this->Load();
+    }
+
+    void SpirvCache::Load()
+    {
+        if (!File::Exist(m_path))
+        {
+            return;
+        }
+
+        ByteBuffer buffer = File::ReadAllBytes(m_path);
+        if (buffer.Size() < (int) sizeof(SpirvCacheHeader))
+        {
+            return;
+        }
+
+        SpirvCacheHeader header;
+        Memory::Copy(&header, buffer.Bytes(), sizeof(header));
+
+        if (header.magic != SPIRV_CACHE_MAGIC ||
+            header.version != SPIRV_CACHE_VERSION ||
+            header.file_size != (uint32_t) buffer.Size() ||
+            sizeof(header) + (size_t) header.entry_count * sizeof(SpirvCacheEntry) > (size_t) buffer.Size())
+        {
+            Log("spirv cache of another version, ignored");
+            return;
+        }
+
+        m_file = buffer;
+        m_file_entry_count = (int) header.entry_count;
+    }
+
+    int SpirvCache::FindFileEntry(const SpirvCacheKey& key) const
+    {
+        if (m_file_entry_count == 0)
+        {
+            return -1;
+        }
+
+        const SpirvCacheEntry* entries = (const SpirvCacheEntry*) (m_file.Bytes() + sizeof(SpirvCacheHeader));
+
+        int begin = 0;
+        int end = m_file_entry_count;
+        while (begin < end)
+        {
+            int middle = (begin + end) / 2;
+
+            SpirvCacheKey middle_key;
+            middle_key.low = entries[middle].key_low;
+            middle_key.high = entries[middle].key_high;
+
+            if (middle_key == key)
+            {
+                return middle;
+            }
+            else if (middle_key < key)
+            {
+                begin = middle + 1;
+            }
+            else
+            {
+                end = middle;
+            }
+        }
+
+        return -1;
+    }
+
+    bool SpirvCache::Find(const SpirvCacheKey& key, Vector<unsigned int>& spirv, Vector<byte>& reflection)
+    {
+        std::lock_guard<Mutex> lock(m_mutex);
+
+        Entry* added;
+        if (m_added.TryGet(key, &added))
+        {
+            spirv = added->spirv;
+            reflection = added->reflection;
+            return true;
+        }
+
+        int index = this->FindFileEntry(key);
+        if (index < 0)
+        {
+            return false;
+        }
+
+        const SpirvCacheEntry* entries = (const SpirvCacheEntry*) (m_file.Bytes() + sizeof(SpirvCacheHeader));
+        const SpirvCacheEntry& entry = entries[index];
+        if ((size_t) entry.spirv_offset + entry.spirv_size > (size_t) m_file.Size() ||
+            (size_t) entry.reflection_offset + entry.reflection_size > (size_t) m_file.Size())
+        {
+            return false;
+        }
+
+        spirv.Resize(entry.spirv_size / 4);
+        Memory::Copy(&spirv[0], m_file.Bytes() + entry.spirv_offset, entry.spirv_size);
+        reflection.Resize(entry.reflection_size);
+        if (entry.reflection_size > 0)
+        {
+            Memory::Copy(&reflection[0], m_file.Bytes() + entry.reflection_offset, entry.reflection_size);
+        }
+
+        return true;
+    }
+
+    void SpirvCache::Add(const SpirvCacheKey& key, const Vector<unsigned int>& spirv, const Vector<byte>& reflection)
+    {
+        std::lock_guard<Mutex> lock(m_mutex);
+
+        Entry entry;
+        entry.spirv = spirv;
+        entry.reflection = reflection;
+        m_added.Add(key, entry);
+    }
+
+    void SpirvCache::Save()
+    {
+        std::lock_guard<Mutex> lock(m_mutex);
+
+        if (m_added.Empty())
+        {
+            return;
+        }
+
+        // merge the file entries with the added ones, the index stays sorted by key
+        Map<SpirvCacheKey, SpirvCacheEntry> index;
+        for (int i = 0; i < m_file_entry_count; ++i)
+        {
+            const SpirvCacheEntry* file_entries = (const SpirvCacheEntry*) (m_file.Bytes() + sizeof(SpirvCacheHeader));
+
+            SpirvCacheKey key;
+            key.low = file_entries[i].key_low;
+            key.high = file_entries[i].key_high;
+            index.Add(key, file_entries[i]);
+        }
+        for (const auto& i : m_added)
+        {
+            SpirvCacheEntry entry;
+            Memory::Zero(&entry, sizeof(entry));
+            entry.key_low = i.first.low;
+            entry.key_high = i.first.high;
+            entry.spirv_size = (uint32_t) i.second.spirv.SizeInBytes();
+            entry.reflection_size = (uint32_t) i.second.reflection.Size();
+            index.Add(i.first, entry);
+        }
+
+        int data_offset = (int) (sizeof(SpirvCacheHeader) + index.Size() * sizeof(SpirvCacheEntry));
+        int file_size = data_offset;
+        for (const auto& i : index)
+        {
+            file_size += (i.second.spirv_size + 3) & ~3;
+            file_size += (i.second.reflection_size + 3) & ~3;
+        }
+
+        ByteBuffer buffer(file_size);
+        Memory::Zero(buffer.Bytes(), buffer.Size());
+
+        SpirvCacheHeader header;
+        header.magic = SPIRV_CACHE_MAGIC;
+        header.version = SPIRV_CACHE_VERSION;
+        header.entry_count = (uint32_t) index.Size();
+        header.file_size = (uint32_t) file_size;
+        Memory::Copy(buffer.Bytes(), &header, sizeof(header));
+
+        SpirvCacheEntry* entries = (SpirvCacheEntry*) (buffer.Bytes() + sizeof(SpirvCacheHeader));
+        int entry_index = 0;
+        int offset = data_offset;
+        for (const auto& i : index)
+        {
+            SpirvCacheEntry entry = i.second;
+            const byte* spirv = nullptr;
+            const byte* reflection = nullptr;
+
+            Entry* added;
+            if (m_added.TryGet(i.first, &added))
+            {
+                spirv = added->spirv.Bytes();
+                reflection = added->reflection.Size() > 0 ? &added->reflection[0] : nullptr;
+            }
+            else
+            {
+                spirv = m_file.Bytes() + entry.spirv_offset;
+                reflection = m_file.Bytes() + entry.reflection_offset;
+            }
+
+            entry.spirv_offset = (uint32_t) offset;
+            Memory::Copy(buffer.Bytes() + offset, spirv, entry.spirv_size);
+            offset += (entry.spirv_size + 3) & ~3;
+
+            entry.reflection_offset = (uint32_t) offset;
+            if (entry.reflection_size > 0)
+            {
+                Memory::Copy(buffer.Bytes() + offset, reflection, entry.reflection_size);
+            }
+            offset += (entry.reflection_size + 3) & ~3;
+
+            entries[entry_index++] = entry;
+        }
+
+        File::WriteAllBytes(m_path, buffer);
+
+        m_file = buffer;
+        m_file_entry_count = index.Size();
+        m_added.Clear();
+    }
+
+    void SpirvCache::Clear()
+    {
+        std::lock_guard<Mutex> lock(m_mutex);
+
+        m_file = ByteBuffer();
+        m_file_entry_count = 0;
+        m_added.Clear();
+
+        if (File::Exist(m_path))
+        {
+            File::Delete(m_path);
+        }
+    }
+}
@@ -0,0 +1,77 @@
+/*
+* Viry3D
+* Copyright 2014-2018 by Stack - stackos@qq.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include "container/Vector.h"
+#include "container/Map.h"
+#include "memory/ByteBuffer.h"
+#include "string/String.h"
+#include "thread/ThreadPool.h"
+
+namespace Viry3D
+{
+    struct SpirvCacheKey
+    {
+        uint64_t low;
+        uint64_t high;
+
+        bool operator <(const SpirvCacheKey& key) const
+        {
+            return high < key.high || (high == key.high && low < key.low);
+        }
+        bool operator ==(const SpirvCacheKey& key) const
+        {
+            return low == key.low && high == key.high;
+        }
+    };
+
+    // compiled spirv and reflection data of every shader stage in one file.
+    // the file is a header, an index sorted by key and 4 byte aligned data, so it is read once and used in place.
+    // a file of another format version is dropped as a whole, new entries are written back on Save.
+    class SpirvCache
+    {
+    public:
+        // 128 bit murmur3 of the data, seed separates stages with equal source
+        static SpirvCacheKey Hash(const void* data, int size, uint32_t seed);
+        SpirvCache(const String& path);
+        bool Find(const SpirvCacheKey& key, Vector<unsigned int>& spirv, Vector<byte>& reflection);
+        void Add(const SpirvCacheKey& key, const Vector<unsigned int>& spirv, const Vector<byte>& reflection);
+        // writes the file only if entries were added
+        void Save();
+        // drops all entries and the file
+        void Clear();
+
+    private:
+        struct Entry
+        {
+            Vector<unsigned int> spirv;
+            Vector<byte> reflection;
+        };
+
+    private:
+        void Load();
+        int FindFileEntry(const SpirvCacheKey& key) const;
+
+    private:
+        String m_path;
+        ByteBuffer m_file;
+        int m_file_entry_count;
+        Map<SpirvCacheKey, Entry> m_added;
+        Mutex m_mutex;
+    };
+}
@@ -360,7 +360,7 @@ namespace Viry3D
 			VK_IMAGE_LAYOUT_UNDEFINED,
 			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 			(VkAccessFlagBits) 0);
-		Display::Instance()->EndImageCmd();
+		texture->m_upload_token = Display::Instance()->EndImageCmd();
 
         return texture;
     }
@@ -535,79 +535,28 @@ namespace Viry3D
 		m_shared_cubemap.reset();
 	}
 
-    void Texture::UpdateTexture2D(const ByteBuffer& pixels, int x, int y, int w, int h)
+    UploadToken Texture::UpdateTexture2D(const ByteBuffer& pixels, int x, int y, int w, int h)
     {
-        VkDevice device = Display::Instance()->GetDevice();
-
-        if (!m_image_buffer)
-        {
-            m_image_buffer = Display::Instance()->CreateBuffer(pixels.Bytes(), pixels.Size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-        }
-        else
-        {
-            Display::Instance()->UpdateBuffer(m_image_buffer, 0, pixels.Bytes(), pixels.Size());
-        }
-
         this->CopyBufferToImageBegin();
-        this->CopyBufferToImage(m_image_buffer, x, y, w, h, 0, 0);
-        this->CopyBufferToImageEnd();
-
-        if (!m_dynamic)
-        {
-            m_image_buffer->Destroy(device);
-            m_image_buffer.reset();
-        }
+        this->CopyPixelsToImage(pixels, x, y, w, h, 0, 0);
+        return this->CopyBufferToImageEnd();
     }
 
-    void Texture::UpdateCubemap(const ByteBuffer& pixels, CubemapFace face, int level)
+    UploadToken Texture::UpdateCubemap(const ByteBuffer& pixels, CubemapFace face, int level)
     {
-        VkDevice device = Display::Instance()->GetDevice();
-
-        if (!m_image_buffer || m_image_buffer->GetSize() < pixels.Size())
-        {
-            m_image_buffer = Display::Instance()->CreateBuffer(pixels.Bytes(), pixels.Size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-        }
-        else
-        {
-            Display::Instance()->UpdateBuffer(m_image_buffer, 0, pixels.Bytes(), pixels.Size());
-        }
-
         this->CopyBufferToImageBegin();
-        this->CopyBufferToImage(m_image_buffer, 0, 0, m_width >> level, m_height >> level, (int) face, level);
-        this->CopyBufferToImageEnd();
-
-        if (!m_dynamic)
-        {
-            m_image_buffer->Destroy(device);
-            m_image_buffer.reset();
-        }
+        this->CopyPixelsToImage(pixels, 0, 0, m_width >> level, m_height >> level, (int) face, level);
+        return this->CopyBufferToImageEnd();
     }
 
-    void Texture::UpdateTexture2DArray(const ByteBuffer& pixels, int layer, int level)
+    UploadToken Texture::UpdateTexture2DArray(const ByteBuffer& pixels, int layer, int level)
     {
-        VkDevice device = Display::Instance()->GetDevice();
-
-        if (!m_image_buffer || m_image_buffer->GetSize() < pixels.Size())
-        {
-            m_image_buffer = Display::Instance()->CreateBuffer(pixels.Bytes(), pixels.Size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-        }
-        else
-        {
-            Display::Instance()->UpdateBuffer(m_image_buffer, 0, pixels.Bytes(), pixels.Size());
-        }
-
         this->CopyBufferToImageBegin();
-        this->CopyBufferToImage(m_image_buffer, 0, 0, m_width >> level, m_height >> level, layer, level);
-        this->CopyBufferToImageEnd();
-
-        if (!m_dynamic)
-        {
-            m_image_buffer->Destroy(device);
-            m_image_buffer.reset();
-        }
+        this->CopyPixelsToImage(pixels, 0, 0, m_width >> level, m_height >> level, layer, level);
+        return this->CopyBufferToImageEnd();
     }
 
-    void Texture::CopyTexture(
+    UploadToken Texture::CopyTexture(
         const Ref<Texture>& src_texture,
         int src_layer, int src_level,
         int src_x, int src_y,
@@ -619,7 +568,7 @@ namespace Viry3D
 
         Display::Instance()->SetImageLayout(
             src_texture->GetImage(),
-            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
             VK_PIPELINE_STAGE_TRANSFER_BIT,
             { VK_IMAGE_ASPECT_COLOR_BIT, (uint32_t) src_level, 1, (uint32_t) src_layer, 1 },
             VK_IMAGE_LAYOUT_UNDEFINED,
@@ -628,7 +577,7 @@ namespace Viry3D
 
         Display::Instance()->SetImageLayout(
             m_image,
-            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
             VK_PIPELINE_STAGE_TRANSFER_BIT,
             { VK_IMAGE_ASPECT_COLOR_BIT, (uint32_t) level, 1, (uint32_t) layer, 1 },
             VK_IMAGE_LAYOUT_UNDEFINED,
@@ -670,7 +619,10 @@ namespace Viry3D
             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
             VK_ACCESS_TRANSFER_WRITE_BIT);
 
-        Display::Instance()->EndImageCmd();
+        m_upload_token = Display::Instance()->EndImageCmd();
+        src_texture->m_upload_token = m_upload_token;
+
+        return m_upload_token;
     }
 
     void Texture::CopyToMemory(ByteBuffer& pixels, int layer, int level)
@@ -681,7 +633,7 @@ namespace Viry3D
 
         Display::Instance()->SetImageLayout(
             m_image,
-            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
             VK_PIPELINE_STAGE_TRANSFER_BIT,
             { VK_IMAGE_ASPECT_COLOR_BIT, (uint32_t) level, 1, (uint32_t) layer, 1 },
             VK_IMAGE_LAYOUT_UNDEFINED,
@@ -714,7 +666,8 @@ namespace Viry3D
             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
             VK_ACCESS_TRANSFER_READ_BIT);
 
-        Display::Instance()->EndImageCmd();
+        UploadToken token = Display::Instance()->EndImageCmd();
+        Display::Instance()->WaitUpload(token);
 
         Display::Instance()->ReadBuffer(copy_buffer, pixels);
 
@@ -726,9 +679,10 @@ namespace Viry3D
     {
         Display::Instance()->BeginImageCmd();
 
+        // image cmds share the graphics queue, wait for earlier frames sampling the image
         Display::Instance()->SetImageLayout(
             m_image,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
             { VK_IMAGE_ASPECT_COLOR_BIT, 0, (uint32_t) m_mipmap_level_count, 0, (uint32_t) this->GetLayerCount() },
             VK_IMAGE_LAYOUT_UNDEFINED,
@@ -736,11 +690,22 @@ namespace Viry3D
             (VkAccessFlagBits) 0);
     }
     
-    void Texture::CopyBufferToImage(const Ref<BufferObject>& image_buffer, int x, int y, int w, int h, int layer, int level)
+    void Texture::CopyPixelsToImage(const ByteBuffer& pixels, int x, int y, int w, int h, int layer, int level)
+    {
+        // staging space is released when the upload batch completes
+        Ref<BufferObject> image_buffer;
+        int buffer_offset = 0;
+        void* data = Display::Instance()->MapImageStaging(pixels.Size(), image_buffer, &buffer_offset);
+        Memory::Copy(data, pixels.Bytes(), pixels.Size());
+
+        this->CopyBufferToImage(image_buffer, buffer_offset, x, y, w, h, layer, level);
+    }
+
+    void Texture::CopyBufferToImage(const Ref<BufferObject>& image_buffer, int buffer_offset, int x, int y, int w, int h, int layer, int level)
     {
         VkBufferImageCopy copy;
         Memory::Zero(&copy, sizeof(copy));
-        copy.bufferOffset = 0;
+        copy.bufferOffset = (VkDeviceSize) buffer_offset;
         copy.bufferRowLength = 0;
         copy.bufferImageHeight = 0;
         copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, (uint32_t) level, (uint32_t) layer, 1 };
@@ -756,7 +721,7 @@ namespace Viry3D
             &copy);
     }
 
-    void Texture::CopyBufferToImageEnd()
+    UploadToken Texture::CopyBufferToImageEnd()
     {
         Display::Instance()->SetImageLayout(
             m_image,
@@ -767,7 +732,9 @@ namespace Viry3D
             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
             VK_ACCESS_TRANSFER_WRITE_BIT);
 
-        Display::Instance()->EndImageCmd();
+        m_upload_token = Display::Instance()->EndImageCmd();
+
+        return m_upload_token;
     }
 
     int Texture::GetLayerCount()
@@ -784,7 +751,7 @@ namespace Viry3D
         return layer_count;
     }
 
-    void Texture::GenMipmaps()
+    UploadToken Texture::GenMipmaps()
     {
         assert(m_mipmap_level_count > 1);
 
@@ -817,7 +784,7 @@ namespace Viry3D
 
             Display::Instance()->SetImageLayout(
                 m_image,
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
 				VK_PIPELINE_STAGE_TRANSFER_BIT,
                 { VK_IMAGE_ASPECT_COLOR_BIT, (uint32_t) i, 1, 0, layer_count },
                 VK_IMAGE_LAYOUT_UNDEFINED,
@@ -853,7 +820,9 @@ namespace Viry3D
             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
             VK_ACCESS_TRANSFER_READ_BIT);
 
-        Display::Instance()->EndImageCmd();
+        m_upload_token = Display::Instance()->EndImageCmd();
+
+        return m_upload_token;
     }
 
     Texture::Texture():
@@ -862,30 +831,32 @@ namespace Viry3D
         m_format(VK_FORMAT_UNDEFINED),
         m_image(VK_NULL_HANDLE),
         m_image_view(VK_NULL_HANDLE),
-        m_memory(VK_NULL_HANDLE),
         m_sampler(VK_NULL_HANDLE),
+        m_upload_token(0),
         m_mipmap_level_count(1),
         m_dynamic(false),
         m_cubemap(false)
     {
-        Memory::Zero(&m_memory_info, sizeof(m_memory_info));
     }
 
     Texture::~Texture()
     {
-        VkDevice device = Display::Instance()->GetDevice();
+        // pending image cmds are submitted no later than the current frame, which the retire waits for
+        VkSampler sampler = m_sampler;
+        VkImage image = m_image;
+        VkImageView image_view = m_image_view;
+        MemoryAllocation memory = m_memory;
 
-        if (m_image_buffer)
-        {
-            m_image_buffer->Destroy(device);
-            m_image_buffer.reset();
-        }
-        if (m_sampler)
-        {
-            vkDestroySampler(device, m_sampler, nullptr);
-        }
-        vkDestroyImage(device, m_image, nullptr);
-        vkDestroyImageView(device, m_image_view, nullptr);
-        vkFreeMemory(device, m_memory, nullptr);
+        Display::Instance()->RetireResource([=]() mutable {
+            VkDevice device = Display::Instance()->GetDevice();
+
+            if (sampler)
+            {
+                vkDestroySampler(device, sampler, nullptr);
+            }
+            vkDestroyImage(device, image, nullptr);
+            vkDestroyImageView(device, image_view, nullptr);
+            Display::Instance()->FreeMemory(memory);
+        });
     }
 }
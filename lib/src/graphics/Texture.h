@@ -19,6 +19,7 @@
 
 #include "Object.h"
 #include "Display.h"
+#include "MemoryAllocator.h"
 #include "thread/ThreadPool.h"
 
 namespace Viry3D
@@ -126,10 +127,11 @@ namespace Viry3D
         VkImage GetImage() const { return m_image; }
         VkImageView GetImageView() const { return m_image_view; }
         VkSampler GetSampler() const { return m_sampler; }
-        void UpdateTexture2D(const ByteBuffer& pixels, int x, int y, int w, int h);
-        void UpdateCubemap(const ByteBuffer& pixels, CubemapFace face, int level);
-        void UpdateTexture2DArray(const ByteBuffer& pixels, int layer, int level);
-        void CopyTexture(
+        // image cmds are recorded and submitted with the next frame, wait on the token with Display::WaitUpload if needed
+        UploadToken UpdateTexture2D(const ByteBuffer& pixels, int x, int y, int w, int h);
+        UploadToken UpdateCubemap(const ByteBuffer& pixels, CubemapFace face, int level);
+        UploadToken UpdateTexture2DArray(const ByteBuffer& pixels, int layer, int level);
+        UploadToken CopyTexture(
             const Ref<Texture>& src_texture,
             int src_layer, int src_level,
             int src_x, int src_y,
@@ -137,13 +139,15 @@ namespace Viry3D
             int x, int y,
             int w, int h);
         void CopyToMemory(ByteBuffer& pixels, int layer, int level);
-        void GenMipmaps();
+        UploadToken GenMipmaps();
+        UploadToken GetUploadToken() const { return m_upload_token; }
 
     private:
         Texture();
         void CopyBufferToImageBegin();
-        void CopyBufferToImage(const Ref<BufferObject>& image_buffer, int x, int y, int w, int h, int face, int level);
-        void CopyBufferToImageEnd();
+        void CopyPixelsToImage(const ByteBuffer& pixels, int x, int y, int w, int h, int layer, int level);
+        void CopyBufferToImage(const Ref<BufferObject>& image_buffer, int buffer_offset, int x, int y, int w, int h, int face, int level);
+        UploadToken CopyBufferToImageEnd();
         int GetLayerCount();
 
     private:
@@ -156,10 +160,9 @@ namespace Viry3D
         VkFormat m_format;
         VkImage m_image;
         VkImageView m_image_view;
-        VkDeviceMemory m_memory;
-        VkMemoryAllocateInfo m_memory_info;
+        MemoryAllocation m_memory;
         VkSampler m_sampler;
-        Ref<BufferObject> m_image_buffer;
+        UploadToken m_upload_token;
         int m_mipmap_level_count;
         bool m_dynamic;
         bool m_cubemap;
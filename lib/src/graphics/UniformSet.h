@@ -39,7 +39,16 @@ namespace Viry3D
         int stage;
         Vector<UniformMember> members;
         int size;
+        // block is sub allocated from a shared uniform page, offset is bound as dynamic offset
         Ref<BufferObject> buffer;
+        int offset;
+        // cpu copy of the block, written to the gpu once per frame when dirty
+        Vector<byte> data;
+        bool dirty;
+        // block owned by another object and bound here, never written or freed by the owner of the set
+        bool shared;
+        // shader storage block, never allocated by materials, bound as shared through a property block
+        bool storage;
     };
 
     struct UniformTexture
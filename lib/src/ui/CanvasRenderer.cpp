@@ -54,7 +54,7 @@ namespace Viry3D
 
         if (m_draw_buffer)
         {
-            m_draw_buffer->Destroy(Display::Instance()->GetDevice());
+            Display::Instance()->RetireBuffer(m_draw_buffer);
             m_draw_buffer.reset();
         }
 	}
@@ -383,7 +383,7 @@ void main()
         {
             if (!m_mesh || vertices.Size() > m_mesh->GetVertexCount() || indices.Size() > m_mesh->GetIndexCount())
             {
-                m_mesh = RefMake<Mesh>(vertices, indices);
+                m_mesh = RefMake<Mesh>(vertices, indices, Vector<Mesh::Submesh>(), true);
                 this->MarkInstanceCmdDirty();
             }
             else